@@ -0,0 +1,522 @@
+/*
+ * ArrayKernels.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include "ArrayKernels.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_KERNELS
+#include <immintrin.h>
+// Only the functions marked with this are compiled for AVX2, so the rest still run on processors without it
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace ArrayKernels;
+
+namespace
+{
+
+// The operations on single elements, as Block does them, and on vectors of them. No vector instruction multiplies or
+// divides 64-bit integers (before AVX-512), so those are only ever done one at a time
+
+struct Add
+{
+    static long scalar(const long a, const long b) { return a + b; }
+    static double scalar(const double a, const double b) { return a + b; }
+#ifdef SIMD_KERNELS
+    static __m128i sse2(const __m128i a, const __m128i b) { return _mm_add_epi64(a, b); }
+    static __m128d sse2(const __m128d a, const __m128d b) { return _mm_add_pd(a, b); }
+    AVX2 static __m256i avx2(const __m256i a, const __m256i b) { return _mm256_add_epi64(a, b); }
+    AVX2 static __m256d avx2(const __m256d a, const __m256d b) { return _mm256_add_pd(a, b); }
+#endif
+};
+
+// Block takes away by adding the negated value, which gives the same result
+struct Subtract
+{
+    static long scalar(const long a, const long b) { return a - b; }
+    static double scalar(const double a, const double b) { return a - b; }
+#ifdef SIMD_KERNELS
+    static __m128i sse2(const __m128i a, const __m128i b) { return _mm_sub_epi64(a, b); }
+    static __m128d sse2(const __m128d a, const __m128d b) { return _mm_sub_pd(a, b); }
+    AVX2 static __m256i avx2(const __m256i a, const __m256i b) { return _mm256_sub_epi64(a, b); }
+    AVX2 static __m256d avx2(const __m256d a, const __m256d b) { return _mm256_sub_pd(a, b); }
+#endif
+};
+
+struct Multiply
+{
+    static long scalar(const long a, const long b) { return a * b; }
+    static double scalar(const double a, const double b) { return a * b; }
+#ifdef SIMD_KERNELS
+    static __m128d sse2(const __m128d a, const __m128d b) { return _mm_mul_pd(a, b); }
+    AVX2 static __m256d avx2(const __m256d a, const __m256d b) { return _mm256_mul_pd(a, b); }
+#endif
+};
+
+struct Divide
+{
+    static long scalar(const long a, const long b) { return a / b; }
+    static double scalar(const double a, const double b) { return a / b; }
+#ifdef SIMD_KERNELS
+    static __m128d sse2(const __m128d a, const __m128d b) { return _mm_div_pd(a, b); }
+    AVX2 static __m256d avx2(const __m256d a, const __m256d b) { return _mm256_div_pd(a, b); }
+#endif
+};
+
+// As std::min(a, b) and std::max(a, b), which keep a unless b is strictly smaller or larger. MINPD and MAXPD keep
+// their second operand unless the first is, so they are given b first. SSE2 can't compare 64-bit integers
+struct Minimum
+{
+    static long scalar(const long a, const long b) { return b < a ? b : a; }
+    static double scalar(const double a, const double b) { return b < a ? b : a; }
+#ifdef SIMD_KERNELS
+    static __m128d sse2(const __m128d a, const __m128d b) { return _mm_min_pd(b, a); }
+    AVX2 static __m256i avx2(const __m256i a, const __m256i b)
+    {
+        return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+    }
+    AVX2 static __m256d avx2(const __m256d a, const __m256d b) { return _mm256_min_pd(b, a); }
+#endif
+};
+
+struct Maximum
+{
+    static long scalar(const long a, const long b) { return a < b ? b : a; }
+    static double scalar(const double a, const double b) { return a < b ? b : a; }
+#ifdef SIMD_KERNELS
+    static __m128d sse2(const __m128d a, const __m128d b) { return _mm_max_pd(b, a); }
+    AVX2 static __m256i avx2(const __m256i a, const __m256i b)
+    {
+        return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a));
+    }
+    AVX2 static __m256d avx2(const __m256d a, const __m256d b) { return _mm256_max_pd(b, a); }
+#endif
+};
+
+#ifdef SIMD_KERNELS
+inline __m128i load2(const long * const a) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(a)); }
+inline __m128d load2(const double * const a) { return _mm_loadu_pd(a); }
+inline void store2(long * const a, const __m128i value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(a), value); }
+inline void store2(double * const a, const __m128d value) { _mm_storeu_pd(a, value); }
+AVX2 inline __m256i load4(const long * const a) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)); }
+AVX2 inline __m256d load4(const double * const a) { return _mm256_loadu_pd(a); }
+AVX2 inline void store4(long * const a, const __m256i value)
+{
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(a), value);
+}
+AVX2 inline void store4(double * const a, const __m256d value) { _mm256_storeu_pd(a, value); }
+#endif
+
+// Where the second operand of each element comes from: the elements of another array, or the same value for all of them
+
+template <typename T>
+struct Elements
+{
+    const T * const b;
+    explicit Elements(const T * const b) : b(b) {}
+    T at(const unsigned i) const { return b[i]; }
+#ifdef SIMD_KERNELS
+    void sse2(const unsigned i, __m128i & value) const { value = load2(b + i); }
+    void sse2(const unsigned i, __m128d & value) const { value = load2(b + i); }
+    AVX2 void avx2(const unsigned i, __m256i & value) const { value = load4(b + i); }
+    AVX2 void avx2(const unsigned i, __m256d & value) const { value = load4(b + i); }
+#endif
+};
+
+struct IntegerValue
+{
+    const long b;
+    explicit IntegerValue(const long b) : b(b) {}
+    long at(unsigned) const { return b; }
+#ifdef SIMD_KERNELS
+    void sse2(unsigned, __m128i & value) const { value = _mm_set1_epi64x(b); }
+    AVX2 void avx2(unsigned, __m256i & value) const { value = _mm256_set1_epi64x(b); }
+#endif
+};
+
+struct RealValue
+{
+    const double b;
+    explicit RealValue(const double b) : b(b) {}
+    double at(unsigned) const { return b; }
+#ifdef SIMD_KERNELS
+    void sse2(unsigned, __m128d & value) const { value = _mm_set1_pd(b); }
+    AVX2 void avx2(unsigned, __m256d & value) const { value = _mm256_set1_pd(b); }
+#endif
+};
+
+// The products of the matching elements of two arrays of reals, for dot products
+struct RealProducts
+{
+    const double * const a, * const b;
+    RealProducts(const double * const a, const double * const b) : a(a), b(b) {}
+    double at(const unsigned i) const { return a[i] * b[i]; }
+#ifdef SIMD_KERNELS
+    void sse2(const unsigned i, __m128d & value) const { value = _mm_mul_pd(load2(a + i), load2(b + i)); }
+    AVX2 void avx2(const unsigned i, __m256d & value) const { value = _mm256_mul_pd(load4(a + i), load4(b + i)); }
+#endif
+};
+
+// Reals are reduced into this many lanes, whichever kernels are used
+const unsigned laneCount = 8;
+
+// Combines the lanes in a fixed order: each with the one four along, then two along, then one along
+template <typename Operation>
+double combinedLanes(double * const lanes)
+{
+    for (unsigned width = laneCount / 2; width > 0; width /= 2)
+    {
+        for (unsigned i = 0; i < width; ++i) lanes[i] = Operation::scalar(lanes[i], lanes[i + width]);
+    }
+    return lanes[0];
+}
+
+// The kernels for each level. Each applies Operation to every element, reduces integers in any order (as they give the
+// same result in any order), and reduces reals into the lanes
+
+struct Scalar
+{
+    template <typename Operation, typename T, typename Source>
+    static void apply(T * const a, const Source & b, const unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i) a[i] = Operation::scalar(a[i], b.at(i));
+    }
+
+    template <typename Operation>
+    static long reduceIntegers(long total, const long * const a, const unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i) total = Operation::scalar(total, a[i]);
+        return total;
+    }
+
+    template <typename Operation, typename Source>
+    static void reduceReals(double * const lanes, const Source & a, const unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i) lanes[i % laneCount] = Operation::scalar(lanes[i % laneCount], a.at(i));
+    }
+};
+
+#ifdef SIMD_KERNELS
+
+struct Sse2
+{
+    template <typename Operation, typename T, typename Source>
+    static void apply(T * const a, const Source & b, const unsigned count)
+    {
+        unsigned i = 0;
+        typename Vector<T>::Type value;
+        for (; i + 2 <= count; i += 2)
+        {
+            b.sse2(i, value);
+            store2(a + i, Operation::sse2(load2(a + i), value));
+        }
+        for (; i < count; ++i) a[i] = Operation::scalar(a[i], b.at(i));
+    }
+
+    template <typename Operation>
+    static long reduceIntegers(const long total, const long * const a, const unsigned count)
+    {
+        return Scalar::reduceIntegers<Operation>(total, a, count);
+    }
+
+    template <typename Operation, typename Source>
+    static void reduceReals(double * const lanes, const Source & a, const unsigned count)
+    {
+        __m128d sums[laneCount / 2], value;
+        for (unsigned j = 0; j < laneCount / 2; ++j) sums[j] = load2(lanes + j * 2);
+        unsigned i = 0;
+        for (; i + laneCount <= count; i += laneCount)
+        {
+            for (unsigned j = 0; j < laneCount / 2; ++j)
+            {
+                a.sse2(i + j * 2, value);
+                sums[j] = Operation::sse2(sums[j], value);
+            }
+        }
+        for (unsigned j = 0; j < laneCount / 2; ++j) store2(lanes + j * 2, sums[j]);
+        for (; i < count; ++i) lanes[i % laneCount] = Operation::scalar(lanes[i % laneCount], a.at(i));
+    }
+
+private:
+    template <typename T> struct Vector;
+};
+
+template <> struct Sse2::Vector<long> { typedef __m128i Type; };
+template <> struct Sse2::Vector<double> { typedef __m128d Type; };
+
+template <>
+long Sse2::reduceIntegers<Add>(const long total, const long * const a, const unsigned count)
+{
+    __m128i sum = _mm_setzero_si128();
+    unsigned i = 0;
+    for (; i + 2 <= count; i += 2) sum = _mm_add_epi64(sum, load2(a + i));
+    long sums[2];
+    store2(sums, sum);
+    return Scalar::reduceIntegers<Add>(total + sums[0] + sums[1], a + i, count - i);
+}
+
+struct Avx2
+{
+    template <typename Operation, typename T, typename Source>
+    AVX2 static void apply(T * const a, const Source & b, const unsigned count)
+    {
+        unsigned i = 0;
+        typename Vector<T>::Type value;
+        for (; i + 4 <= count; i += 4)
+        {
+            b.avx2(i, value);
+            store4(a + i, Operation::avx2(load4(a + i), value));
+        }
+        for (; i < count; ++i) a[i] = Operation::scalar(a[i], b.at(i));
+    }
+
+    template <typename Operation>
+    AVX2 static long reduceIntegers(const long total, const long * const a, const unsigned count)
+    {
+        if (count < 8) return Scalar::reduceIntegers<Operation>(total, a, count);
+
+        __m256i result = load4(a);
+        unsigned i = 4;
+        for (; i + 4 <= count; i += 4) result = Operation::avx2(result, load4(a + i));
+        long results[4];
+        store4(results, result);
+        return Scalar::reduceIntegers<Operation>(Scalar::reduceIntegers<Operation>(total, results, 4), a + i,
+                                                 count - i);
+    }
+
+    template <typename Operation, typename Source>
+    AVX2 static void reduceReals(double * const lanes, const Source & a, const unsigned count)
+    {
+        __m256d low = load4(lanes), high = load4(lanes + 4), value;
+        unsigned i = 0;
+        for (; i + laneCount <= count; i += laneCount)
+        {
+            a.avx2(i, value);
+            low = Operation::avx2(low, value);
+            a.avx2(i + 4, value);
+            high = Operation::avx2(high, value);
+        }
+        store4(lanes, low);
+        store4(lanes + 4, high);
+        for (; i < count; ++i) lanes[i % laneCount] = Operation::scalar(lanes[i % laneCount], a.at(i));
+    }
+
+private:
+    template <typename T> struct Vector;
+};
+
+template <> struct Avx2::Vector<long> { typedef __m256i Type; };
+template <> struct Avx2::Vector<double> { typedef __m256d Type; };
+
+#endif
+
+template <typename Kernel, typename Source>
+void applyToIntegers(const Operation operation, long * const a, const Source & b, const unsigned count)
+{
+    switch (operation)
+    {
+    case O_ADD:      Kernel::template apply<Add>(a, b, count); break;
+    case O_SUBTRACT: Kernel::template apply<Subtract>(a, b, count); break;
+    case O_MULTIPLY: Scalar::apply<Multiply>(a, b, count); break;
+    default:         Scalar::apply<Divide>(a, b, count); break;
+    }
+}
+
+template <typename Kernel, typename Source>
+void applyToReals(const Operation operation, double * const a, const Source & b, const unsigned count)
+{
+    switch (operation)
+    {
+    case O_ADD:      Kernel::template apply<Add>(a, b, count); break;
+    case O_SUBTRACT: Kernel::template apply<Subtract>(a, b, count); break;
+    case O_MULTIPLY: Kernel::template apply<Multiply>(a, b, count); break;
+    default:         Kernel::template apply<Divide>(a, b, count); break;
+    }
+}
+
+template <typename Kernel>
+void applyIntegerElements(const Operation operation, long * const a, const long * const b, const unsigned count)
+{
+    applyToIntegers<Kernel>(operation, a, Elements<long>(b), count);
+}
+
+template <typename Kernel>
+void applyIntegerValue(const Operation operation, long * const a, const long b, const unsigned count)
+{
+    applyToIntegers<Kernel>(operation, a, IntegerValue(b), count);
+}
+
+template <typename Kernel>
+void applyRealElements(const Operation operation, double * const a, const double * const b, const unsigned count)
+{
+    applyToReals<Kernel>(operation, a, Elements<double>(b), count);
+}
+
+template <typename Kernel>
+void applyRealValue(const Operation operation, double * const a, const double b, const unsigned count)
+{
+    applyToReals<Kernel>(operation, a, RealValue(b), count);
+}
+
+template <typename Kernel>
+long reduceIntegers(const Opcodes::Reduction reduction, const long initial, const long * const a,
+                    const unsigned count)
+{
+    switch (reduction)
+    {
+    case Opcodes::R_ADD:     return Kernel::template reduceIntegers<Add>(initial, a, count);
+    case Opcodes::R_MINIMUM: return Kernel::template reduceIntegers<Minimum>(initial, a, count);
+    default:                 return Kernel::template reduceIntegers<Maximum>(initial, a, count);
+    }
+}
+
+// Sums start each lane at -0.0, which is the only value that adding leaves every real unchanged by
+template <typename Kernel>
+double reduceReals(const Opcodes::Reduction reduction, const double initial, const double * const a,
+                   const unsigned count)
+{
+    double lanes[laneCount];
+    const Elements<double> elements(a);
+    switch (reduction)
+    {
+    case Opcodes::R_ADD:
+        for (unsigned i = 0; i < laneCount; ++i) lanes[i] = -0.0;
+        Kernel::template reduceReals<Add>(lanes, elements, count);
+        return initial + combinedLanes<Add>(lanes);
+    case Opcodes::R_MINIMUM:
+        for (unsigned i = 0; i < laneCount; ++i) lanes[i] = initial;
+        Kernel::template reduceReals<Minimum>(lanes, elements, count);
+        return combinedLanes<Minimum>(lanes);
+    default:
+        for (unsigned i = 0; i < laneCount; ++i) lanes[i] = initial;
+        Kernel::template reduceReals<Maximum>(lanes, elements, count);
+        return combinedLanes<Maximum>(lanes);
+    }
+}
+
+template <typename Kernel>
+double realDotProduct(const double * const a, const double * const b, const unsigned count)
+{
+    double lanes[laneCount];
+    for (unsigned i = 0; i < laneCount; ++i) lanes[i] = -0.0;
+    Kernel::template reduceReals<Add>(lanes, RealProducts(a, b), count);
+    return combinedLanes<Add>(lanes);
+}
+
+struct Kernels
+{
+    Level level;
+    void (*applyIntegerElements)(Operation, long *, const long *, unsigned);
+    void (*applyIntegerValue)(Operation, long *, long, unsigned);
+    void (*applyRealElements)(Operation, double *, const double *, unsigned);
+    void (*applyRealValue)(Operation, double *, double, unsigned);
+    long (*reduceIntegers)(Opcodes::Reduction, long, const long *, unsigned);
+    double (*reduceReals)(Opcodes::Reduction, double, const double *, unsigned);
+    double (*realDotProduct)(const double *, const double *, unsigned);
+};
+
+template <typename Kernel>
+Kernels kernelsFor(const Level level)
+{
+    Kernels kernels;
+    kernels.level = level;
+    kernels.applyIntegerElements = &applyIntegerElements<Kernel>;
+    kernels.applyIntegerValue = &applyIntegerValue<Kernel>;
+    kernels.applyRealElements = &applyRealElements<Kernel>;
+    kernels.applyRealValue = &applyRealValue<Kernel>;
+    kernels.reduceIntegers = &reduceIntegers<Kernel>;
+    kernels.reduceReals = &reduceReals<Kernel>;
+    kernels.realDotProduct = &realDotProduct<Kernel>;
+    return kernels;
+}
+
+Kernels chosenKernels()
+{
+#ifdef SIMD_KERNELS
+    // This runs before main, which is too early for the builtins to have found out what the processor supports
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return kernelsFor<Avx2>(L_AVX2);
+    return kernelsFor<Sse2>(L_SSE2); // Every x86-64 processor has SSE2
+#else
+    return kernelsFor<Scalar>(L_SCALAR);
+#endif
+}
+
+const Kernels kernelsInUse = chosenKernels();
+
+// Integers in a block only keep 48 bits in a COMPACT_BLOCKS build, so results are cut down the same way
+inline long keptInBlock(const long value)
+{
+#ifdef COMPACT_BLOCKS
+    return static_cast<long>(static_cast<unsigned long>(value) << 16) >> 16;
+#else
+    return value;
+#endif
+}
+
+inline void keepInBlocks(long * const a, const unsigned count)
+{
+#ifdef COMPACT_BLOCKS
+    for (unsigned i = 0; i < count; ++i) a[i] = keptInBlock(a[i]);
+#else
+    (void)a;
+    (void)count;
+#endif
+}
+
+}
+
+Level ArrayKernels::level()
+{
+    return kernelsInUse.level;
+}
+
+void ArrayKernels::apply(const Operation operation, long * const a, const long * const b, const unsigned count)
+{
+    kernelsInUse.applyIntegerElements(operation, a, b, count);
+    keepInBlocks(a, count);
+}
+
+void ArrayKernels::apply(const Operation operation, double * const a, const double * const b, const unsigned count)
+{
+    kernelsInUse.applyRealElements(operation, a, b, count);
+}
+
+void ArrayKernels::apply(const Operation operation, long * const a, const long b, const unsigned count)
+{
+    kernelsInUse.applyIntegerValue(operation, a, b, count);
+    keepInBlocks(a, count);
+}
+
+void ArrayKernels::apply(const Operation operation, double * const a, const double b, const unsigned count)
+{
+    kernelsInUse.applyRealValue(operation, a, b, count);
+}
+
+long ArrayKernels::reduce(const Opcodes::Reduction reduction, const long initial, const long * const a,
+                          const unsigned count)
+{
+    return keptInBlock(kernelsInUse.reduceIntegers(reduction, initial, a, count));
+}
+
+double ArrayKernels::reduce(const Opcodes::Reduction reduction, const double initial, const double * const a,
+                            const unsigned count)
+{
+    return kernelsInUse.reduceReals(reduction, initial, a, count);
+}
+
+long ArrayKernels::dot(const long * const a, const long * const b, const unsigned count)
+{
+    long total = 0;
+    for (unsigned i = 0; i < count; ++i) total += a[i] * b[i];
+    return keptInBlock(total);
+}
+
+double ArrayKernels::dot(const double * const a, const double * const b, const unsigned count)
+{
+    return kernelsInUse.realDotProduct(a, b, count);
+}
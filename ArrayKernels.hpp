@@ -0,0 +1,58 @@
+/*
+ * ArrayKernels.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef ARRAYKERNELS_HPP
+#define ARRAYKERNELS_HPP
+
+#include "Opcodes.hpp"
+
+// Loops over the elements of packed arrays of integers or reals, where they are stored without type tags (see
+// ManagedHeap), for the bulk array instructions and preduce. There are scalar versions of each, and SSE2 and AVX2
+// versions on x86-64, of which the best the processor supports is picked when the program starts.
+// Whichever are picked, the results are the same. Each element is worked out just as Machine::_add and the rest would
+// work it out, and reals are summed in eight lanes (element i going to lane i mod 8) that are then added together in a
+// fixed order, so the rounding doesn't depend on the processor. Integers wrap around as they do in a block, so in a
+// COMPACT_BLOCKS build they are kept to 48 bits
+
+namespace ArrayKernels
+{
+
+enum Operation
+{
+    O_ADD = 0,
+    O_SUBTRACT,
+    O_MULTIPLY,
+    O_DIVIDE
+};
+
+enum Level
+{
+    L_SCALAR = 0,
+    L_SSE2,
+    L_AVX2
+};
+
+Level level(); // The kernels in use
+
+// Replaces each element of a with it operated on by the matching element of b, or by b itself
+void apply(Operation operation, long * a, const long * b, unsigned count);
+void apply(Operation operation, double * a, const double * b, unsigned count);
+void apply(Operation operation, long * a, long b, unsigned count);
+void apply(Operation operation, double * a, double b, unsigned count);
+
+// Combines initial with every element of a. Only R_ADD, R_MINIMUM and R_MAXIMUM are handled, minimums and maximums
+// being taken as std::min and std::max take them
+long reduce(Opcodes::Reduction reduction, long initial, const long * a, unsigned count);
+double reduce(Opcodes::Reduction reduction, double initial, const double * a, unsigned count);
+
+// The sum of the products of the matching elements of a and b
+long dot(const long * a, const long * b, unsigned count);
+double dot(const double * a, const double * b, unsigned count);
+
+}
+
+#endif // ARRAYKERNELS_HPP
@@ -0,0 +1,194 @@
+/*
+ * BatchRunner.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+#include <exception>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "BatchRunner.hpp"
+#include "Machine.hpp"
+#include "Program.hpp"
+
+double secondsNow()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + (now.tv_usec / 1000000.0);
+}
+
+void BatchRunner::JobQueue::push(const unsigned job)
+{
+    Mutex::Lock lock(mutex);
+    jobs.push_back(job);
+}
+
+bool BatchRunner::JobQueue::popBack(unsigned & job)
+{
+    Mutex::Lock lock(mutex);
+    if (jobs.empty()) return false;
+    job = jobs.back();
+    jobs.pop_back();
+    return true;
+}
+
+bool BatchRunner::JobQueue::popFront(unsigned & job)
+{
+    Mutex::Lock lock(mutex);
+    if (jobs.empty()) return false;
+    job = jobs.front();
+    jobs.pop_front();
+    return true;
+}
+
+BatchRunner::BatchRunner(const Program & program, unsigned workerCount,
+                         const ManagedHeap::CollectionMode collectionMode, const unsigned optionCount,
+                         const Interpreter::Option * const options)
+    : program(program), collectionMode(collectionMode), options(options, options + optionCount), elapsedSeconds_(0.0)
+{
+    if (workerCount == 0)
+    {
+        const long processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+        workerCount = processorCount > 0 ? processorCount : 1;
+    }
+
+    queues.reserve(workerCount);
+    for (unsigned i = 0; i < workerCount; ++i) queues.push_back(new JobQueue);
+    const WorkerStatistics noStatistics = { 0, 0, 0, 0.0 };
+    statistics.assign(workerCount, noStatistics);
+}
+
+BatchRunner::~BatchRunner()
+{
+    for (unsigned i = 0; i < queues.size(); ++i) delete queues[i];
+}
+
+void BatchRunner::add(std::istream & input, std::ostream & output)
+{
+    const Job job = { &input, &output };
+    jobs.push_back(job);
+}
+
+void BatchRunner::run()
+{
+    const unsigned count = workerCount();
+    const WorkerStatistics noStatistics = { 0, 0, 0, 0.0 };
+    statistics.assign(count, noStatistics);
+
+    // Dealt out in contiguous runs, so that a thief takes the jobs furthest from the ones its victim is working on
+    for (unsigned i = 0; i < jobs.size(); ++i) queues[static_cast<unsigned long>(i) * count / jobs.size()]->push(i);
+
+    const double start = secondsNow();
+    std::vector<Worker> workers(count);
+    unsigned started = 0;
+    for (; started < count; ++started)
+    {
+        workers[started].runner = this;
+        workers[started].index = started;
+        if (pthread_create(&workers[started].thread, NULL, &runWorker, &workers[started]) != 0) break;
+    }
+    // If a thread couldn't be started, the ones that were take its jobs instead
+    for (unsigned i = 0; i < started; ++i) pthread_join(workers[i].thread, NULL);
+    elapsedSeconds_ = secondsNow() - start;
+
+    jobs.clear();
+    if (started == 0) throw(std::runtime_error("BatchRunner::run: No worker threads could be started"));
+}
+
+unsigned BatchRunner::workerCount() const
+{
+    return queues.size();
+}
+
+const std::vector<BatchRunner::WorkerStatistics> & BatchRunner::workerStatistics() const
+{
+    return statistics;
+}
+
+double BatchRunner::elapsedSeconds() const
+{
+    return elapsedSeconds_;
+}
+
+void BatchRunner::reportStatistics(std::ostream & stream) const
+{
+    unsigned jobCount = 0;
+    for (unsigned i = 0; i < statistics.size(); ++i)
+    {
+        const WorkerStatistics & worker = statistics[i];
+        stream << "Worker " << i << ": " << worker.jobCount << " jobs (" << worker.stolenCount << " stolen, "
+               << worker.failedCount << " failed), "
+               << (elapsedSeconds_ > 0.0 ? worker.busySeconds / elapsedSeconds_ * 100.0 : 0.0) << "% busy"
+               << std::endl;
+        jobCount += worker.jobCount;
+    }
+    stream << "Jobs: " << jobCount << " in " << elapsedSeconds_ * 1000.0 << " ms" << std::endl
+           << "Jobs per second: " << (elapsedSeconds_ > 0.0 ? jobCount / elapsedSeconds_ : 0.0) << std::endl;
+}
+
+void * BatchRunner::runWorker(void * const worker)
+{
+    Worker & self = *static_cast<Worker*>(worker);
+    self.runner->work(self.index);
+    return NULL;
+}
+
+void BatchRunner::work(const unsigned workerIndex)
+{
+    WorkerStatistics & own = statistics[workerIndex];
+
+    // Built on the worker's own thread, so that its memory is local to where it runs
+    Machine machine(0, 0, 0, collectionMode);
+    Interpreter * interpreter = NULL;
+    std::string bindError;
+    try
+    {
+        interpreter = new Interpreter(machine, program, options.size(), options.empty() ? NULL : &options[0]);
+        interpreter->setParallelWorkerCount(1); // The other workers are keeping the other processors busy
+    }
+    catch (const std::exception & e) { bindError = e.what(); }
+
+    unsigned job;
+    while (takeJob(workerIndex, job))
+    {
+        const double start = secondsNow();
+        std::ostream & output = *jobs[job].output;
+        bool succeeded = false;
+        if (interpreter != NULL)
+        {
+            machine.setInput(*jobs[job].input);
+            machine.setOutput(output);
+            try { succeeded = interpreter->runWithoutOptions(); }
+            catch (const std::exception & e) { output << e.what() << std::endl << "Execution halted" << std::endl; }
+            machine.flush();
+        }
+        else output << bindError << std::endl << "Execution halted" << std::endl;
+
+        ++own.jobCount;
+        if (!succeeded) ++own.failedCount;
+        own.busySeconds += secondsNow() - start;
+    }
+
+    delete interpreter;
+}
+
+bool BatchRunner::takeJob(const unsigned workerIndex, unsigned & job)
+{
+    if (queues[workerIndex]->popBack(job)) return true;
+
+    // No jobs are added while running, so once every queue has been found empty there is nothing left to do
+    const unsigned count = workerCount();
+    for (unsigned i = 1; i < count; ++i)
+    {
+        if (queues[(workerIndex + i) % count]->popFront(job))
+        {
+            ++statistics[workerIndex].stolenCount;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,98 @@
+/*
+ * BatchRunner.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef BATCHRUNNER_HPP
+#define BATCHRUNNER_HPP
+
+#include <vector>
+#include <deque>
+#include <iostream>
+#include <pthread.h>
+
+#include "Interpreter.hpp"
+#include "ManagedHeap.hpp"
+#include "Mutex.hpp"
+
+class Program;
+
+// Runs a program once for each of a batch of inputs, in parallel. Each worker thread keeps one Machine and Interpreter
+// for all of its jobs, so the bytecode stays quickened and hot code stays compiled from one job to the next (the
+// machine is flushed in between). Jobs are dealt out evenly to begin with, and a worker that runs out steals from the
+// front of another's queue, so that long jobs don't leave the other workers idle
+
+class BatchRunner
+{
+public:
+    struct WorkerStatistics
+    {
+        unsigned jobCount, stolenCount, failedCount;
+        double busySeconds; // Time spent running jobs, as opposed to looking for them
+    };
+
+    // workerCount is the number of threads to run, or 0 for one per processor. Options are as for the Interpreter,
+    // although only O_DISABLE_JIT has any effect
+    BatchRunner(const Program & program, unsigned workerCount = 0,
+                ManagedHeap::CollectionMode collectionMode = ManagedHeap::CM_REFERENCE_COUNTING,
+                unsigned optionCount = 0, const Interpreter::Option * options = NULL);
+    ~BatchRunner();
+
+    // Queues a run of the program that reads from input and writes to output (including any error that halts it).
+    // Both must outlive the call to run, and must not be shared with another job
+    void add(std::istream & input, std::ostream & output);
+    // Runs every job that has been added, returning once they have all finished. Throws if a worker can't be started
+    void run();
+
+    unsigned workerCount() const;
+    const std::vector<WorkerStatistics> & workerStatistics() const; // From the last call to run
+    double elapsedSeconds() const;
+    void reportStatistics(std::ostream & stream) const; // Each worker's jobs and utilisation, then jobs per second
+
+private:
+    struct Job
+    {
+        std::istream * input;
+        std::ostream * output;
+    };
+
+    // A worker's jobs. Its owner takes from the back and thieves take from the front, so they only contend when it's
+    // nearly empty
+    class JobQueue
+    {
+    public:
+        void push(unsigned job);
+        bool popBack(unsigned & job);
+        bool popFront(unsigned & job);
+
+    private:
+        Mutex mutex;
+        std::deque<unsigned> jobs;
+    };
+
+    struct Worker
+    {
+        BatchRunner * runner;
+        unsigned index;
+        pthread_t thread;
+    };
+
+    const Program & program;
+    const ManagedHeap::CollectionMode collectionMode;
+    std::vector<Interpreter::Option> options;
+    std::vector<Job> jobs;
+    std::vector<JobQueue*> queues; // Pointers, as a Mutex can't be copied
+    std::vector<WorkerStatistics> statistics;
+    double elapsedSeconds_;
+
+    static void * runWorker(void * worker);
+    void work(unsigned workerIndex);
+    bool takeJob(unsigned workerIndex, unsigned & job);
+
+    BatchRunner(const BatchRunner &);
+    BatchRunner & operator =(const BatchRunner &);
+};
+
+#endif // BATCHRUNNER_HPP
@@ -19,9 +19,27 @@ Block::Block()
 Block::Block(const Block & other)
 {
     init();
-    if (other.dataType_ != DATA_TYPE_COUNT) *this = other;
+    if (other.dataType() != DATA_TYPE_COUNT) *this = other;
 }
 
+#ifdef COMPACT_BLOCKS
+
+Block::Block(const Integer value)
+    : word(tagged(DT_INTEGER, value)) {}
+
+Block::Block(const Real value)
+{
+    setRealData(value);
+}
+
+Block::Block(const Char value)
+    : word(tagged(DT_CHAR, static_cast<unsigned char>(value))) {}
+
+Block::Block(const Boolean value)
+    : word(tagged(DT_BOOLEAN, value)) {}
+
+#else
+
 Block::Block(const Integer value)
     : dataType_(DT_INTEGER), integerData_(value) {}
 
@@ -34,6 +52,8 @@ Block::Block(const Char value)
 Block::Block(const Boolean value)
     : dataType_(DT_BOOLEAN), booleanData_(value) {}
 
+#endif
+
 Block::Block(const int address, Heap & heap)
 {
     init();
@@ -46,116 +66,87 @@ Block::Block(const DataType dataType)
     setTo(dataType);
 }
 
-Block::~Block()
-{
-    nullifyPointerData();
-}
-
-Block::DataType Block::dataType() const
-{
-    return dataType_;
-}
-
-long Block::integerData() const
-{
-    return integerData_;
-}
-
-void Block::setIntegerData(const long data)
-{
-    integerData_ = data;
-}
-
-void Block::addToIntegerData(const long amount)
-{
-    integerData_ += amount;
-}
-
-void Block::multiplyIntegerData(const long amount)
-{
-    integerData_ *= amount;
-}
-
 void Block::divideIntegerData(const long amount)
 {
-    integerData_ /= amount;
+    setIntegerData(integerData() / amount);
 }
 
 void Block::modIntegerData(const long amount)
 {
-    integerData_ %= amount;
+    setIntegerData(integerData() % amount);
 }
 
 void Block::negateIntegerData()
 {
-    integerData_ = -integerData_;
+    setIntegerData(-integerData());
 }
 
-double Block::realData() const
+void Block::divideRealData(const double amount)
 {
-    return realData_;
+    setRealData(realData() / amount);
 }
 
-void Block::setRealData(const double data)
+void Block::modRealData(const double amount)
 {
-    realData_ = data;
+    setRealData(fmod(realData(), amount));
 }
 
-void Block::addToRealData(const double amount)
+void Block::negateRealData()
 {
-    realData_ += amount;
+    setRealData(-realData());
 }
 
-void Block::multiplyRealData(const double amount)
+void Block::divideCharData(const char amount)
 {
-    realData_ *= amount;
+    setCharData(charData() / amount);
 }
 
-void Block::divideRealData(const double amount)
+void Block::modCharData(const char amount)
 {
-    realData_ /= amount;
+    setCharData(charData() % amount);
 }
 
-void Block::modRealData(const double amount)
-{
-    realData_ = fmod(realData_, amount);
-}
+#ifdef COMPACT_BLOCKS
 
-void Block::negateRealData()
+bool Block::booleanData() const
 {
-    realData_ = -realData_;
+    return (word & 1) != 0;
 }
 
-char Block::charData() const
+void Block::setBooleanData(const bool data)
 {
-    return charData_;
+    word = tagged(DT_BOOLEAN, data);
 }
 
-void Block::setCharData(const char data)
+int Block::pointerAddress() const
 {
-    charData_ = data;
+    return static_cast<int>(static_cast<unsigned>(word));
 }
 
-void Block::addToCharData(const char amount)
+void Block::setPointerAddress(const int data)
 {
-    charData_ += amount;
+    word = (word & ~0xFFFFFFFFul) | static_cast<unsigned>(data);
 }
 
-void Block::multiplyCharData(const char amount)
+Heap * Block::pointerHeap() const
 {
-    charData_ *= amount;
+    if (dataType() != DT_POINTER) return NULL;
+    return Heap::withId((word >> 32) & 0xFFFF);
 }
 
-void Block::divideCharData(const char amount)
+void Block::setPointerData(const int address, Heap * const heap)
 {
-    charData_ /= amount;
+    const unsigned long heapId = heap == NULL ? 0 : heap->id;
+    word = tagged(DT_POINTER, (heapId << 32) | static_cast<unsigned>(address));
 }
 
-void Block::modCharData(const char amount)
+void Block::init()
 {
-    charData_ %= amount;
+    word = tagged(DT_INTEGER, 0);
 }
 
+#else
+
 bool Block::booleanData() const
 {
     return booleanData_;
@@ -182,81 +173,122 @@ Heap * Block::pointerHeap() const
     return pointerData.heap;
 }
 
+void Block::setPointerData(const int address, Heap * const heap)
+{
+    pointerData.address = address;
+    pointerData.heap = heap;
+}
+
+void Block::init()
+{
+    pointerData.address = -1;
+    pointerData.heap = NULL;
+    dataType_ = DT_INTEGER;
+}
+
+#endif
+
 bool Block::pointerIsNull() const
 {
-    if (dataType_ != DT_POINTER) return true;
-    return (pointerData.address < 0) || (pointerData.heap == NULL);
+    if (dataType() != DT_POINTER) return true;
+    return (pointerAddress() < 0) || (pointerHeap() == NULL);
+}
+
+ManagedHeap * Block::pointerManagedHeap() const
+{
+    if (pointerIsNull()) return NULL;
+    Heap * const heap = pointerHeap();
+    return heap->isManaged() ? static_cast<ManagedHeap*>(heap) : NULL;
 }
 
 unsigned Block::pointerArrayLength() const
 {
-    if (pointerIsNull()) return 0;
-    ManagedHeap * managedHeap = dynamic_cast<ManagedHeap*>(pointerData.heap);
+    ManagedHeap * managedHeap = pointerManagedHeap();
     if (managedHeap == NULL) return 0;
-    return managedHeap->arrayLengthAt(pointerData.address);
+    return managedHeap->arrayLengthAt(pointerAddress());
 }
 
 Block * Block::pointerArrayElementAt(const unsigned index) const
 {
-    if (pointerIsNull() || (index >= pointerArrayLength())) return NULL;
-    return &pointerData.heap->blockAt(pointerData.address + index);
+    ManagedHeap * managedHeap = pointerManagedHeap();
+    if (managedHeap == NULL) return NULL;
+    const unsigned address = pointerAddress();
+    if ((index >= managedHeap->arrayLengthAt(address)) || ((index > 0) && managedHeap->arrayIsPackedAt(address)))
+        return NULL;
+    return &managedHeap->blockAt(address + index);
 }
 
 Block * Block::pointerDataPointedTo() const
 {
     if (pointerIsNull()) return NULL;
-    return &pointerData.heap->blockAt(pointerData.address);
+    return &pointerHeap()->blockAt(pointerAddress());
 }
 
 void Block::nullifyPointerData(const bool decReference)
 {
-    if ((dataType_ == DT_POINTER) && (pointerData.heap != NULL) && decReference)
-        pointerData.heap->decReferenceCountAt(pointerData.address);
-    pointerData.address = -1;
-    pointerData.heap = NULL;
+    if (dataType() != DT_POINTER) return;
+
+    // Cleared before the reference count is changed, as that can free an array that leads back to this block
+    Heap * const heap = pointerHeap();
+    const int address = pointerAddress();
+    setPointerData(-1, NULL);
+    if ((heap != NULL) && decReference && heap->countsReferences()) heap->decReferenceCountAt(address);
 }
 
+// In the compact representation, setting a value sets the data type along with it
 void Block::setToInteger(const long data)
 {
     nullifyPointerData();
+#ifndef COMPACT_BLOCKS
     dataType_ = DT_INTEGER;
-    integerData_ = data;
+#endif
+    setIntegerData(data);
 }
 
 void Block::setToReal(const double data)
 {
     nullifyPointerData();
+#ifndef COMPACT_BLOCKS
     dataType_ = DT_REAL;
-    realData_ = data;
+#endif
+    setRealData(data);
 }
 
 void Block::setToChar(const char data)
 {
     nullifyPointerData();
+#ifndef COMPACT_BLOCKS
     dataType_ = DT_CHAR;
-    charData_ = data;
+#endif
+    setCharData(data);
 }
 
 void Block::setToBoolean(const bool data)
 {
     nullifyPointerData();
+#ifndef COMPACT_BLOCKS
     dataType_ = DT_BOOLEAN;
-    booleanData_ = data;
+#endif
+    setBooleanData(data);
 }
 
 void Block::setToPointer(const int address, Heap & heap)
 {
     nullifyPointerData();
+#ifndef COMPACT_BLOCKS
     dataType_ = DT_POINTER;
-    pointerData.address = address;
-    pointerData.heap = &heap;
-    heap.incReferenceCountAt(address);
+#endif
+    setPointerData(address, &heap);
+    if (heap.countsReferences()) heap.incReferenceCountAt(address);
 }
 
 void Block::setToPointer()
 {
     nullifyPointerData();
+#ifndef COMPACT_BLOCKS
     dataType_ = DT_POINTER;
+#endif
+    setPointerData(-1, NULL);
 }
 
 void Block::setTo(DataType dataType)
@@ -274,34 +306,36 @@ void Block::setTo(DataType dataType)
 
 void Block::clear()
 {
-    if ((dataType_ < 0) || (dataType_ >= DATA_TYPE_COUNT)) dataType_ = DT_INTEGER;
-    setTo(dataType_);
+    const DataType dataType = this->dataType();
+    setTo((dataType < 0) || (dataType >= DATA_TYPE_COUNT) ? DT_INTEGER : dataType);
 }
 
-Block & Block::operator =(const Block & rhs)
+void Block::assignSlowly(const Block & rhs)
 {
-    nullifyPointerData();
-    dataType_ = rhs.dataType_;
-    if (dataType_ == DT_POINTER) setToPointer(rhs.pointerData.address, *rhs.pointerData.heap);
-    else pointerData = rhs.pointerData; // because pointerData takes up most space in the union
-    return *this;
+    Heap * const heap = rhs.pointerHeap();
+    if (heap != NULL) setToPointer(rhs.pointerAddress(), *heap);
+    else
+    {
+        nullifyPointerData();
+        moveFrom(rhs);
+    }
 }
 
 bool Block::operator ==(const Block & rhs) const
 {
-    if (dataType_ != rhs.dataType_) return false;
-    switch (dataType_)
+    if (dataType() != rhs.dataType()) return false;
+    switch (dataType())
     {
     case DT_INTEGER:
-        return integerData_ == rhs.integerData_;
+        return integerData() == rhs.integerData();
     case DT_REAL:
-        return fabs(realData_ - rhs.realData_) < 0.00001;
+        return fabs(realData() - rhs.realData()) < 0.00001;
     case DT_CHAR:
-        return charData_ == rhs.charData_;
+        return charData() == rhs.charData();
     case DT_BOOLEAN:
-        return booleanData_ == rhs.booleanData_;
+        return booleanData() == rhs.booleanData();
     case DT_POINTER:
-        return (pointerData.address == rhs.pointerData.address) && (pointerData.heap == rhs.pointerData.heap);
+        return (pointerAddress() == rhs.pointerAddress()) && (pointerHeap() == rhs.pointerHeap());
 
     default:
         std::cout << "Block::operator ==: Unknown type handled in comparison" << std::endl;
@@ -314,13 +348,6 @@ bool Block::operator !=(const Block & rhs) const
     return !(*this == rhs);
 }
 
-void Block::init()
-{
-    pointerData.address = -1;
-    pointerData.heap = NULL;
-    dataType_ = DT_INTEGER;
-}
-
 std::ostream & operator <<(std::ostream & stream, const Block & block)
 {
     switch (block.dataType())
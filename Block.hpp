@@ -12,9 +12,13 @@
 
 #include "TypeWrappers.hpp"
 
-// A class for a single block of data in memory
+// A class for a single block of data in memory.
+// Building with COMPACT_BLOCKS defined packs a block into a single 64-bit word instead of a type tag and a union (24
+// bytes on 64-bit platforms). Reals are stored as themselves, and every other type as a NaN that arithmetic never
+// produces, so in that build integers only keep 48 bits (they are sign extended from there) and the JIT is disabled
 
 class Heap;
+class ManagedHeap;
 
 class Block
 {
@@ -74,7 +78,9 @@ public:
 
     Heap * pointerHeap() const;
     bool pointerIsNull() const;
+    ManagedHeap * pointerManagedHeap() const; // NULL unless the block points into a managed heap
     unsigned pointerArrayLength() const;
+    // NULL for the elements of a packed array after the first, as they aren't kept as blocks (see ManagedHeap)
     Block * pointerArrayElementAt(unsigned index) const;
     Block * pointerDataPointedTo() const;
     // Cleans the pointer data of a block, decrementing a heap reference count if necessary
@@ -89,12 +95,34 @@ public:
     void setTo(DataType dataType); // Sets the block to the specified datatype with it's default value (i.e. 0)
 
     void clear();
+    // Copies other without changing any reference counts, for when a block is being moved rather than duplicated
+    void moveFrom(const Block & other);
+    // Exchanges the contents of two blocks, which leaves every reference count as it was
+    void swap(Block & other);
 
     Block & operator =(const Block & rhs);
     bool operator ==(const Block & rhs) const;
     bool operator !=(const Block & rhs) const;
 
 private:
+    friend class Jit; // Native code works on blocks that aren't pointers directly
+
+#ifdef COMPACT_BLOCKS
+    // The top 16 bits of a block that isn't a real are tagBase plus its data type, and the rest are its value. A
+    // pointer's value is the id of its heap (see Heap::withId) followed by a 32-bit address
+    static const unsigned long tagBase = 0xFFF9, valueMask = 0xFFFFFFFFFFFFul, canonicalNaN = 0x7FF8000000000000ul;
+    typedef char wordMustBe64Bits[sizeof(unsigned long) == 8 ? 1 : -1];
+
+    unsigned long word;
+
+    static unsigned long tagged(DataType dataType, unsigned long value);
+#else
+    struct PointerData
+    {
+        int address; // The array index of a block in one of the heaps
+        Heap * heap; // The heap that the address is associated with
+    };
+
     DataType dataType_;
 
     union
@@ -103,17 +131,205 @@ private:
         double realData_;
         char charData_;
         bool booleanData_;
-
-        struct // pointer struct
-        {
-            int address; // The array index of a block in one of the heaps
-            Heap * heap; // The heap that the address is associated with
-        } pointerData;
+        PointerData pointerData;
     };
+#endif
 
     void init();
+    void assignSlowly(const Block & rhs); // Assignment where either block may hold a pointer
+    void setPointerData(int address, Heap * heap); // Doesn't change any reference counts
 };
 
 std::ostream & operator <<(std::ostream & stream, const Block & block);
 
+// The accessors used on hot paths are inline, as is copying blocks that don't hold pointers, which needs no reference
+// counting
+
+inline Block::~Block()
+{
+    if (dataType() == DT_POINTER) nullifyPointerData();
+}
+
+inline Block & Block::operator =(const Block & rhs)
+{
+    if ((dataType() != DT_POINTER) && (rhs.dataType() != DT_POINTER)) moveFrom(rhs);
+    else assignSlowly(rhs);
+    return *this;
+}
+
+#ifdef COMPACT_BLOCKS
+
+inline unsigned long Block::tagged(const DataType dataType, const unsigned long value)
+{
+    return ((tagBase + dataType) << 48) | (value & valueMask);
+}
+
+inline void Block::moveFrom(const Block & other)
+{
+    word = other.word;
+}
+
+inline void Block::swap(Block & other)
+{
+    const unsigned long temporary = word;
+    word = other.word;
+    other.word = temporary;
+}
+
+inline Block::DataType Block::dataType() const
+{
+    const unsigned long tag = word >> 48;
+    return tag < tagBase ? DT_REAL : DataType(tag - tagBase);
+}
+
+inline long Block::integerData() const
+{
+    return static_cast<long>(word << 16) >> 16;
+}
+
+inline void Block::setIntegerData(const long data)
+{
+    word = tagged(DT_INTEGER, data);
+}
+
+inline void Block::addToIntegerData(const long amount)
+{
+    setIntegerData(integerData() + amount);
+}
+
+inline void Block::multiplyIntegerData(const long amount)
+{
+    setIntegerData(integerData() * amount);
+}
+
+inline double Block::realData() const
+{
+    union { unsigned long word; double real; } bits;
+    bits.word = word;
+    return bits.real;
+}
+
+inline void Block::setRealData(const double data)
+{
+    union { unsigned long word; double real; } bits;
+    bits.real = data;
+    word = data == data ? bits.word : canonicalNaN; // A NaN's own bits could look like another type
+}
+
+inline void Block::addToRealData(const double amount)
+{
+    setRealData(realData() + amount);
+}
+
+inline void Block::multiplyRealData(const double amount)
+{
+    setRealData(realData() * amount);
+}
+
+inline char Block::charData() const
+{
+    return static_cast<char>(word);
+}
+
+inline void Block::setCharData(const char data)
+{
+    word = tagged(DT_CHAR, static_cast<unsigned char>(data));
+}
+
+inline void Block::addToCharData(const char amount)
+{
+    setCharData(charData() + amount);
+}
+
+inline void Block::multiplyCharData(const char amount)
+{
+    setCharData(charData() * amount);
+}
+
+#else
+
+inline void Block::moveFrom(const Block & other)
+{
+    dataType_ = other.dataType_;
+    pointerData = other.pointerData; // because pointerData takes up most space in the union
+}
+
+inline void Block::swap(Block & other)
+{
+    const DataType temporaryDataType = dataType_;
+    dataType_ = other.dataType_;
+    other.dataType_ = temporaryDataType;
+
+    const PointerData temporaryData = pointerData;
+    pointerData = other.pointerData;
+    other.pointerData = temporaryData;
+}
+
+inline Block::DataType Block::dataType() const
+{
+    return dataType_;
+}
+
+inline long Block::integerData() const
+{
+    return integerData_;
+}
+
+inline void Block::setIntegerData(const long data)
+{
+    integerData_ = data;
+}
+
+inline void Block::addToIntegerData(const long amount)
+{
+    integerData_ += amount;
+}
+
+inline void Block::multiplyIntegerData(const long amount)
+{
+    integerData_ *= amount;
+}
+
+inline double Block::realData() const
+{
+    return realData_;
+}
+
+inline void Block::setRealData(const double data)
+{
+    realData_ = data;
+}
+
+inline void Block::addToRealData(const double amount)
+{
+    realData_ += amount;
+}
+
+inline void Block::multiplyRealData(const double amount)
+{
+    realData_ *= amount;
+}
+
+inline char Block::charData() const
+{
+    return charData_;
+}
+
+inline void Block::setCharData(const char data)
+{
+    charData_ = data;
+}
+
+inline void Block::addToCharData(const char amount)
+{
+    charData_ += amount;
+}
+
+inline void Block::multiplyCharData(const char amount)
+{
+    charData_ *= amount;
+}
+
+#endif
+
 #endif // BLOCK_HPP
@@ -0,0 +1,56 @@
+/*
+ * BlockRegion.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "BlockRegion.hpp"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+BlockRegion::BlockRegion(const unsigned initialCount, const unsigned maximumCount)
+    : blocks(NULL), count_(0), maximumCount_(maximumCount), reservedSize(size_t(maximumCount) * sizeof(Block))
+{
+    if (maximumCount == 0) throw(std::runtime_error("BlockRegion::BlockRegion: Maximum block count must not be 0"));
+
+    // Pages of an anonymous mapping are only given physical memory when first written to
+    void * const memory = mmap(NULL, reservedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                               -1, 0);
+    if (memory == MAP_FAILED) throw(std::runtime_error("BlockRegion::BlockRegion: Could not reserve memory"));
+    blocks = static_cast<Block*>(memory);
+
+    grow(initialCount < maximumCount ? initialCount : maximumCount);
+}
+
+BlockRegion::~BlockRegion()
+{
+    for (unsigned i = 0; i < count_; ++i) blocks[i].~Block();
+    munmap(blocks, reservedSize);
+}
+
+unsigned BlockRegion::maximumCount() const
+{
+    return maximumCount_;
+}
+
+bool BlockRegion::grow(unsigned count)
+{
+    if (count <= count_) return true;
+    if (count > maximumCount_) return false;
+
+    // Fill out the page that the last block ends on, as it is going to be backed by memory anyway
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t end = ((size_t(count) * sizeof(Block) + pageSize - 1) / pageSize) * pageSize;
+    count = end / sizeof(Block) < maximumCount_ ? end / sizeof(Block) : maximumCount_;
+
+    for ( ; count_ < count; ++count_) new (&blocks[count_]) Block();
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * BlockRegion.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef BLOCKREGION_HPP
+#define BLOCKREGION_HPP
+
+#include <cstddef>
+#include <algorithm>
+
+#include "Block.hpp"
+
+// A run of blocks in a range of virtual memory that is reserved for the most it can ever hold, but only constructed
+// (and so only backed by physical memory) as far as it has been grown. Blocks never move once constructed, so their
+// addresses can be kept
+
+class BlockRegion
+{
+public:
+    BlockRegion(unsigned initialCount, unsigned maximumCount);
+    ~BlockRegion();
+
+    Block & operator [](unsigned index);
+    const Block & operator [](unsigned index) const;
+    unsigned count() const; // How many blocks have been constructed
+    unsigned maximumCount() const;
+
+    // Constructs blocks until there are at least count of them, rounded up to a whole page. Returns false (and
+    // constructs nothing) if count is more than the maximum
+    bool grow(unsigned count);
+
+    void swap(BlockRegion & other); // Exchanges the blocks of the two regions, without moving any
+    // Where the address of the first block is kept, for native code that has to follow a swap
+    Block * const * firstBlockAddress() const;
+
+private:
+    Block * blocks;
+    unsigned count_, maximumCount_;
+    size_t reservedSize;
+
+    BlockRegion(const BlockRegion &);
+    BlockRegion & operator =(const BlockRegion &);
+};
+
+inline Block & BlockRegion::operator [](const unsigned index)
+{
+    return blocks[index];
+}
+
+inline const Block & BlockRegion::operator [](const unsigned index) const
+{
+    return blocks[index];
+}
+
+inline unsigned BlockRegion::count() const
+{
+    return count_;
+}
+
+inline void BlockRegion::swap(BlockRegion & other)
+{
+    std::swap(blocks, other.blocks);
+    std::swap(count_, other.count_);
+    std::swap(maximumCount_, other.maximumCount_);
+    std::swap(reservedSize, other.reservedSize);
+}
+
+inline Block * const * BlockRegion::firstBlockAddress() const
+{
+    return &blocks;
+}
+
+#endif // BLOCKREGION_HPP
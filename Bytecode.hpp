@@ -0,0 +1,133 @@
+/*
+ * Bytecode.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include <vector>
+#include <string>
+
+#include "Block.hpp"
+#include "ComparisonFlagRegister.hpp"
+#include "Opcodes.hpp"
+#include "Handlers.hpp"
+#include "ExtensionFunction.hpp"
+
+// The pre-decoded form of a program that the interpreter actually executes. Instructions are lowered from their
+// Token form once at load time, so that nothing has to be re-derived from the tokens on every step. A Program keeps
+// its bytecode with static operands as locations, and each interpreter runs its own copy bound to its machine
+
+struct Operand
+{
+    enum Kind
+    {
+        K_NULL,
+        K_STATIC,             // A register or an unmanaged heap location, bound directly to its block (see Program)
+        K_CONSTANT,           // A constant that is only ever read, so it can be used straight from the constant pool
+        K_TEMPORARY,          // A constant that the instruction may write to, so it is copied before use
+        K_STACK_TOP,
+        K_STACK_BOTTOM,
+        K_STACK_NEGATIVE,
+        K_TARGET,             // A label that has been resolved to an index into the code
+        K_NAME,               // A label used as a name rather than a jump target (i.e. by extl and extc)
+        K_EXTENSION_FUNCTION, // The function an extc calls, once it has been looked up by name
+        K_DATA_TYPE,
+        K_COMPARISON_FLAG_ID,
+        K_REDUCTION,
+        K_NIL
+    };
+
+    Operand() : kind(K_NULL), isPointer(false), block(NULL) {}
+
+    unsigned char kind;
+    bool isPointer;
+
+    union
+    {
+        Block * block;
+        unsigned location;  // What a K_STATIC operand refers to until it is bound (see Token::locationData)
+        const Block * constant;
+        unsigned stackPosition;
+        unsigned target;
+        unsigned nameIndex; // Index into Bytecode::strings
+        ExtensionFunction * extensionFunction;
+        Block::DataType dataType;
+        CFR::ComparisonFlagId comparisonFlagId;
+        Opcodes::Reduction reduction;
+    };
+};
+
+struct CompiledInstruction
+{
+    // Pseudo opcodes that only exist in compiled code
+    enum
+    {
+        P_HALT = Opcodes::VDOT + 1, // Marks the end of the code, which finishes the thread that reaches it
+        P_INVALID,                  // An instruction with invalid operands. Operand 1 holds the error message
+
+        // Superinstructions, which execute an instruction and the one after it with a single dispatch. They are only
+        // ever used as a dispatch opcode, so the second instruction is still there to be jumped to on its own
+        S_HANDLER_PAIR,   // Two instructions that both go through their handler
+        S_HANDLER_JUMP,   // A handler followed by jmp
+        S_HANDLER_CALL,   // A handler followed by call (e.g. push then call)
+        S_HANDLER_RETURN, // A handler followed by ret (e.g. move RP .. then ret RP)
+        S_COMPARE_JE,     // A comparison followed by a conditional jump
+        S_COMPARE_JNE,
+        S_COMPARE_JL,
+        S_COMPARE_JG,
+        S_COMPARE_JLE,
+        S_COMPARE_JGE,
+
+        PSEUDO_OPCODE_END
+    };
+
+    CompiledInstruction() : target(NULL), handler(NULL), opcode(P_HALT), dispatchOpcode(P_HALT), line(0) {}
+
+    const void * target;       // Where the dispatch loop should go to execute this instruction
+    // Specialised for the kinds of the operands. NULL for control flow instructions. Arithmetic and comparison handlers
+    // replace themselves once they have seen the data types of their operands (see Handlers), so it is mutable
+    mutable Handlers::Handler handler;
+    unsigned char opcode;
+    unsigned char dispatchOpcode; // What the dispatch loop executes. Either opcode or a superinstruction
+    unsigned line;       // The line of the source this instruction came from (for error messages)
+    Operand operand1, operand2;
+};
+
+struct Bytecode
+{
+    std::vector<CompiledInstruction> code; // Always terminated by a P_HALT instruction
+    std::vector<Block> constants; // Left empty in bound copies, whose operands still point into the program's
+    std::vector<std::string> strings;
+
+    void clear() { code.clear(); constants.clear(); strings.clear(); }
+
+    // The function called by the extc instruction at the given index, or NULL if no extension function has its name
+    // (yet). It is looked up by name until it is found, then bound to the instruction's second operand
+    ExtensionFunction * extensionFunctionFor(const unsigned index) const
+    {
+        // Like quickening (see Handlers), this is done in place. The code is only ever const to stop it being moved
+        Operand & operand = const_cast<Operand&>(code[index].operand2);
+        if (operand.extensionFunction == NULL)
+            operand.extensionFunction = ExtensionFunction::find(strings[code[index].operand1.nameIndex].c_str());
+        return operand.extensionFunction;
+    }
+
+    // The index of the first instruction at or after the given source line
+    unsigned codeIndexAtLine(const unsigned line) const
+    {
+        unsigned low = 0, high = code.size() - 1; // The final P_HALT is always a valid answer
+        while (low < high)
+        {
+            const unsigned middle = (low + high) / 2;
+            if ((code[middle].opcode != CompiledInstruction::P_HALT) && (code[middle].line < line)) low = middle + 1;
+            else high = middle;
+        }
+        return low;
+    }
+};
+
+#endif // BYTECODE_HPP
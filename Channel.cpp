@@ -0,0 +1,183 @@
+/*
+ * Channel.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "Channel.hpp"
+#include "ManagedHeap.hpp"
+
+Channel::Channel(const unsigned capacity, const Kind kind)
+    : kind_(kind), mask(roundedCapacity(capacity) - 1), slots(new Slot[mask + 1]),
+      sendPosition(0), receivePositionSeen(0), receivePosition(0), sendPositionSeen(0)
+{
+    for (unsigned long i = 0; i <= mask; ++i) slots[i].sequence = i;
+}
+
+Channel::~Channel()
+{
+    delete[] slots;
+}
+
+bool Channel::trySend(const Block & value)
+{
+    // A producer that shares the channel can't back out of a slot once it has been reserved, so arrays are copied
+    // before then, in case they can't be. To save copying them when there's no room, that's checked for first
+    const bool copyFirst = (kind_ != K_SINGLE_PRODUCER) && (value.dataType() == Block::DT_POINTER)
+                           && !value.pointerIsNull();
+    Message copy;
+    if (copyFirst)
+    {
+        if (looksFull()) return false;
+        copy.store(value);
+    }
+
+    unsigned long position;
+    Slot * const slot = reserveSlot(position);
+    if (slot == NULL) return false;
+    if (copyFirst) slot->message.swap(copy);
+    else slot->message.store(value);
+    publishSlot(*slot, position);
+    return true;
+}
+
+bool Channel::tryReceive(Block & destination, ManagedHeap & heap, std::vector<Block> & arrays)
+{
+    unsigned long position;
+    Slot * const slot = takeSlot(position);
+    if (slot == NULL) return false;
+
+    // A message that can't be loaded is dropped, so that it doesn't stop the ones behind it from being received
+    try
+    {
+        slot->message.load(destination, heap, arrays);
+    }
+    catch (...)
+    {
+        releaseSlot(*slot, position);
+        throw;
+    }
+    releaseSlot(*slot, position);
+    return true;
+}
+
+bool Channel::looksFull() const
+{
+    const unsigned long position = __atomic_load_n(&sendPosition, __ATOMIC_ACQUIRE);
+    if (kind_ == K_SINGLE_PRODUCER) return position - __atomic_load_n(&receivePosition, __ATOMIC_ACQUIRE) > mask;
+    return long(__atomic_load_n(&slots[position & mask].sequence, __ATOMIC_ACQUIRE) - position) < 0;
+}
+
+bool Channel::looksEmpty() const
+{
+    const unsigned long position = __atomic_load_n(&receivePosition, __ATOMIC_ACQUIRE);
+    if (kind_ == K_SINGLE_PRODUCER) return position == __atomic_load_n(&sendPosition, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slots[position & mask].sequence, __ATOMIC_ACQUIRE) != position + 1;
+}
+
+Channel::Kind Channel::kind() const
+{
+    return kind_;
+}
+
+unsigned Channel::capacity() const
+{
+    return mask + 1;
+}
+
+unsigned long Channel::roundedCapacity(const unsigned capacity)
+{
+    if ((capacity == 0) || (capacity > maximumCapacity))
+        throw(std::runtime_error("Channel::Channel: Capacity is out of range"));
+    unsigned long rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+    return rounded;
+}
+
+Channel::Slot * Channel::reserveSlot(unsigned long & position)
+{
+    if (kind_ == K_SINGLE_PRODUCER)
+    {
+        // Only this end changes the send position, so it needn't be read atomically here
+        position = sendPosition;
+        if (position - receivePositionSeen > mask)
+        {
+            receivePositionSeen = __atomic_load_n(&receivePosition, __ATOMIC_ACQUIRE);
+            if (position - receivePositionSeen > mask) return NULL;
+        }
+        return &slots[position & mask];
+    }
+
+    // A slot can be sent to once its sequence has caught up with the send position. Producers race to move the
+    // position on past it, and whichever does gets the slot
+    position = __atomic_load_n(&sendPosition, __ATOMIC_RELAXED);
+    while (true)
+    {
+        Slot & slot = slots[position & mask];
+        const long difference = long(__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) - position);
+        if (difference == 0)
+        {
+            // On failure, position is updated to where another producer has moved it
+            if (__atomic_compare_exchange_n(&sendPosition, &position, position + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                return &slot;
+        }
+        else if (difference < 0) return NULL; // The receiver hasn't taken what was sent there last time round
+        else position = __atomic_load_n(&sendPosition, __ATOMIC_RELAXED);
+    }
+}
+
+void Channel::publishSlot(Slot & slot, const unsigned long position)
+{
+    if (kind_ == K_SINGLE_PRODUCER) __atomic_store_n(&sendPosition, position + 1, __ATOMIC_RELEASE);
+    else __atomic_store_n(&slot.sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+Channel::Slot * Channel::takeSlot(unsigned long & position)
+{
+    if (kind_ == K_SINGLE_PRODUCER)
+    {
+        position = receivePosition;
+        if (position == sendPositionSeen)
+        {
+            sendPositionSeen = __atomic_load_n(&sendPosition, __ATOMIC_ACQUIRE);
+            if (position == sendPositionSeen) return NULL;
+        }
+        return &slots[position & mask];
+    }
+
+    // A slot has something to receive once its sequence is one past the receive position. A single consumer simply
+    // takes it. Multiple consumers race to move the position on past it, as producers do in reserveSlot
+    position = __atomic_load_n(&receivePosition, __ATOMIC_RELAXED);
+    while (true)
+    {
+        Slot & slot = slots[position & mask];
+        const long difference = long(__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) - (position + 1));
+        if (difference < 0) return NULL;
+        if (kind_ == K_MULTIPLE_PRODUCERS) return &slot;
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&receivePosition, &position, position + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                return &slot;
+        }
+        else position = __atomic_load_n(&receivePosition, __ATOMIC_RELAXED);
+    }
+}
+
+void Channel::releaseSlot(Slot & slot, const unsigned long position)
+{
+    if (kind_ == K_SINGLE_PRODUCER)
+    {
+        __atomic_store_n(&receivePosition, position + 1, __ATOMIC_RELEASE);
+        return;
+    }
+    // The slot is next sent to one time round the buffer from now. Multiple consumers have already moved the receive
+    // position on, when they took the slot
+    __atomic_store_n(&slot.sequence, position + mask + 1, __ATOMIC_RELEASE);
+    if (kind_ == K_MULTIPLE_PRODUCERS) __atomic_store_n(&receivePosition, position + 1, __ATOMIC_RELEASE);
+}
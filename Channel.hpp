@@ -0,0 +1,90 @@
+/*
+ * Channel.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef CHANNEL_HPP
+#define CHANNEL_HPP
+
+#include <vector>
+
+#include "Block.hpp"
+#include "Message.hpp"
+
+class ManagedHeap;
+
+// A bounded queue of values, for passing them between the threads of a machine or between machines running on
+// different threads, without any of them sharing a heap. A channel is a ring buffer that is used without locks: a
+// single producer channel can have one thread sending and one receiving at a time, a multiple producer channel any
+// number of threads sending and one receiving (the threads of a single machine count as one), and a multiple consumer
+// channel any number of threads doing either. Neither operation waits: they fail if the channel is full or empty, and
+// it's up to the caller to try again.
+// Values are sent as Messages, so arrays are deep copied from the sender's heap into the receiver's
+
+class Channel
+{
+public:
+    enum Kind
+    {
+        K_SINGLE_PRODUCER = 0,
+        K_MULTIPLE_PRODUCERS,
+        K_MULTIPLE_CONSUMERS // And multiple producers
+    };
+
+    // capacity is rounded up to a power of two
+    explicit Channel(unsigned capacity, Kind kind = K_SINGLE_PRODUCER);
+    ~Channel();
+
+    // Returns false if the channel is full. Throws if value points anywhere other than an array in a managed heap
+    bool trySend(const Block & value);
+    // Returns false if the channel is empty. Any arrays the value points to are allocated in heap, and kept in arrays
+    // while they are, which should be among the heap's roots so that none of them are collected before they're all
+    // linked together. Leaves arrays empty. If the value can't be loaded, it's dropped from the channel and this throws
+    bool tryReceive(Block & destination, ManagedHeap & heap, std::vector<Block> & arrays);
+
+    // Whether a send or receive would fail if it were tried now. Unlike the operations themselves, these read what the
+    // other end has done afresh, so a thread that has told the other end it's about to wait can check that it still
+    // needs to (see Machine::waitForChannel)
+    bool looksFull() const;
+    bool looksEmpty() const;
+
+    Kind kind() const;
+    unsigned capacity() const;
+
+private:
+    struct Slot
+    {
+        Message message;
+        // Unless there's a single producer, the position the slot is next to be sent to, or one after the position it's
+        // next to be received from
+        unsigned long sequence;
+    };
+
+    static const unsigned cacheLineSize = 64, maximumCapacity = 1u << 30;
+
+    const Kind kind_;
+    const unsigned long mask; // The capacity less one
+    Slot * const slots;
+
+    // The sending and receiving ends are each kept on a cache line of their own, so that they don't contend. Positions
+    // only ever increase, and index the slots modulo the capacity. Each end keeps a copy of the other's position,
+    // which it only reloads when the channel looks full or empty
+    char padding1[cacheLineSize];
+    unsigned long sendPosition, receivePositionSeen;
+    char padding2[cacheLineSize - 2 * sizeof(unsigned long)];
+    unsigned long receivePosition, sendPositionSeen;
+    char padding3[cacheLineSize - 2 * sizeof(unsigned long)];
+
+    Channel(const Channel &);
+    Channel & operator =(const Channel &);
+
+    static unsigned long roundedCapacity(unsigned capacity);
+    Slot * reserveSlot(unsigned long & position); // NULL if the channel is full
+    void publishSlot(Slot & slot, unsigned long position);
+    Slot * takeSlot(unsigned long & position); // NULL if the channel is empty
+    void releaseSlot(Slot & slot, unsigned long position); // Frees a received slot to be sent to again
+};
+
+#endif // CHANNEL_HPP
@@ -12,18 +12,6 @@ ComparisonFlagRegister::ComparisonFlagRegister()
     reset();
 }
 
-bool ComparisonFlagRegister::getValue(const ComparisonFlagId id) const
-{
-    if (id == FLAG_COUNT) return false;
-    return flags[id];
-}
-
-void ComparisonFlagRegister::setValue(const ComparisonFlagId id, const bool value)
-{
-    if (id == FLAG_COUNT) return;
-    flags[id] = value;
-}
-
 void ComparisonFlagRegister::toggle(const ComparisonFlagId id)
 {
     if (id == FLAG_COUNT) return;
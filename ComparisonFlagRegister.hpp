@@ -33,7 +33,23 @@ public:
     void reset();
 
 private:
+    friend class Jit; // Native code reads and writes the flags directly
+
     bool flags[FLAG_COUNT];
 } CFR;
 
+// Defined here so that flag reads and writes can be inlined into the interpreter's dispatch loop
+
+inline bool ComparisonFlagRegister::getValue(const ComparisonFlagId id) const
+{
+    if (id == FLAG_COUNT) return false;
+    return flags[id];
+}
+
+inline void ComparisonFlagRegister::setValue(const ComparisonFlagId id, const bool value)
+{
+    if (id == FLAG_COUNT) return;
+    flags[id] = value;
+}
+
 #endif // COMPARISONFLAGREGISTER_HPP
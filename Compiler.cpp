@@ -0,0 +1,313 @@
+/*
+ * Compiler.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+
+#include "Compiler.hpp"
+#include "Bytecode.hpp"
+#include "Program.hpp"
+
+inline bool tokenHasBlock(const Token & token)
+{
+    switch (token.type)
+    {
+    case Token::T_OPERAND_STATIC_LOCATION:
+    case Token::T_OPERAND_CONST_INT:
+    case Token::T_OPERAND_CONST_REAL:
+    case Token::T_OPERAND_CONST_CHAR:
+    case Token::T_OPERAND_CONST_BOOL:
+    case Token::T_OPERAND_STACK_TOP:
+    case Token::T_OPERAND_STACK_BOTTOM:
+    case Token::T_OPERAND_STACK_NEGATIVE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool firstOperandIsLabel(const Instruction & instruction)
+{
+    return (instruction.operand1.type == Token::T_LABEL) && instruction.operand2.isNull();
+}
+
+// Whether an instruction can change the value of one of its operands. Constants given for these operands have to be
+// copied before each use so that the constant itself is left alone
+bool operandIsWritten(const unsigned char opcode, const short operandNumber)
+{
+    if (operandNumber == 2) return opcode == Opcodes::SWAP;
+
+    switch (opcode)
+    {
+    case Opcodes::INS:
+    case Opcodes::OUT:
+    case Opcodes::OUTS:
+    case Opcodes::PUSH:
+    case Opcodes::PLA:
+    case Opcodes::ATOA:
+    case Opcodes::AEL:
+    case Opcodes::CPYA:
+    case Opcodes::CMP:
+    case Opcodes::CMPT:
+    case Opcodes::IST:
+    case Opcodes::RET:
+    case Opcodes::SEND:
+    case Opcodes::RECV:
+    case Opcodes::TRYRECV:
+    case Opcodes::PMAP:
+    case Opcodes::PREDUCE:
+    case Opcodes::VADD:
+    case Opcodes::VSUB:
+    case Opcodes::VMUL:
+    case Opcodes::VDIV:
+    case Opcodes::VFILL:
+    case Opcodes::VDOT:
+        return false;
+    default:
+        return true;
+    }
+}
+
+class InstructionCompiler
+{
+public:
+    InstructionCompiler(const std::vector<Instruction> & instructions, const Program & program, Bytecode & bytecode)
+        : program(program), bytecode(bytecode), firstCodeIndexAtLine(instructions.size() + 1, 0)
+    {
+        // Work out where each line will end up in the code, so that labels can be resolved to code indices. Lines
+        // without an opcode are dropped, so a label refers to the first instruction at or after its line
+        unsigned codeIndex = 0;
+        for (unsigned line = 0; line < instructions.size(); ++line)
+        {
+            firstCodeIndexAtLine[line] = codeIndex;
+            if (!instructions[line].opcode.isNull()) ++codeIndex;
+        }
+        firstCodeIndexAtLine[instructions.size()] = codeIndex;
+    }
+
+    void compile(const Instruction & instruction, const unsigned line)
+    {
+        if (instruction.opcode.isNull()) return;
+
+        CompiledInstruction compiled;
+        compiled.opcode = instruction.opcode.opcodeData;
+        compiled.line = line;
+
+        short requiredOperandNumber = Opcodes::opcodeOperandCounts[compiled.opcode];
+        if (tokenHasBlock(instruction.operand1)) --requiredOperandNumber;
+        if (tokenHasBlock(instruction.operand2)) --requiredOperandNumber;
+
+        bool error = false;
+        if (requiredOperandNumber != 0)
+        {
+            // Deal with special cases that accept labels or 'nil', which don't have blocks to represent them
+            switch (compiled.opcode)
+            {
+            case Opcodes::POP:
+                error = !((instruction.operand1.type == Token::T_OPERAND_NIL) && instruction.operand2.isNull());
+                break;
+            case Opcodes::ALLC:
+                error = !((instruction.operand1.type == Token::T_OPERAND_DATA_TYPE)
+                          && tokenHasBlock(instruction.operand2));
+                break;
+            case Opcodes::IST:
+                error = !(tokenHasBlock(instruction.operand1)
+                          && (instruction.operand2.type == Token::T_OPERAND_DATA_TYPE));
+                break;
+            case Opcodes::CPYF:
+                error = !(tokenHasBlock(instruction.operand1)
+                          && (instruction.operand2.type == Token::T_OPERAND_COMPARISON_FLAG_ID));
+                break;
+            case Opcodes::PMAP:
+                error = !(tokenHasBlock(instruction.operand1) && (instruction.operand2.type == Token::T_LABEL));
+                break;
+            case Opcodes::PREDUCE:
+                error = !(tokenHasBlock(instruction.operand1)
+                          && (instruction.operand2.type == Token::T_OPERAND_REDUCTION));
+                break;
+            case Opcodes::JMP:
+            case Opcodes::JE:
+            case Opcodes::JNE:
+            case Opcodes::JL:
+            case Opcodes::JG:
+            case Opcodes::JLE:
+            case Opcodes::JGE:
+            case Opcodes::CALL:
+            case Opcodes::EXTL:
+            case Opcodes::EXTC:
+            case Opcodes::SPAWN:
+                error = !firstOperandIsLabel(instruction);
+                break;
+            default: error = true;
+            }
+        }
+        else
+        {
+            // These instructions have never done anything when given blocks rather than their special operands
+            switch (compiled.opcode)
+            {
+            case Opcodes::ALLC:
+            case Opcodes::IST:
+            case Opcodes::CPYF:
+            case Opcodes::JMP:
+            case Opcodes::JE:
+            case Opcodes::JNE:
+            case Opcodes::JL:
+            case Opcodes::JG:
+            case Opcodes::JLE:
+            case Opcodes::JGE:
+            case Opcodes::CALL:
+            case Opcodes::EXTL:
+            case Opcodes::EXTC:
+            case Opcodes::SPAWN:
+                return;
+            // Whereas newer ones report it as an error
+            case Opcodes::PMAP:
+            case Opcodes::PREDUCE:
+                error = true;
+                break;
+            default: break;
+            }
+        }
+
+        if (error)
+        {
+            compiled.opcode = CompiledInstruction::P_INVALID;
+            compiled.operand1.kind = Operand::K_NAME;
+            compiled.operand1.nameIndex = addString(requiredOperandNumber < 0
+                                                    ? "Interpreter::execute: Too many operands given"
+                                                    : requiredOperandNumber > 0
+                                                    ? "Interpreter::execute: Too few operands given"
+                                                    : "Interpreter::execute: Invalid operands given");
+        }
+        else
+        {
+            compileOperand(instruction.operand1, compiled.opcode, 1, compiled.operand1);
+            compileOperand(instruction.operand2, compiled.opcode, 2, compiled.operand2);
+            compiled.handler = Handlers::select(compiled);
+
+            if (compiled.opcode == Opcodes::EXTC)
+            {
+                // Bound to the function when it's first called, as it is usually loaded by an extl at run time
+                compiled.operand2.kind = Operand::K_EXTENSION_FUNCTION;
+                compiled.operand2.extensionFunction = NULL;
+            }
+        }
+
+        compiled.dispatchOpcode = compiled.opcode;
+        bytecode.code.push_back(compiled);
+    }
+
+private:
+    const Program & program;
+    Bytecode & bytecode;
+    std::vector<unsigned> firstCodeIndexAtLine;
+
+    unsigned addString(const std::string & str)
+    {
+        bytecode.strings.push_back(str);
+        return bytecode.strings.size() - 1;
+    }
+
+    const Block * addConstant(const Block & block)
+    {
+        // The constant pool has already been reserved for the worst case, so pointers into it stay valid
+        bytecode.constants.push_back(block);
+        return &bytecode.constants.back();
+    }
+
+    void compileOperand(const Token & token, const unsigned char opcode, const short operandNumber, Operand & operand)
+    {
+        operand.isPointer = token.isPointer;
+        switch (token.type)
+        {
+        case Token::T_OPERAND_STATIC_LOCATION:
+            operand.kind = Operand::K_STATIC;
+            operand.location = token.locationData;
+            return;
+
+        case Token::T_OPERAND_CONST_INT:  operand.constant = addConstant(Block(Integer(token.integerData))); break;
+        case Token::T_OPERAND_CONST_REAL: operand.constant = addConstant(Block(Real(token.realData))); break;
+        case Token::T_OPERAND_CONST_CHAR: operand.constant = addConstant(Block(Char(token.charData))); break;
+        case Token::T_OPERAND_CONST_BOOL: operand.constant = addConstant(Block(Boolean(token.booleanData))); break;
+
+        case Token::T_OPERAND_STACK_TOP:
+            operand.kind = Operand::K_STACK_TOP;
+            operand.stackPosition = token.stackPositionData;
+            return;
+        case Token::T_OPERAND_STACK_BOTTOM:
+            operand.kind = Operand::K_STACK_BOTTOM;
+            operand.stackPosition = token.stackPositionData;
+            return;
+        case Token::T_OPERAND_STACK_NEGATIVE:
+            operand.kind = Operand::K_STACK_NEGATIVE;
+            operand.stackPosition = token.stackPositionData;
+            return;
+
+        case Token::T_LABEL:
+            operand.isPointer = false;
+            if ((opcode == Opcodes::EXTL) || (opcode == Opcodes::EXTC))
+            {
+                operand.kind = Operand::K_NAME;
+                operand.nameIndex = addString(token.labelData);
+            }
+            else
+            {
+                operand.kind = Operand::K_TARGET;
+                operand.target = firstCodeIndexAtLine[program.labelLineNumber(token.labelData)];
+            }
+            return;
+
+        case Token::T_OPERAND_DATA_TYPE:
+            operand.kind = Operand::K_DATA_TYPE;
+            operand.dataType = token.dataTypeData;
+            return;
+        case Token::T_OPERAND_COMPARISON_FLAG_ID:
+            operand.kind = Operand::K_COMPARISON_FLAG_ID;
+            operand.comparisonFlagId = token.comparisonFlagData;
+            return;
+        case Token::T_OPERAND_REDUCTION:
+            operand.kind = Operand::K_REDUCTION;
+            operand.reduction = token.reductionData;
+            return;
+        case Token::T_OPERAND_NIL:
+            operand.kind = Operand::K_NIL;
+            return;
+
+        default:
+            operand.kind = Operand::K_NULL;
+            return;
+        }
+
+        // Only constants get here
+        operand.kind = operandIsWritten(opcode, operandNumber) ? Operand::K_TEMPORARY : Operand::K_CONSTANT;
+    }
+};
+
+void Compiler::compile(const std::vector<Instruction> & instructions, const Program & program,
+                       const void * const * const dispatchTable, Bytecode & bytecode)
+{
+    bytecode.clear();
+    bytecode.code.reserve(instructions.size() + 1);
+    bytecode.constants.reserve(instructions.size() * 2);
+
+    InstructionCompiler compiler(instructions, program, bytecode);
+    for (unsigned line = 0; line < instructions.size(); ++line)
+    {
+        try { compiler.compile(instructions[line], line); }
+        catch (const std::exception & e) { throw(Compiler::Error(e.what(), line)); }
+    }
+    bytecode.code.push_back(CompiledInstruction()); // P_HALT
+
+    if (dispatchTable != NULL)
+    {
+        for (unsigned i = 0; i < bytecode.code.size(); ++i)
+            bytecode.code[i].target = dispatchTable[bytecode.code[i].dispatchOpcode];
+    }
+}
+
+Compiler::Error::Error(const std::string & message, const unsigned line)
+    : std::runtime_error(message), line(line) {}
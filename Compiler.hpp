@@ -0,0 +1,41 @@
+/*
+ * Compiler.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef COMPILER_HPP
+#define COMPILER_HPP
+
+#include <vector>
+#include <stdexcept>
+#include <string>
+
+#include "Instruction.hpp"
+
+struct Bytecode;
+class Program;
+
+// Lowers lexed instructions into Bytecode. Empty and label-only lines are dropped, labels are resolved to indices into
+// the code and operand validation is done once here instead of on every execution.
+
+namespace Compiler
+{
+
+// Thrown when an instruction cannot be compiled (e.g. it refers to a label that doesn't exist)
+struct Error : public std::runtime_error
+{
+    Error(const std::string & message, unsigned line);
+    unsigned line; // The index of the line the error occurred on
+};
+
+// dispatchTable is indexed by opcode (including the CompiledInstruction pseudo opcodes) and gives the target that each
+// compiled instruction should have. It may be NULL if the dispatch loop switches on the opcode instead. Labels are
+// looked up in program
+void compile(const std::vector<Instruction> & instructions, const Program & program,
+             const void * const * dispatchTable, Bytecode & bytecode);
+
+}
+
+#endif // COMPILER_HPP
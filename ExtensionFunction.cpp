@@ -11,23 +11,37 @@
 #include "Machine.hpp"
 #include "Block.hpp"
 #include "Stack.hpp"
+#include "StringHash.hpp"
+#include "Mutex.hpp"
 
-std::vector<ExtensionFunction> ExtensionFunction::instances;
+std::deque<ExtensionFunction> ExtensionFunction::instances;
+std::vector<unsigned> ExtensionFunction::slots(ExtensionFunction::initialSlotCount, 0);
+Mutex ExtensionFunction::mutex;
 
 void ExtensionFunction::addNew(const char * name, const Pointer function, const unsigned parameterCount)
 {
     if (parameterCount > 10)
         throw(std::runtime_error("ExtensionFunction::addNew: Only a maximum of 10 parameters allowed"));
-    instances.push_back(ExtensionFunction(name, function, parameterCount));
+    add(ExtensionFunction(name, function, NULL, parameterCount));
+}
+
+void ExtensionFunction::addNewSpan(const char * name, const SpanPointer function, const unsigned parameterCount)
+{
+    add(ExtensionFunction(name, NULL, function, parameterCount));
 }
 
 ExtensionFunction * ExtensionFunction::find(const char * name)
 {
-    for (unsigned i = 0; i < instances.size(); ++i)
-    {
-        if (strcmp(instances[i].name_.c_str(), name) == 0) return &instances[i];
-    }
-    return NULL;
+    Mutex::Lock lock(mutex);
+    const unsigned slot = slotFor(name);
+    return slots[slot] == 0 ? NULL : &instances[slots[slot] - 1];
+}
+
+void ExtensionFunction::removeAll()
+{
+    Mutex::Lock lock(mutex);
+    instances.clear();
+    slots.assign(initialSlotCount, 0);
 }
 
 const std::string & ExtensionFunction::name() const
@@ -40,13 +54,30 @@ const ExtensionFunction::Pointer & ExtensionFunction::pointer() const
     return pointer_;
 }
 
+const ExtensionFunction::SpanPointer & ExtensionFunction::spanPointer() const
+{
+    return spanPointer_;
+}
+
 unsigned ExtensionFunction::parameterCount() const
 {
     return parameterCount_;
 }
 
+bool ExtensionFunction::takesArgumentSpan() const
+{
+    return spanPointer_ != NULL;
+}
+
 Block ExtensionFunction::call(const Stack & stack, Machine * const machine) const
 {
+    if (spanPointer_ != NULL)
+    {
+        Block result;
+        call(stack, machine, result);
+        return result;
+    }
+
     if (stack.count() < parameterCount_)
         throw(std::runtime_error("ExtensionFunction::call: Not enough arguments on the stack"));
 
@@ -86,5 +117,50 @@ Block ExtensionFunction::call(const Stack & stack, Machine * const machine) cons
     }
 }
 
-ExtensionFunction::ExtensionFunction(const std::string & name, const Pointer function, const unsigned parameterCount)
-    : name_(name), pointer_(function), parameterCount_(parameterCount) {}
+void ExtensionFunction::call(const Stack & stack, Machine * const machine, Block & result) const
+{
+    if (spanPointer_ == NULL)
+    {
+        result = call(stack, machine);
+        return;
+    }
+
+    if (stack.count() < parameterCount_)
+        throw(std::runtime_error("ExtensionFunction::call: Not enough arguments on the stack"));
+
+    // The blocks of a stack frame are contiguous, so the arguments can be passed as they are
+    result.setToInteger(0);
+    spanPointer_(machine, stack.count() == 0 ? NULL : &stack.at(0), stack.count(), result);
+}
+
+void ExtensionFunction::add(const ExtensionFunction & function)
+{
+    Mutex::Lock lock(mutex);
+
+    // Keep the index at most half full so that probe sequences stay short
+    if ((instances.size() + 1) * 2 > slots.size())
+    {
+        slots.assign(slots.size() * 2, 0);
+        for (unsigned i = 0; i < instances.size(); ++i) slots[slotFor(instances[i].name_.c_str())] = i + 1;
+    }
+
+    const unsigned slot = slotFor(function.name_.c_str());
+    if (slots[slot] != 0) return;
+
+    instances.push_back(function);
+    slots[slot] = instances.size();
+}
+
+unsigned ExtensionFunction::slotFor(const char * const name)
+{
+    const unsigned mask = slots.size() - 1;
+    unsigned slot = hashString(name) & mask;
+
+    // Linear probing. The index is never full, so this always finishes
+    while ((slots[slot] != 0) && (instances[slots[slot] - 1].name_ != name)) slot = (slot + 1) & mask;
+    return slot;
+}
+
+ExtensionFunction::ExtensionFunction(const std::string & name, const Pointer function, const SpanPointer spanFunction,
+                                     const unsigned parameterCount)
+    : name_(name), pointer_(function), spanPointer_(spanFunction), parameterCount_(parameterCount) {}
@@ -9,32 +9,62 @@
 #define EXTENSIONFUNCTION_HPP
 
 #include <vector>
+#include <deque>
+#include <string>
 
 class Block;
 class Stack;
 class Machine;
+class Mutex;
 
 class ExtensionFunction
 {
 public:
     typedef Block (*Pointer)(Machine* const); // i.e. ExtensionFunction::Pointer
+    // A function using the argument span calling convention. Rather than being passed copies of its arguments, it is
+    // given every block in the caller's stack frame (first pushed first) and writes its return value, which starts off
+    // as the integer 0, straight into the stack slot reserved for it. These are added by an extension's
+    // tvmLoadSpanExtension function, which is given addNewSpan in the same way tvmLoadExtension is given addNew
+    typedef void (*SpanPointer)(Machine* const, const Block * arguments, unsigned argumentCount, Block & result);
 
+    // Adding a function with the same name as an existing one does nothing, so the first one added is always used
     static void addNew(const char * name, Pointer function, unsigned parameterCount);
+    // parameterCount is the fewest arguments the function can be called with. There is no maximum
+    static void addNewSpan(const char * name, SpanPointer function, unsigned parameterCount);
+    // Returns NULL if there is no function with the given name. Functions are never moved, and only removed once no
+    // Machine is left to call them (see removeAll), so the pointer returned can be kept (e.g. by an extc instruction,
+    // so that it only has to look the function up once)
     static ExtensionFunction * find(const char * name);
+    // For when the extensions the functions came from are unloaded
+    static void removeAll();
 
     const std::string & name() const;
-    const Pointer & pointer() const;
+    const Pointer & pointer() const; // NULL for functions that take an argument span
+    const SpanPointer & spanPointer() const;
     unsigned parameterCount() const;
+    bool takesArgumentSpan() const;
 
     Block call(const Stack & stack, Machine * const machine) const; // stack contains arguments to pass
+    // Returns the result through the given block, which for functions taking an argument span is written to directly
+    void call(const Stack & stack, Machine * const machine, Block & result) const;
 
 private:
-    static std::vector<ExtensionFunction> instances; // Change to something quicker to search later
+    static const unsigned initialSlotCount = 64;
 
-    ExtensionFunction(const std::string & name, Pointer function, unsigned parameterCount);
+    static std::deque<ExtensionFunction> instances; // A deque so that adding to it doesn't move the others
+    static std::vector<unsigned> slots; // Hash index on names. Each is an index into instances plus one, or 0 if empty
+    static Mutex mutex; // Guards the two above, as extensions can be loaded by machines on different threads
+
+    // The slot that holds the function with the given name, or the empty slot where it would go
+    static unsigned slotFor(const char * name);
+
+    ExtensionFunction(const std::string & name, Pointer function, SpanPointer spanFunction, unsigned parameterCount);
+
+    static void add(const ExtensionFunction & function);
 
     std::string name_;
     Pointer pointer_;
+    SpanPointer spanPointer_;
     unsigned parameterCount_;
 
     // Nobody really wants to see this
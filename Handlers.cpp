@@ -0,0 +1,584 @@
+/*
+ * Handlers.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <cmath>
+
+#include "Handlers.hpp"
+#include "Bytecode.hpp"
+#include "Machine.hpp"
+
+typedef Handlers::Handler Handler;
+
+// Each fetcher gets the block for one kind of operand. Handlers call written on the blocks they write to, which only
+// does anything for blocks reached through a pointer (see Indirect)
+struct Handlers::Fetch
+{
+    struct Direct
+    {
+        static void written(Machine &, Block *, const Block &) {}
+    };
+
+    struct Static : Direct
+    {
+        static Block * block(Machine &, const Operand & operand, Block &)
+        {
+            return operand.block;
+        }
+    };
+
+    struct Constant : Direct
+    {
+        // The compiler only uses K_CONSTANT for operands that are never written to, so the cast is safe
+        static Block * block(Machine &, const Operand & operand, Block &)
+        {
+            return const_cast<Block*>(operand.constant);
+        }
+    };
+
+    struct Temporary : Direct
+    {
+        static Block * block(Machine &, const Operand & operand, Block & temporary)
+        {
+            temporary = *operand.constant;
+            return &temporary;
+        }
+    };
+
+    struct StackTop : Direct
+    {
+        static Block * block(Machine & machine, const Operand & operand, Block &)
+        {
+            return &machine.stack_.fromTop(operand.stackPosition);
+        }
+    };
+
+    struct StackBottom : Direct
+    {
+        static Block * block(Machine & machine, const Operand & operand, Block &)
+        {
+            return &machine.stack_.at(operand.stackPosition);
+        }
+    };
+
+    struct StackNegative : Direct
+    {
+        static Block * block(Machine & machine, const Operand & operand, Block &)
+        {
+            return &machine.stack_.fromTopBelow(operand.stackPosition);
+        }
+    };
+
+    // 'nil', or an operand that isn't a block
+    struct None : Direct
+    {
+        static Block * block(Machine &, const Operand &, Block &)
+        {
+            return NULL;
+        }
+    };
+
+    // The block pointed to by a location, i.e. '@' operands. That can be the first element of a packed array, which
+    // has to keep the array's data type, so its value is kept in the temporary (which is otherwise unused) until the
+    // instruction has written to it
+    template <typename Location>
+    struct Indirect
+    {
+        static Block * block(Machine & machine, const Operand & operand, Block & temporary)
+        {
+            return machine.getIndirectBlock(*Location::block(machine, operand, temporary), temporary);
+        }
+
+        static void written(Machine & machine, Block * const block, const Block & temporary)
+        {
+            machine.checkIndirectWrite(block, temporary);
+        }
+    };
+};
+
+// The shapes of the Machine functions that instructions map on to. Each has a run function templated on the fetchers
+// for its operands, which is what gets used as the Handler
+
+template <void (Machine::*function)()>
+struct WithoutOperands
+{
+    static void run(Machine & machine, const CompiledInstruction &, Block *)
+    {
+        (machine.*function)();
+    }
+};
+
+template <void (Machine::*function)(Block *)>
+struct WithBlock
+{
+    template <typename Fetch1>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        Block * const block = Fetch1::block(machine, instruction.operand1, temporaries[0]);
+        (machine.*function)(block);
+        Fetch1::written(machine, block, temporaries[0]);
+    }
+};
+
+template <void (Machine::*function)(const Block *)>
+struct WithConstBlock
+{
+    template <typename Fetch1>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        (machine.*function)(Fetch1::block(machine, instruction.operand1, temporaries[0]));
+    }
+};
+
+template <void (Machine::*function)(Block *, const Block *)>
+struct WithBlocks
+{
+    template <typename Fetch1, typename Fetch2>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        Block * const block = Fetch1::block(machine, instruction.operand1, temporaries[0]);
+        (machine.*function)(block, Fetch2::block(machine, instruction.operand2, temporaries[1]));
+        Fetch1::written(machine, block, temporaries[0]);
+    }
+};
+
+template <void (Machine::*function)(Block *, Block *)>
+struct WithMutableBlocks
+{
+    template <typename Fetch1, typename Fetch2>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        Block * const block1 = Fetch1::block(machine, instruction.operand1, temporaries[0]),
+              * const block2 = Fetch2::block(machine, instruction.operand2, temporaries[1]);
+        (machine.*function)(block1, block2);
+        Fetch1::written(machine, block1, temporaries[0]);
+        Fetch2::written(machine, block2, temporaries[1]);
+    }
+};
+
+template <void (Machine::*function)(const Block *, const Block *)>
+struct WithConstBlocks
+{
+    template <typename Fetch1, typename Fetch2>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        (machine.*function)(Fetch1::block(machine, instruction.operand1, temporaries[0]),
+                            Fetch2::block(machine, instruction.operand2, temporaries[1]));
+    }
+};
+
+// Conversion, allocation, type checks and flag copies take a non-block operand, which is read straight from the
+// instruction
+
+template <void (Machine::*function)(Block *, const Block *, Block::DataType), Block::DataType dataType>
+struct Conversion
+{
+    template <typename Fetch1, typename Fetch2>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        Block * const block = Fetch1::block(machine, instruction.operand1, temporaries[0]);
+        (machine.*function)(block, Fetch2::block(machine, instruction.operand2, temporaries[1]), dataType);
+        Fetch1::written(machine, block, temporaries[0]);
+    }
+};
+
+template <void (Machine::*function)(Block::DataType, const Block *)>
+struct WithDataTypeAndBlock
+{
+    template <typename Fetch2>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        (machine.*function)(instruction.operand1.dataType, Fetch2::block(machine, instruction.operand2, temporaries[1]));
+    }
+};
+
+template <void (Machine::*function)(const Block *, Block::DataType)>
+struct WithBlockAndDataType
+{
+    template <typename Fetch1>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        (machine.*function)(Fetch1::block(machine, instruction.operand1, temporaries[0]), instruction.operand2.dataType);
+    }
+};
+
+template <void (Machine::*function)(Block *, ComparisonFlagRegister::ComparisonFlagId)>
+struct WithBlockAndFlag
+{
+    template <typename Fetch1>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        Block * const block = Fetch1::block(machine, instruction.operand1, temporaries[0]);
+        (machine.*function)(block, instruction.operand2.comparisonFlagId);
+        Fetch1::written(machine, block, temporaries[0]);
+    }
+};
+
+template <void (Machine::*function)(const Block *, unsigned)>
+struct WithConstBlockAndTarget
+{
+    template <typename Fetch1>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        (machine.*function)(Fetch1::block(machine, instruction.operand1, temporaries[0]), instruction.operand2.target);
+    }
+};
+
+template <void (Machine::*function)(const Block *, Opcodes::Reduction)>
+struct WithConstBlockAndReduction
+{
+    template <typename Fetch1>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        (machine.*function)(Fetch1::block(machine, instruction.operand1, temporaries[0]),
+                            instruction.operand2.reduction);
+    }
+};
+
+template <void (Machine::*function)(const Block *, const Block *, CFR::ComparisonFlagId), CFR::ComparisonFlagId flagId>
+struct WithConstBlocksAndFlag
+{
+    template <typename Fetch1, typename Fetch2>
+    static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+    {
+        (machine.*function)(Fetch1::block(machine, instruction.operand1, temporaries[0]),
+                            Fetch2::block(machine, instruction.operand2, temporaries[1]), flagId);
+    }
+};
+
+// Quickening. Arithmetic and comparison instructions start off with a handler that looks at the data types of their
+// operands the first time it runs, and replaces itself with one specialised for those types (e.g. add on two integers)
+// if it can. The specialised handler then only has to check that the types are still the same. If they ever aren't, the
+// instruction goes back to the generic handler for good (a deoptimisation), so that a site that sees mixed types doesn't
+// keep flipping between the two
+
+// The value held by a block that is known to be of a given data type
+template <Block::DataType dataType> struct Value;
+
+template <>
+struct Value<Block::DT_INTEGER>
+{
+    typedef long Type;
+    static Type get(const Block & block) { return block.integerData(); }
+    static void set(Block & block, const Type value) { block.setIntegerData(value); }
+    static bool equal(const Type lhs, const Type rhs) { return lhs == rhs; }
+};
+
+template <>
+struct Value<Block::DT_REAL>
+{
+    typedef double Type;
+    static Type get(const Block & block) { return block.realData(); }
+    static void set(Block & block, const Type value) { block.setRealData(value); }
+    static bool equal(const Type lhs, const Type rhs) { return fabs(lhs - rhs) < 0.00001; } // As Block::operator ==
+};
+
+template <>
+struct Value<Block::DT_CHAR>
+{
+    typedef char Type;
+    static Type get(const Block & block) { return block.charData(); }
+    static void set(Block & block, const Type value) { block.setCharData(value); }
+    static bool equal(const Type lhs, const Type rhs) { return lhs == rhs; }
+};
+
+struct Handlers::Quickening
+{
+    // The operations that can be quickened. generic is the Machine function for the instruction, and specialised does
+    // the same for two blocks that are both of the given data type
+
+    struct Add
+    {
+        static void generic(Machine & machine, Block * const destBlock, const Block * const sourceBlock)
+        {
+            machine._add(destBlock, sourceBlock);
+        }
+
+        template <Block::DataType dataType>
+        static void specialised(Machine &, Block * const destBlock, const Block * const sourceBlock)
+        {
+            Value<dataType>::set(*destBlock, Value<dataType>::get(*destBlock) + Value<dataType>::get(*sourceBlock));
+        }
+    };
+
+    struct Subtract
+    {
+        static void generic(Machine & machine, Block * const destBlock, const Block * const sourceBlock)
+        {
+            machine._subtract(destBlock, sourceBlock);
+        }
+
+        template <Block::DataType dataType>
+        static void specialised(Machine &, Block * const destBlock, const Block * const sourceBlock)
+        {
+            Value<dataType>::set(*destBlock, Value<dataType>::get(*destBlock) - Value<dataType>::get(*sourceBlock));
+        }
+    };
+
+    struct Multiply
+    {
+        static void generic(Machine & machine, Block * const destBlock, const Block * const sourceBlock)
+        {
+            machine._multiply(destBlock, sourceBlock);
+        }
+
+        template <Block::DataType dataType>
+        static void specialised(Machine &, Block * const destBlock, const Block * const sourceBlock)
+        {
+            Value<dataType>::set(*destBlock, Value<dataType>::get(*destBlock) * Value<dataType>::get(*sourceBlock));
+        }
+    };
+
+    struct Compare
+    {
+        static void generic(Machine & machine, const Block * const lhsBlock, const Block * const rhsBlock)
+        {
+            machine._compare(lhsBlock, rhsBlock);
+        }
+
+        template <Block::DataType dataType>
+        static void specialised(Machine & machine, const Block * const lhsBlock, const Block * const rhsBlock)
+        {
+            const typename Value<dataType>::Type lhs = Value<dataType>::get(*lhsBlock),
+                                                 rhs = Value<dataType>::get(*rhsBlock);
+            const bool equality = Value<dataType>::equal(lhs, rhs);
+
+            // Every flag is set, so there is no need to reset the register first
+            ComparisonFlagRegister & flags = machine.comparisonFlagRegister_;
+            flags.setValue(CFR::F_EQUAL, equality);
+            flags.setValue(CFR::F_NOT_EQUAL, !equality);
+            flags.setValue(CFR::F_LESS, lhs < rhs);
+            flags.setValue(CFR::F_GREATER, lhs > rhs);
+            flags.setValue(CFR::F_LESS_EQUAL, lhs <= rhs);
+            flags.setValue(CFR::F_GREATER_EQUAL, lhs >= rhs);
+        }
+    };
+
+    // The shape of a quickenable instruction. run is the handler it starts off with
+    template <typename Operation>
+    struct Quickenable
+    {
+        template <typename Fetch1, typename Fetch2>
+        static void run(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+        {
+            Block * const block1 = Fetch1::block(machine, instruction.operand1, temporaries[0]),
+                  * const block2 = Fetch2::block(machine, instruction.operand2, temporaries[1]);
+
+            instruction.handler = &generic<Fetch1, Fetch2>;
+            if ((block1 != NULL) && (block2 != NULL) && (block1->dataType() == block2->dataType()))
+            {
+                switch (block1->dataType())
+                {
+                case Block::DT_INTEGER: instruction.handler = &specialised<Block::DT_INTEGER, Fetch1, Fetch2>; break;
+                case Block::DT_REAL:    instruction.handler = &specialised<Block::DT_REAL, Fetch1, Fetch2>; break;
+                case Block::DT_CHAR:    instruction.handler = &specialised<Block::DT_CHAR, Fetch1, Fetch2>; break;
+                default: break;
+                }
+                if (instruction.handler != &generic<Fetch1, Fetch2>) ++machine.quickenedCount_;
+            }
+
+            Operation::generic(machine, block1, block2);
+            Fetch1::written(machine, block1, temporaries[0]);
+        }
+
+        template <Block::DataType dataType, typename Fetch1, typename Fetch2>
+        static void specialised(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+        {
+            Block * const block1 = Fetch1::block(machine, instruction.operand1, temporaries[0]),
+                  * const block2 = Fetch2::block(machine, instruction.operand2, temporaries[1]);
+
+            if ((block1 != NULL) && (block2 != NULL) && (block1->dataType() == dataType)
+                && (block2->dataType() == dataType))
+            {
+                Operation::template specialised<dataType>(machine, block1, block2);
+                return;
+            }
+
+            instruction.handler = &generic<Fetch1, Fetch2>;
+            ++machine.deoptimisedCount_;
+            Operation::generic(machine, block1, block2);
+            Fetch1::written(machine, block1, temporaries[0]);
+        }
+
+        template <typename Fetch1, typename Fetch2>
+        static void generic(Machine & machine, const CompiledInstruction & instruction, Block * const temporaries)
+        {
+            Block * const block1 = Fetch1::block(machine, instruction.operand1, temporaries[0]);
+            Operation::generic(machine, block1, Fetch2::block(machine, instruction.operand2, temporaries[1]));
+            Fetch1::written(machine, block1, temporaries[0]);
+        }
+    };
+};
+
+struct Handlers::Select
+{
+    // Works out the fetcher for an operand, then passes it on to Next::get
+    template <typename Next>
+    static Handler byKind(const CompiledInstruction & instruction, const Operand & operand)
+    {
+        switch (operand.kind)
+        {
+        case Operand::K_STATIC:
+            if (operand.isPointer) return Next::template get<Fetch::Indirect<Fetch::Static> >(instruction);
+            return Next::template get<Fetch::Static>(instruction);
+        case Operand::K_CONSTANT:
+            return Next::template get<Fetch::Constant>(instruction);
+        case Operand::K_TEMPORARY:
+            return Next::template get<Fetch::Temporary>(instruction);
+        case Operand::K_STACK_TOP:
+            if (operand.isPointer) return Next::template get<Fetch::Indirect<Fetch::StackTop> >(instruction);
+            return Next::template get<Fetch::StackTop>(instruction);
+        case Operand::K_STACK_BOTTOM:
+            if (operand.isPointer) return Next::template get<Fetch::Indirect<Fetch::StackBottom> >(instruction);
+            return Next::template get<Fetch::StackBottom>(instruction);
+        case Operand::K_STACK_NEGATIVE:
+            if (operand.isPointer) return Next::template get<Fetch::Indirect<Fetch::StackNegative> >(instruction);
+            return Next::template get<Fetch::StackNegative>(instruction);
+        default:
+            return Next::template get<Fetch::None>(instruction);
+        }
+    }
+
+    template <typename Shape>
+    struct SingleOperand
+    {
+        template <typename Fetch1>
+        static Handler get(const CompiledInstruction &)
+        {
+            return &Shape::template run<Fetch1>;
+        }
+    };
+
+    template <typename Shape, typename Fetch1>
+    struct SecondOperand
+    {
+        template <typename Fetch2>
+        static Handler get(const CompiledInstruction &)
+        {
+            return &Shape::template run<Fetch1, Fetch2>;
+        }
+    };
+
+    template <typename Shape>
+    struct FirstOperand
+    {
+        template <typename Fetch1>
+        static Handler get(const CompiledInstruction & instruction)
+        {
+            return byKind<SecondOperand<Shape, Fetch1> >(instruction, instruction.operand2);
+        }
+    };
+
+    template <typename Shape>
+    static Handler firstOperand(const CompiledInstruction & instruction)
+    {
+        return byKind<SingleOperand<Shape> >(instruction, instruction.operand1);
+    }
+
+    template <typename Shape>
+    static Handler secondOperand(const CompiledInstruction & instruction)
+    {
+        return byKind<SingleOperand<Shape> >(instruction, instruction.operand2);
+    }
+
+    template <typename Shape>
+    static Handler bothOperands(const CompiledInstruction & instruction)
+    {
+        return byKind<FirstOperand<Shape> >(instruction, instruction.operand1);
+    }
+};
+
+Handler Handlers::select(const CompiledInstruction & i)
+{
+    typedef Machine M;
+    typedef Quickening Q;
+
+    switch (i.opcode)
+    {
+    case Opcodes::CLR:  return Select::firstOperand<WithBlock<&M::_clear> >(i);
+    case Opcodes::SET:  return Select::bothOperands<WithBlocks<&M::_set> >(i);
+    case Opcodes::MOVE: return Select::bothOperands<WithBlocks<&M::_move> >(i);
+    case Opcodes::SWAP: return Select::bothOperands<WithMutableBlocks<&M::_swap> >(i);
+    case Opcodes::IN:   return Select::firstOperand<WithBlock<&M::_read> >(i);
+    case Opcodes::INS:  return Select::firstOperand<WithBlock<&M::_readString> >(i);
+    case Opcodes::OUT:  return Select::firstOperand<WithConstBlock<&M::_write> >(i);
+    case Opcodes::OUTS: return Select::firstOperand<WithConstBlock<&M::_writeString> >(i);
+    case Opcodes::PUSH: return Select::firstOperand<WithConstBlock<&M::_push> >(i);
+    case Opcodes::POP:  return Select::firstOperand<WithBlock<&M::_pop> >(i);
+    case Opcodes::INC:  return Select::firstOperand<WithBlock<&M::_increment> >(i);
+    case Opcodes::DEC:  return Select::firstOperand<WithBlock<&M::_decrement> >(i);
+    case Opcodes::NEG:  return Select::firstOperand<WithBlock<&M::_negate> >(i);
+    case Opcodes::ABS:  return Select::firstOperand<WithBlock<&M::_absolute> >(i);
+    case Opcodes::ADD:  return Select::bothOperands<Q::Quickenable<Q::Add> >(i);
+    case Opcodes::SUB:  return Select::bothOperands<Q::Quickenable<Q::Subtract> >(i);
+    case Opcodes::MUL:  return Select::bothOperands<Q::Quickenable<Q::Multiply> >(i);
+    case Opcodes::DIV:  return Select::bothOperands<WithBlocks<&M::_divide> >(i);
+    case Opcodes::MOD:  return Select::bothOperands<WithBlocks<&M::_modlulo> >(i);
+    case Opcodes::SADD: return &WithoutOperands<&M::stackAdd>::run;
+    case Opcodes::SSUB: return &WithoutOperands<&M::stackSubtract>::run;
+    case Opcodes::SMUL: return &WithoutOperands<&M::stackMultiply>::run;
+    case Opcodes::SDIV: return &WithoutOperands<&M::stackDivide>::run;
+    case Opcodes::SMOD: return &WithoutOperands<&M::stackModulo>::run;
+    case Opcodes::ALLC: return Select::secondOperand<WithDataTypeAndBlock<&M::_allocate> >(i);
+    case Opcodes::PLA:  return Select::bothOperands<WithConstBlocks<&M::_startPopulatingArray> >(i);
+    case Opcodes::FNA:  return &WithoutOperands<&M::stopPopulatingArray>::run;
+    case Opcodes::ATOA: return Select::firstOperand<WithConstBlock<&M::_addToArray> >(i);
+    case Opcodes::AEL:  return Select::bothOperands<WithConstBlocks<&M::_getArrayElement> >(i);
+    case Opcodes::ALEN: return Select::bothOperands<WithBlocks<&M::_getArrayLength> >(i);
+    case Opcodes::CPYA: return Select::bothOperands<WithConstBlocks<&M::_copyArray> >(i);
+    case Opcodes::CNVI: return Select::bothOperands<Conversion<&M::_convert, Block::DT_INTEGER> >(i);
+    case Opcodes::CNVR: return Select::bothOperands<Conversion<&M::_convert, Block::DT_REAL> >(i);
+    case Opcodes::CNVC: return Select::bothOperands<Conversion<&M::_convert, Block::DT_CHAR> >(i);
+    case Opcodes::CNVB: return Select::bothOperands<Conversion<&M::_convert, Block::DT_BOOLEAN> >(i);
+    case Opcodes::CNVT: return Select::bothOperands<WithBlocks<&M::_convertToDataTypeOf> >(i);
+    case Opcodes::DREF: return Select::bothOperands<WithBlocks<&M::_dereference> >(i);
+    case Opcodes::CMP:  return Select::bothOperands<Q::Quickenable<Q::Compare> >(i);
+    case Opcodes::CMPT: return Select::bothOperands<WithConstBlocks<&M::_compareDataType> >(i);
+    case Opcodes::IST:  return Select::firstOperand<WithBlockAndDataType<&M::_isDataType> >(i);
+    case Opcodes::CPYF: return Select::firstOperand<WithBlockAndFlag<&M::_copyFlag> >(i);
+    case Opcodes::NOT:  return Select::firstOperand<WithBlock<&M::_logicalNot> >(i);
+    case Opcodes::AND:  return Select::bothOperands<WithBlocks<&M::_logicalAnd> >(i);
+    case Opcodes::OR:   return Select::bothOperands<WithBlocks<&M::_logicalOr> >(i);
+    case Opcodes::XOR:  return Select::bothOperands<WithBlocks<&M::_logicalXor> >(i);
+    case Opcodes::RET:  return Select::firstOperand<WithConstBlock<&M::_returnFromCall> >(i);
+    case Opcodes::JOIN: return Select::firstOperand<WithBlock<&M::_join> >(i);
+    case Opcodes::SEND: return Select::bothOperands<WithConstBlocks<&M::_send> >(i);
+    case Opcodes::RECV: return Select::firstOperand<WithConstBlock<&M::_receive> >(i);
+    case Opcodes::TRYRECV: return Select::firstOperand<WithConstBlock<&M::_tryReceive> >(i);
+    case Opcodes::PMAP:    return Select::firstOperand<WithConstBlockAndTarget<&M::_mapArray> >(i);
+    case Opcodes::PREDUCE: return Select::firstOperand<WithConstBlockAndReduction<&M::_reduceArray> >(i);
+    case Opcodes::VADD:  return Select::bothOperands<WithConstBlocks<&M::_addArrays> >(i);
+    case Opcodes::VSUB:  return Select::bothOperands<WithConstBlocks<&M::_subtractArrays> >(i);
+    case Opcodes::VMUL:  return Select::bothOperands<WithConstBlocks<&M::_multiplyArrays> >(i);
+    case Opcodes::VDIV:  return Select::bothOperands<WithConstBlocks<&M::_divideArrays> >(i);
+    case Opcodes::VFILL: return Select::bothOperands<WithConstBlocks<&M::_fillArray> >(i);
+    case Opcodes::VDOT:  return Select::bothOperands<WithConstBlocks<&M::_dotProduct> >(i);
+    default: return NULL;
+    }
+}
+
+Handler Handlers::selectCompareForFlag(const CompiledInstruction & i, const CFR::ComparisonFlagId flagId)
+{
+    typedef Machine M;
+
+    if (i.opcode != Opcodes::CMP) return NULL;
+    switch (flagId)
+    {
+    case CFR::F_EQUAL:
+        return Select::bothOperands<WithConstBlocksAndFlag<&M::_compareForFlag, CFR::F_EQUAL> >(i);
+    case CFR::F_NOT_EQUAL:
+        return Select::bothOperands<WithConstBlocksAndFlag<&M::_compareForFlag, CFR::F_NOT_EQUAL> >(i);
+    case CFR::F_LESS:
+        return Select::bothOperands<WithConstBlocksAndFlag<&M::_compareForFlag, CFR::F_LESS> >(i);
+    case CFR::F_GREATER:
+        return Select::bothOperands<WithConstBlocksAndFlag<&M::_compareForFlag, CFR::F_GREATER> >(i);
+    case CFR::F_LESS_EQUAL:
+        return Select::bothOperands<WithConstBlocksAndFlag<&M::_compareForFlag, CFR::F_LESS_EQUAL> >(i);
+    case CFR::F_GREATER_EQUAL:
+        return Select::bothOperands<WithConstBlocksAndFlag<&M::_compareForFlag, CFR::F_GREATER_EQUAL> >(i);
+    default: return NULL;
+    }
+}
@@ -0,0 +1,39 @@
+/*
+ * Handlers.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef HANDLERS_HPP
+#define HANDLERS_HPP
+
+#include "ComparisonFlagRegister.hpp"
+
+class Machine;
+class Block;
+struct CompiledInstruction;
+
+// Handlers for bytecode instructions that operate on blocks. A handler is instantiated from templates for every
+// combination of operand kinds, so the one picked for an instruction at load time fetches its operands without having to
+// check what kind they are. Arithmetic and comparison handlers go further and specialise themselves for the data types of
+// their operands the first time they run (quickening)
+
+class Handlers
+{
+public:
+    // temporaries points to two blocks that constants are copied to when an instruction may write to them
+    typedef void (*Handler)(Machine & machine, const CompiledInstruction & instruction, Block * temporaries);
+
+    // Returns NULL for instructions that are not dealt with by a handler (i.e. control flow)
+    static Handler select(const CompiledInstruction & instruction);
+    // For a cmp instruction whose result is only used by a single flag, one that just sets that flag
+    static Handler selectCompareForFlag(const CompiledInstruction & instruction, CFR::ComparisonFlagId flagId);
+
+private:
+    struct Fetch;  // Operand fetching, specialised per operand kind
+    struct Select; // Maps operand kinds onto fetchers and instantiates the handler
+    struct Quickening; // Handlers that replace themselves with ones specialised for the data types they see
+};
+
+#endif // HANDLERS_HPP
@@ -10,62 +10,107 @@
 
 #include "Heap.hpp"
 #include "Block.hpp"
+#include "ManagedHeap.hpp"
+#ifdef COMPACT_BLOCKS
+#include "Mutex.hpp"
+#endif
 
-const unsigned Heap::defaultSize = USHRT_MAX + 1;
+const unsigned Heap::defaultMaximumSize = 1u << 22, Heap::initialSize = 1024;
 
-Heap::Heap(const unsigned size)
-    : size_(size == 0 ? defaultSize : size), data(size_, Block()), referenceCount(size_, 0) {}
+#ifdef COMPACT_BLOCKS
+const unsigned Heap::idCount;
+Heap * Heap::heapsById[Heap::idCount] = { NULL };
+Mutex Heap::idMutex;
+#endif
 
-Block & Heap::blockAt(const unsigned index)
+Heap::Heap(const unsigned maximumSize)
+    : countsReferences_(true), managed(false), data(initialSize, maximumSize == 0 ? defaultMaximumSize : maximumSize),
+      referenceCount(data.count(), 0), accessedBegin(~0u), accessedEnd(0)
 {
-    if (index >= size_) throw(std::out_of_range("Heap::blockAt: Block index out of range"));
-    return data[index];
+    registerId();
+}
+
+Heap::Heap(const unsigned maximumSize, const bool managed)
+    : countsReferences_(true), managed(managed), data(initialSize, maximumSize == 0 ? defaultMaximumSize : maximumSize),
+      referenceCount(data.count(), 0), accessedBegin(~0u), accessedEnd(0)
+{
+    registerId();
+}
+
+Heap::~Heap()
+{
+#ifdef COMPACT_BLOCKS
+    Mutex::Lock lock(idMutex);
+    heapsById[id] = NULL;
+#endif
+}
+
+void Heap::registerId()
+{
+#ifdef COMPACT_BLOCKS
+    // Reuse the id of a heap that has been destroyed if there is one
+    Mutex::Lock lock(idMutex);
+    for (id = 1; (id < idCount) && (heapsById[id] != NULL); ++id);
+    if (id == idCount) throw(std::runtime_error("Heap::registerId: Too many heaps"));
+    heapsById[id] = this;
+#endif
 }
 
 unsigned Heap::size() const
 {
-    return size_;
+    return data.count();
+}
+
+unsigned Heap::maximumSize() const
+{
+    return data.maximumCount();
 }
 
 void Heap::flush()
 {
-    for (unsigned i = 0; i < data.size(); ++i) data[i].nullifyPointerData();
+    for (unsigned i = accessedBegin; i < accessedEnd; ++i) data[i].nullifyPointerData();
 }
 
 void Heap::incReferenceCountAt(const unsigned index)
 {
-    if (index >= size_) throw(std::out_of_range("Heap::incReferenceCountAt: Reference count index out of range"));
-    if (referenceCount[index] == USHRT_MAX)
+    if (index >= data.count()) throw(std::out_of_range("Heap::incReferenceCountAt: Reference count index out of range"));
+    if (referenceCount[index] == UINT_MAX)
         throw(std::runtime_error("Heap::incReferenceCountAt: Reference count is already at its maximum"));
 
     referenceCount[index] += 1;
-    referenceCountChangeCallback(index);
 }
 
 void Heap::decReferenceCountAt(const unsigned index)
 {
-    if (index >= size_) throw(std::out_of_range("Heap::decReferenceCountAt: Reference count index out of range"));
+    if (index >= data.count()) throw(std::out_of_range("Heap::decReferenceCountAt: Reference count index out of range"));
     if (referenceCount[index] == 0)
         throw(std::runtime_error("Heap::decReferenceCountAt: Reference count is already at its minimum (i.e. 0)"));
 
     referenceCount[index] -= 1;
-    referenceCountChangeCallback(index);
+    if (managed && (referenceCount[index] == 0)) static_cast<ManagedHeap*>(this)->freeArray(index);
 }
 
-void Heap::setReferenceCountAt(const unsigned index, const unsigned value, bool triggerCallback)
+void Heap::setReferenceCountAt(const unsigned index, const unsigned value)
 {
-    if (index >= size_) throw(std::out_of_range("Heap::setReferenceCountAt: Reference count index out of range"));
-    if (value > USHRT_MAX)
-        throw(std::runtime_error("Heap::setReferenceCountAt: New reference count value given is too large"));
-
+    if (index >= data.count()) throw(std::out_of_range("Heap::setReferenceCountAt: Reference count index out of range"));
     referenceCount[index] = value;
-    if (triggerCallback) referenceCountChangeCallback(index);
 }
 
-unsigned short Heap::referenceCountAt(const unsigned index) const
+void Heap::resetAccessedRange()
 {
-    if (index >= size_) throw(std::out_of_range("Heap::referenceCountAt: Reference count index out of range"));
+    accessedBegin = ~0u;
+    accessedEnd = 0;
+}
+
+unsigned Heap::referenceCountAt(const unsigned index) const
+{
+    if (index >= data.count()) throw(std::out_of_range("Heap::referenceCountAt: Reference count index out of range"));
     return referenceCount[index];
 }
 
-void Heap::referenceCountChangeCallback(unsigned) {}
+bool Heap::grow(const unsigned size)
+{
+    if (!data.grow(size)) return false;
+    referenceCount.resize(data.count(), 0);
+    return true;
+}
@@ -9,38 +9,108 @@
 #define HEAP_HPP
 
 #include <vector>
+#include <stdexcept>
 
-// The unmanaged heap
+#include "BlockRegion.hpp"
 
-class Block;
+#ifdef COMPACT_BLOCKS
+class Mutex;
+#endif
+
+// The unmanaged heap. Grows on demand, up to a maximum size
 
 class Heap
 {
 public:
-    static const unsigned defaultSize;
+    static const unsigned defaultMaximumSize, initialSize;
+
+    Heap(unsigned maximumSize); // 0 for the default
+    virtual ~Heap();
+
+    Block & blockAt(unsigned index); // Access by an 'address', i.e. an array index. Grows the heap to reach it
+    unsigned size() const; // How many blocks the heap has grown to
+    unsigned maximumSize() const;
 
-    Heap(unsigned size);
+    void flush(); // Clears the pointers out of every block that has been accessed
 
-    Block & blockAt(unsigned index); // Access by an 'address', i.e. an array index
-    unsigned size() const;
+    // False for a managed heap that is garbage collected by tracing, whose pointers are copied without counting
+    bool countsReferences() const;
+    // Whether this is a ManagedHeap, so that pointers can be checked for one without RTTI
+    bool isManaged() const;
 
-    void flush();
+#ifdef COMPACT_BLOCKS
+    // Compact blocks refer to heaps by a 16-bit id rather than a pointer. The id 0 stands for NULL
+    static Heap * withId(unsigned id);
+#endif
 
 protected:
+    Heap(unsigned maximumSize, bool managed);
+
     // References counts are simply conveniences in a regular heap.
-    // In a managed heap, they are used for garbage collection
+    // In a managed heap, they are used for garbage collection: an array is freed when its count drops to 0. That is
+    // dispatched statically rather than through a virtual call, as it is on the path of every pointer copy
     void incReferenceCountAt(unsigned index);
     void decReferenceCountAt(unsigned index);
-    void setReferenceCountAt(unsigned index, unsigned value, bool triggerCallback = true);
-    unsigned short referenceCountAt(unsigned index) const;
-    virtual void referenceCountChangeCallback(unsigned);
+    void setReferenceCountAt(unsigned index, unsigned value); // Never frees anything
+    unsigned referenceCountAt(unsigned index) const;
+    // For when none of the blocks accessed so far can hold pointers any more, and nothing outside the heap keeps their
+    // addresses, so that the next flush needn't look at them
+    void resetAccessedRange();
+    // Grows the heap to at least size blocks. Returns false if it can't grow that far
+    virtual bool grow(unsigned size);
+    // A block the heap has already grown to. Unlike blockAt, this doesn't note the access, so it only reads the heap
+    const Block & existingBlockAt(unsigned index) const;
+
+    bool countsReferences_;
 
     friend class Block;
 
 private:
-    unsigned size_;
-    std::vector<Block> data;
-    std::vector<unsigned short> referenceCount;
+    const bool managed;
+    BlockRegion data;
+    std::vector<unsigned> referenceCount;
+    unsigned accessedBegin, accessedEnd; // The range of blocks handed out by blockAt, the only ones that can be dirty
+
+    void registerId(); // Gives the heap an id for compact blocks to refer to it by
+
+#ifdef COMPACT_BLOCKS
+    static const unsigned idCount = 1u << 16;
+    // Fixed in size, so that it can be read without locking while heaps on other threads are registered
+    static Heap * heapsById[idCount];
+    static Mutex idMutex; // Guards registering and unregistering ids
+    unsigned id;
+#endif
 };
 
+#ifdef COMPACT_BLOCKS
+inline Heap * Heap::withId(const unsigned id)
+{
+    return heapsById[id];
+}
+#endif
+
+inline Block & Heap::blockAt(const unsigned index)
+{
+    if ((index >= data.count()) && !grow(index + 1))
+        throw(std::out_of_range("Heap::blockAt: Block index out of range"));
+    if (index < accessedBegin) accessedBegin = index;
+    if (index >= accessedEnd) accessedEnd = index + 1;
+    return data[index];
+}
+
+inline const Block & Heap::existingBlockAt(const unsigned index) const
+{
+    return data[index];
+}
+
+inline bool Heap::countsReferences() const
+{
+    return countsReferences_;
+}
+
+inline bool Heap::isManaged() const
+{
+    return managed;
+}
+
 #endif // HEAP_HPP
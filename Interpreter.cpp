@@ -14,21 +14,23 @@
 
 #include "Interpreter.hpp"
 #include "Lexer.hpp"
+#include "Compiler.hpp"
 #include "Instruction.hpp"
 #include "Machine.hpp"
 #include "Opcodes.hpp"
-
-const unsigned Interpreter::instructionReservation;
+#include "ParallelArrays.hpp"
+#include "Scheduler.hpp"
+#include "Mutex.hpp"
 
 Interpreter::Interpreter(Machine & machine, const unsigned optionCount, const Option * const options)
-    : machine(machine)
+    : machine(machine), program(ownProgram), jit(machine, bytecode, temporaries), parallelArrays(NULL),
+      scheduler(NULL)
 {
     parseOptions(optionCount, options);
 
     unsigned line = 0;
     std::string buffer;
     buffer.reserve(128);
-    instructions.reserve(instructionReservation);
     while (true)
     {
         ++line;
@@ -53,12 +55,20 @@ Interpreter::Interpreter(Machine & machine, const unsigned optionCount, const Op
         }
     }
 
-    preOptimise();
+    try { preOptimise(); }
+    catch (const Compiler::Error & e)
+    {
+        std::cout << "Error on line " << e.line + 1 << std::endl
+                  << e.what() << std::endl
+                  << "Execution halted" << std::endl;
+        exit(0);
+    }
 }
 
 Interpreter::Interpreter(Machine & machine, const char * fileName, const unsigned optionCount,
                          const Option * const options)
-    : machine(machine)
+    : machine(machine), program(ownProgram), jit(machine, bytecode, temporaries), parallelArrays(NULL),
+      scheduler(NULL)
 {
     parseOptions(optionCount, options);
 
@@ -71,7 +81,6 @@ Interpreter::Interpreter(Machine & machine, const char * fileName, const unsigne
         unsigned line = 0;
         std::string buffer;
         buffer.reserve(128);
-        instructions.reserve(instructionReservation);
         do
         {
             ++line;
@@ -97,9 +106,34 @@ Interpreter::Interpreter(Machine & machine, const char * fileName, const unsigne
     }
     else throw(std::runtime_error("Parser::Parser: File could not be opened"));
 
+    try { preOptimise(); }
+    catch (const Compiler::Error & e)
+    {
+        std::cout << "Error on line " << e.line + 1 << std::endl
+                  << e.what() << std::endl
+                  << "Execution halted" << std::endl;
+        exit(0);
+    }
+}
+
+Interpreter::Interpreter(Machine & machine, const Program & program, const unsigned optionCount,
+                         const Option * const options)
+    : machine(machine), program(program), jit(machine, bytecode, temporaries), parallelArrays(NULL),
+      scheduler(NULL)
+{
+    parseOptions(optionCount, options);
     preOptimise();
 }
 
+Interpreter::~Interpreter()
+{
+    // Stops the carriers before anything they use goes
+    if (machine.scheduler == scheduler) machine.scheduler = NULL;
+    delete scheduler;
+    if (machine.parallelArrays == parallelArrays) machine.parallelArrays = NULL;
+    delete parallelArrays;
+}
+
 void Interpreter::parseOptions(const unsigned optionCount, const Option * const options)
 {
     for (unsigned i = 0; i < OPTION_COUNT; ++i) optionEnabled[i] = false;
@@ -112,40 +146,33 @@ void Interpreter::parseOptions(const unsigned optionCount, const Option * const
 
 void Interpreter::tokenizeAndAddInstruction(const std::string & instruction, const unsigned line)
 {
-    const Instruction * i = &Lexer::tokenize(instruction, machine); // Return value is static, so using pointer is fine
-
-    if (!i->label.isNull()) machine.addLabel(i->label.labelData, line);
-    instructions.push_back(*i); // Even though the Instruction might contain nothing, we still need
-                                // to add it in order to give helpful error messages (i.e to show line number)
+    ownProgram.addLine(instruction, line);
 }
 
-inline void preOptimiseLabel(Token & token, const Machine & machine)
+void Interpreter::preOptimise()
 {
-    if (!token.isOptimisedLabel)
-    {
-        token.labelLineNumberData = machine.labelLineNumber(token.labelData);
-        token.isOptimisedLabel = true;
-    }
-}
+    if (&program == &ownProgram) ownProgram.compile(optionEnabled[O_DUMP_SUPERINSTRUCTIONS] ? &std::cout : NULL);
 
-inline void preOptimiseOperand(Token & operand, Machine & machine)
-{
-    if (operand.isNull()) return;
-    switch (operand.type)
+    const void * const * dispatchTable;
+    execute(&dispatchTable);
+    program.bind(machine, dispatchTable, bytecode);
+
+    if (optionEnabled[O_DISABLE_JIT]) jit.disable();
+    if (jit.enabled()) machine.labelCounts_.assign(bytecode.code.size(), 0);
+
+    std::vector<Option> options;
+    for (unsigned i = 0; i < OPTION_COUNT; ++i)
     {
-    case Token::T_LABEL:
-        preOptimiseLabel(operand, machine);
-        break;
-    default: break;
+        if (optionEnabled[i]) options.push_back(Option(i));
     }
-}
+    parallelArrays = new ParallelArrays(program, machine.managedHeap().collectionMode(), options.size(),
+                                        options.empty() ? NULL : &options[0]);
+    machine.parallelArrays = parallelArrays;
 
-void Interpreter::preOptimise()
-{
-    for (unsigned i = 0; i < instructions.size(); ++i)
+    if (machine.owner_ == &machine)
     {
-        preOptimiseOperand(instructions[i].operand1, machine);
-        preOptimiseOperand(instructions[i].operand2, machine);
+        scheduler = new Scheduler(machine, program, options.size(), options.empty() ? NULL : &options[0]);
+        machine.scheduler = scheduler;
     }
 }
 
@@ -163,39 +190,98 @@ void Interpreter::run()
                 useconds = end.tv_usec - start.tv_usec,
                 milliseconds = (seconds * 1000) + (useconds / 1000);
         std::cout << "Execution time: " << milliseconds << " ms" << std::endl;
+    }
+    else runWithoutOptions();
 
-        return;
+    if (optionEnabled[O_QUICKENING_STATISTICS])
+    {
+        std::cout << "Instructions quickened: " << machine.quickenedCount_ << std::endl
+                  << "Instructions deoptimised: " << machine.deoptimisedCount_ << std::endl;
     }
 
-    runWithoutOptions();
+    if (optionEnabled[O_ALLOCATOR_STATISTICS])
+    {
+        const ManagedHeap::AllocatorStatistics statistics = machine.managedHeap().allocatorStatistics();
+        std::cout << "Free blocks: " << statistics.freeBlockCount << std::endl
+                  << "Free runs: " << statistics.freeRunCount << std::endl
+                  << "Largest free run: " << statistics.largestFreeRun << std::endl
+                  << "Fragmentation: " << statistics.fragmentation * 100.0 << "%" << std::endl
+                  << "Free list lengths:";
+        for (unsigned i = 0; i < ManagedHeap::sizeClassCount; ++i)
+        {
+            if (statistics.freeListLengths[i] != 0)
+                std::cout << ' ' << (1u << i) << "+:" << statistics.freeListLengths[i];
+        }
+        std::cout << std::endl;
+
+        if (machine.managedHeap().collectionMode() == ManagedHeap::CM_MARK_SWEEP)
+        {
+            const ManagedHeap::CollectionStatistics & collections = machine.managedHeap().collectionStatistics();
+            std::cout << "Collections: " << collections.collectionCount << std::endl
+                      << "Arrays collected: " << collections.arraysCollected << std::endl
+                      << "Total collection pause: " << collections.totalPauseMilliseconds << " ms" << std::endl
+                      << "Longest collection pause: " << collections.longestPauseMilliseconds << " ms" << std::endl;
+        }
+
+        const ManagedHeap::CompactionStatistics & compactions = machine.managedHeap().compactionStatistics();
+        std::cout << "Compactions: " << compactions.compactionCount << std::endl
+                  << "Bytes moved: " << compactions.bytesMoved << std::endl
+                  << "Total compaction time: " << compactions.totalMilliseconds << " ms" << std::endl
+                  << "Longest compaction: " << compactions.longestMilliseconds << " ms" << std::endl;
+    }
 }
 
-void Interpreter::runWithoutOptions()
+bool Interpreter::runWithoutOptions()
 {
-    try { machine.jump("main"); }
+    try { machine.programCounter() = program.entryPoint(); }
     catch (const std::exception & e)
     {
-        std::cout << e.what() << std::endl
-                  << "Label 'main' not found" << std::endl
-                  << "Execution halted" << std::endl;
-        return;
+        machine.output() << e.what() << std::endl
+                         << "Label 'main' not found" << std::endl
+                         << "Execution halted" << std::endl;
+        return false;
     }
 
-    unsigned programCounter = machine.programCounter(), & machineProgramCounter = machine.programCounter();
-    while (programCounter < instructions.size())
+    return execute();
+}
+
+bool Interpreter::callFunction(const unsigned codeIndex, const Block & argument, Block & result)
+{
+    machine.stack_.push(argument);
+    machine.programCounter_ = bytecode.code.size() - 2; // So that the function returns to the P_HALT at the end
+    machine.call(codeIndex);
+
+    // Counts towards the function getting hot, as a call instruction does
+    if (jit.enabled() && (++machine.labelCounts_[codeIndex] >= Jit::hotThreshold))
     {
-        try { execute(instructions[programCounter]); }
+        const CompiledInstruction * code = &bytecode.code[codeIndex];
+        try { runNatively(code); }
         catch (const std::exception & e)
         {
-            std::cout << "Error on line " << programCounter + 1 << std::endl
-                      << e.what() << std::endl
-                      << "Execution halted" << std::endl;
-            return;
+            machine.output() << "Error on line " << code->line + 1 << std::endl
+                             << e.what() << std::endl
+                             << "Execution halted" << std::endl;
+            return false;
         }
-
-        if (programCounter == machineProgramCounter) ++machineProgramCounter; // i.e. if there were no jumps
-        programCounter = machineProgramCounter;
+        machine.programCounter_ = code - &bytecode.code[0];
     }
+
+    if (!execute()) return false;
+    if (machine.stack_.empty()) throw(std::runtime_error("Interpreter::callFunction: Function did not return a value"));
+    result = machine.stack_.peek();
+    machine.stack_.pop();
+    return true;
+}
+
+void Interpreter::setParallelWorkerCount(const unsigned workerCount)
+{
+    parallelArrays->setWorkerCount(workerCount);
+    if (scheduler != NULL) scheduler->setCarrierCount(workerCount);
+}
+
+bool Interpreter::resume()
+{
+    return execute();
 }
 
 std::string typeString(const Token::Type type)
@@ -212,6 +298,7 @@ std::string typeString(const Token::Type type)
     case Token::T_OPERAND_STACK_TOP:            return "stack-top";
     case Token::T_OPERAND_STACK_BOTTOM:         return "stack-bottom";
     case Token::T_OPERAND_STACK_NEGATIVE:       return "stack-negative";
+    case Token::T_OPERAND_REDUCTION:            return "reduction";
     case Token::T_OPERAND_NIL:                  return "operand-nil";
     case Token::T_LABEL:                        return "label";
     case Token::T_NULL:                         return "null";
@@ -234,6 +321,7 @@ std::string valueString(const Token & token)
     case Token::T_OPERAND_STACK_TOP:
     case Token::T_OPERAND_STACK_BOTTOM:
     case Token::T_OPERAND_STACK_NEGATIVE:       stream << token.stackPositionData; break;
+    case Token::T_OPERAND_REDUCTION:            stream << token.reductionData; break;
     case Token::T_OPERAND_NIL:                  stream << "operand-nil"; break;
     case Token::T_LABEL:                        stream << token.labelData; break;
     case Token::T_NULL:                         stream << "null"; break;
@@ -244,7 +332,7 @@ std::string valueString(const Token & token)
 
 void Interpreter::outputTokenData(const std::string & instruction)
 {
-    const Instruction & i = Lexer::tokenize(instruction, machine);
+    const Instruction i = Lexer::tokenize(instruction);
     std::cout << (i.label.isNull() ? "" : typeString(i.label.type) + " ")
               << typeString(i.opcode.type) << " "
               << (i.operand1.isPointer ? "@" : "") + typeString(i.operand1.type) << " "
@@ -255,258 +343,216 @@ void Interpreter::outputTokenData(const std::string & instruction)
               << valueString(i.operand2) << std::endl;
 }
 
-inline bool firstOperandIsLabel(const Instruction & instruction, const Block * const operand2)
+void Interpreter::runNatively(const CompiledInstruction *& code)
 {
-    return (instruction.operand1.type == Token::T_LABEL) && (operand2 == NULL) && (instruction.operand2.isNull());
+    const CompiledInstruction * const codeStart = &bytecode.code[0];
+    unsigned index = code - codeStart;
+    const bool succeeded = jit.run(index);
+    machine.stack_.recordDepth(); // Native code pushes onto the stack directly
+    code = codeStart + index;
+    if (!succeeded) throw(std::runtime_error(jit.error()));
 }
 
-void Interpreter::execute(const Instruction & instruction)
+// Computed gotos let each instruction jump straight to the code for the next one (direct threading). Fall back to a
+// switch for compilers that don't support them
+#if defined(__GNUC__)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef THREADED_DISPATCH
+#define OPCODE_TARGET(opcode) L_##opcode:
+#define PSEUDO_OPCODE_TARGET(opcode) L_##opcode:
+#define HANDLER_TARGET() L_HANDLER:
+#define DISPATCH() goto *code->target
+#else
+#define OPCODE_TARGET(opcode) case Opcodes::opcode:
+#define PSEUDO_OPCODE_TARGET(opcode) case CompiledInstruction::opcode:
+#define HANDLER_TARGET() default:
+#define DISPATCH() goto dispatch
+#endif
+
+#define NEXT() ++code; DISPATCH()
+#define JUMP(index) code = codeStart + (index); DISPATCH()
+
+// Calls and backward jumps count towards the code they go to getting hot. Once it is, it's run natively
+// They are also where threads stop for each other while the machine's green threads are multiplexed
+#define ENTER(index) \
+    code = codeStart + (index); \
+    if (__atomic_load_n(safepointFlag, __ATOMIC_RELAXED)) \
+    { \
+        machine.programCounter_ = code - codeStart; \
+        machine.safepoint(); \
+        code = codeStart + machine.programCounter_; \
+    } \
+    if (jitEnabled && (++labelCounts[code - codeStart] >= Jit::hotThreshold)) runNatively(code); \
+    DISPATCH()
+#define BRANCH(index) if ((index) <= unsigned(code - codeStart)) { ENTER(index); } JUMP(index)
+
+// Runs the first instruction of a superinstruction and moves on to the second, so that an error in the second is
+// reported against its own line
+#define FIRST_OF_PAIR() code->handler(machine, *code, temporaries); ++code
+#define COMPARE_AND_JUMP(flagId) FIRST_OF_PAIR(); if (flags.getValue(flagId)) { BRANCH(code->operand1.target); } NEXT()
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // Computed gotos are a GNU extension
+#endif
+
+bool Interpreter::execute(const void * const ** const dispatchTable)
 {
-    if (instruction.opcode.isNull()) return;
-
-    machine.operand1IsPointer() = instruction.operand1.isPointer;
-    machine.operand2IsPointer() = instruction.operand2.isPointer;
-
-    bool operand1IsLabel, operand2IsLabel;
-    Block * operand1Block = getBlockFromToken(instruction.operand1, operand1IsLabel, 1),
-            * operand2Block = getBlockFromToken(instruction.operand2, operand2IsLabel, 2);
-
-    short requiredOperandNumber = Opcodes::opcodeOperandCounts[instruction.opcode.opcodeData];
-    if (operand1Block != NULL) --requiredOperandNumber;
-    if (operand2Block != NULL) --requiredOperandNumber;
-
-    bool error = false, instructionFinished = false;
-    if (requiredOperandNumber != 0)
+#ifdef THREADED_DISPATCH
+    // In the same order as Opcodes::Id, followed by the CompiledInstruction pseudo opcodes. Instructions that operate on
+    // blocks all go through their handler
+    static const void * const targets[] =
     {
-        // Deal with special cases that accept labels or 'nil', which don't have blocks to represent them
-        switch (instruction.opcode.opcodeData)
-        {
-        case Opcodes::POP:
-            if ((instruction.operand1.type == Token::T_OPERAND_NIL)
-                    && (operand2Block == NULL) && (instruction.operand2.isNull()))
-            {
-                machine.pop(Machine::L_NIL);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::ALLC:
-            if ((instruction.operand1.type == Token::T_OPERAND_DATA_TYPE) && (operand2Block != NULL))
-            {
-                machine.allocate(instruction.operand1.dataTypeData, *operand2Block);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::IST:
-            if ((operand1Block != NULL) && (instruction.operand2.type == Token::T_OPERAND_DATA_TYPE))
-            {
-                machine.isDataType(*operand1Block, instruction.operand2.dataTypeData);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::CPYF:
-            if ((operand1Block != NULL) && (instruction.operand2.type == Token::T_OPERAND_COMPARISON_FLAG_ID))
-            {
-                machine.copyFlag(*operand1Block, instruction.operand2.comparisonFlagData);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::JMP:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.jump(instruction.operand1.labelLineNumberData);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::JE:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.conditionalJump(instruction.operand1.labelLineNumberData, CFR::F_EQUAL);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::JNE:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.conditionalJump(instruction.operand1.labelLineNumberData, CFR::F_NOT_EQUAL);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::JL:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.conditionalJump(instruction.operand1.labelLineNumberData, CFR::F_LESS);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::JG:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.conditionalJump(instruction.operand1.labelLineNumberData, CFR::F_GREATER);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::JLE:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.conditionalJump(instruction.operand1.labelLineNumberData, CFR::F_LESS_EQUAL);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::JGE:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.conditionalJump(instruction.operand1.labelLineNumberData, CFR::F_GREATER_EQUAL);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::CALL:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.call(instruction.operand1.labelLineNumberData);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::EXTL:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.loadExtension(instruction.operand1.labelData);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        case Opcodes::EXTC:
-            if (firstOperandIsLabel(instruction, operand2Block))
-            {
-                machine.extensionCall(instruction.operand1.labelData);
-                instructionFinished = true;
-            }
-            else error = true;
-            break;
-
-        default: error = true;
-        }
-    }
-    if (error)
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  clr  set  move swap in
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  ins  out  outs push pop
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  inc  dec  neg  abs  add
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  sub  mul  div  mod  sadd
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  ssub smul sdiv smod allc
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  pla  fna  atoa ael  alen
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  cpya cnvi cnvr cnvc cnvb
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  cnvt dref cmp  cmpt ist
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  cpyf not  and  or   xor
+        &&L_JMP,     &&L_JE,      &&L_JNE,     &&L_JL,      &&L_JG,
+        &&L_JLE,     &&L_JGE,     &&L_CALL,    &&L_RET,     &&L_EXTL,
+        &&L_EXTC,    &&L_SPAWN,   &&L_YIELD,   &&L_JOIN,    &&L_SEND,
+        &&L_RECV,    &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  recv tryrecv pmap preduce vadd
+        &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, &&L_HANDLER, //  vsub vmul vdiv vfill vdot
+        &&L_P_HALT,  &&L_P_INVALID,
+        &&L_S_HANDLER_PAIR, &&L_S_HANDLER_JUMP, &&L_S_HANDLER_CALL, &&L_S_HANDLER_RETURN,
+        &&L_S_COMPARE_JE,   &&L_S_COMPARE_JNE,  &&L_S_COMPARE_JL,   &&L_S_COMPARE_JG,
+        &&L_S_COMPARE_JLE,  &&L_S_COMPARE_JGE
+    };
+    if (dispatchTable != NULL)
     {
-        if (requiredOperandNumber < 0) throw(std::runtime_error("Interpreter::execute: Too many operands given"));
-        else if (requiredOperandNumber > 0) throw(std::runtime_error("Interpreter:execute: Too few operands given"));
-        else if ((operand1Block == NULL) && (operand2Block != NULL))
-            throw(std::runtime_error("Interpreter:execute: First operand given is invalid"));
+        *dispatchTable = targets;
+        return true;
     }
-
-    if (instructionFinished) return;
-
-    switch (instruction.opcode.opcodeData)
+#else
+    if (dispatchTable != NULL)
     {
-    case Opcodes::CLR:  machine.clear(*operand1Block); break;
-    case Opcodes::SET:  machine.set(*operand1Block, *operand2Block); break;
-    case Opcodes::MOVE: machine.move(*operand1Block, *operand2Block); break;
-    case Opcodes::SWAP: machine.swap(*operand1Block, *operand2Block); break;
-    case Opcodes::IN:   machine.read(*operand1Block); break;
-    case Opcodes::INS:  machine.readString(*operand1Block); break;
-    case Opcodes::OUT:  machine.write(*operand1Block); break;
-    case Opcodes::OUTS: machine.writeString(*operand1Block); break;
-    case Opcodes::PUSH: machine.push(*operand1Block); break;
-    case Opcodes::POP:  machine.pop(*operand1Block); break;
-    case Opcodes::INC:  machine.increment(*operand1Block); break;
-    case Opcodes::DEC:  machine.decrement(*operand1Block); break;
-    case Opcodes::NEG:  machine.negate(*operand1Block); break;
-    case Opcodes::ABS:  machine.absolute(*operand1Block); break;
-    case Opcodes::ADD:  machine.add(*operand1Block, *operand2Block); break;
-    case Opcodes::SUB:  machine.subtract(*operand1Block, *operand2Block); break;
-    case Opcodes::MUL:  machine.multiply(*operand1Block, *operand2Block); break;
-    case Opcodes::DIV:  machine.divide(*operand1Block, *operand2Block); break;
-    case Opcodes::MOD:  machine.modulo(*operand1Block, *operand2Block); break;
-    case Opcodes::SADD: machine.stackAdd(); break;
-    case Opcodes::SSUB: machine.stackSubtract(); break;
-    case Opcodes::SMUL: machine.stackMultiply(); break;
-    case Opcodes::SDIV: machine.stackDivide(); break;
-    case Opcodes::SMOD: machine.stackModulo(); break;
-    case Opcodes::ALLC: break; // handled above
-    case Opcodes::PLA:  machine.startPopulatingArray(*operand1Block, *operand2Block); break;
-    case Opcodes::FNA:  machine.stopPopulatingArray(); break;
-    case Opcodes::ATOA: machine.addToArray(*operand1Block); break;
-    case Opcodes::AEL:  machine.getArrayElement(*operand1Block, *operand2Block); break;
-    case Opcodes::ALEN: machine.getArrayLength(*operand1Block, *operand2Block); break;
-    case Opcodes::CPYA: machine.copyArray(*operand1Block, *operand2Block); break;
-    case Opcodes::CNVI: machine.convert(*operand1Block, *operand2Block, Block::DT_INTEGER); break;
-    case Opcodes::CNVR: machine.convert(*operand1Block, *operand2Block, Block::DT_REAL); break;
-    case Opcodes::CNVC: machine.convert(*operand1Block, *operand2Block, Block::DT_CHAR); break;
-    case Opcodes::CNVB: machine.convert(*operand1Block, *operand2Block, Block::DT_BOOLEAN); break;
-    case Opcodes::CNVT: machine.convertToDataTypeOf(*operand1Block, *operand2Block); break;
-    case Opcodes::DREF: machine.dereference(*operand1Block, *operand2Block); break;
-    case Opcodes::CMP:  machine.compare(*operand1Block, *operand2Block); break;
-    case Opcodes::CMPT: machine.compareDataType(*operand1Block, *operand2Block); break;
-    case Opcodes::IST:  break; // handled above
-    case Opcodes::CPYF: break; // handled above
-    case Opcodes::NOT:  machine.logicalNot(*operand1Block); break;
-    case Opcodes::AND:  machine.logicalAnd(*operand1Block, *operand2Block); break;
-    case Opcodes::OR:   machine.logicalOr(*operand1Block, *operand2Block); break;
-    case Opcodes::XOR:  machine.logicalXor(*operand1Block, *operand2Block); break;
-    case Opcodes::JMP:  // all handled above
-    case Opcodes::JE:
-    case Opcodes::JNE:
-    case Opcodes::JL:
-    case Opcodes::JG:
-    case Opcodes::JLE:
-    case Opcodes::JGE:
-    case Opcodes::CALL: break; // handled above
-    case Opcodes::RET:  machine.returnFromCall(*operand1Block); break;
-    case Opcodes::EXTL: // handled above
-    case Opcodes::EXTC: break;
+        *dispatchTable = NULL;
+        return true;
     }
-}
+#endif
 
-Block * Interpreter::getBlockFromToken(const Token & token, bool & isLabel, short operandNumber)
-{
-    static Block block[2];
+    const CompiledInstruction * const codeStart = &bytecode.code[0];
+    const CompiledInstruction * code = codeStart + machine.programCounter_;
+    const ComparisonFlagRegister & flags = machine.comparisonFlagRegister_;
+    const bool jitEnabled = jit.enabled();
+    unsigned * const labelCounts = jitEnabled ? &machine.labelCounts_[0] : NULL;
+    const unsigned char * const safepointFlag = machine.safepointFlag();
 
-    if (token.type == Token::T_OPERAND_STATIC_LOCATION) return token.locationData;
-    else if (token.type == Token::T_LABEL)
+    try
     {
-        isLabel = true;
-        return NULL;
-    }
+#ifdef THREADED_DISPATCH
+        DISPATCH();
+#else
+    dispatch:
+        switch (code->dispatchOpcode)
+        {
+#endif
+        OPCODE_TARGET(JMP) BRANCH(code->operand1.target);
+        OPCODE_TARGET(JE)  if (flags.getValue(CFR::F_EQUAL)) { BRANCH(code->operand1.target); } NEXT();
+        OPCODE_TARGET(JNE) if (flags.getValue(CFR::F_NOT_EQUAL)) { BRANCH(code->operand1.target); } NEXT();
+        OPCODE_TARGET(JL)  if (flags.getValue(CFR::F_LESS)) { BRANCH(code->operand1.target); } NEXT();
+        OPCODE_TARGET(JG)  if (flags.getValue(CFR::F_GREATER)) { BRANCH(code->operand1.target); } NEXT();
+        OPCODE_TARGET(JLE) if (flags.getValue(CFR::F_LESS_EQUAL)) { BRANCH(code->operand1.target); } NEXT();
+        OPCODE_TARGET(JGE) if (flags.getValue(CFR::F_GREATER_EQUAL)) { BRANCH(code->operand1.target); } NEXT();
+
+        OPCODE_TARGET(CALL)
+            machine.programCounter_ = code - codeStart;
+            machine.call(code->operand1.target);
+            ENTER(machine.programCounter_);
+        OPCODE_TARGET(RET)
+            code->handler(machine, *code, temporaries);
+            JUMP(machine.programCounter_);
+
+        OPCODE_TARGET(EXTL) machine.loadExtension(bytecode.strings[code->operand1.nameIndex].c_str()); NEXT();
+        OPCODE_TARGET(EXTC)
+        {
+            const ExtensionFunction * const function = bytecode.extensionFunctionFor(code - codeStart);
+            if (function != NULL) machine.extensionCall(*function);
+            else machine.extensionCall(bytecode.strings[code->operand1.nameIndex].c_str()); // Reports it as unknown
+            JUMP(machine.programCounter_);
+        }
 
-    isLabel = false;
-    if (token.isNull() || (operandNumber < 1) || (operandNumber > 2)) return NULL;
-    --operandNumber;
-    switch (token.type)
+        // Switching threads changes the stack and registers in place, so execution just carries on from the program
+        // counter of the thread switched to
+        OPCODE_TARGET(SPAWN) machine.spawn(code->operand1.target, bytecode.code.size() - 1); NEXT();
+        OPCODE_TARGET(YIELD)
+            machine.programCounter_ = code - codeStart + 1;
+            machine.yield();
+            JUMP(machine.programCounter_);
+        OPCODE_TARGET(JOIN)
+        OPCODE_TARGET(SEND)
+        OPCODE_TARGET(RECV)
+            machine.programCounter_ = code - codeStart;
+            code->handler(machine, *code, temporaries);
+            JUMP(machine.programCounter_);
+
+        PSEUDO_OPCODE_TARGET(P_INVALID) throw(std::runtime_error(bytecode.strings[code->operand1.nameIndex]));
+        PSEUDO_OPCODE_TARGET(P_HALT)
+            machine.programCounter_ = code - codeStart;
+            if (machine.finishThread()) { JUMP(machine.programCounter_); }
+            return !machine.threadFailed();
+
+        PSEUDO_OPCODE_TARGET(S_HANDLER_PAIR)
+            FIRST_OF_PAIR();
+            code->handler(machine, *code, temporaries);
+            NEXT();
+        PSEUDO_OPCODE_TARGET(S_HANDLER_JUMP)
+            FIRST_OF_PAIR();
+            BRANCH(code->operand1.target);
+        PSEUDO_OPCODE_TARGET(S_HANDLER_CALL)
+            FIRST_OF_PAIR();
+            machine.programCounter_ = code - codeStart;
+            machine.call(code->operand1.target);
+            ENTER(machine.programCounter_);
+        PSEUDO_OPCODE_TARGET(S_HANDLER_RETURN)
+            FIRST_OF_PAIR();
+            code->handler(machine, *code, temporaries);
+            JUMP(machine.programCounter_);
+        PSEUDO_OPCODE_TARGET(S_COMPARE_JE)  COMPARE_AND_JUMP(CFR::F_EQUAL);
+        PSEUDO_OPCODE_TARGET(S_COMPARE_JNE) COMPARE_AND_JUMP(CFR::F_NOT_EQUAL);
+        PSEUDO_OPCODE_TARGET(S_COMPARE_JL)  COMPARE_AND_JUMP(CFR::F_LESS);
+        PSEUDO_OPCODE_TARGET(S_COMPARE_JG)  COMPARE_AND_JUMP(CFR::F_GREATER);
+        PSEUDO_OPCODE_TARGET(S_COMPARE_JLE) COMPARE_AND_JUMP(CFR::F_LESS_EQUAL);
+        PSEUDO_OPCODE_TARGET(S_COMPARE_JGE) COMPARE_AND_JUMP(CFR::F_GREATER_EQUAL);
+
+        HANDLER_TARGET()
+            code->handler(machine, *code, temporaries);
+            NEXT();
+#ifndef THREADED_DISPATCH
+        }
+#endif
+    }
+    catch (const std::exception & e)
     {
-    case Token::T_OPERAND_CONST_INT:            block[operandNumber].setToInteger(token.integerData); break;
-    case Token::T_OPERAND_CONST_REAL:           block[operandNumber].setToReal(token.realData); break;
-    case Token::T_OPERAND_CONST_CHAR:           block[operandNumber].setToChar(token.charData); break;
-    case Token::T_OPERAND_CONST_BOOL:           block[operandNumber].setToBoolean(token.booleanData); break;
-    case Token::T_OPERAND_STACK_TOP:            return &machine.stack().fromTop(token.stackPositionData);
-    case Token::T_OPERAND_STACK_BOTTOM:         return &machine.stack().at(token.stackPositionData);
-    case Token::T_OPERAND_STACK_NEGATIVE:       return &machine.stack().fromTopBelow(token.stackPositionData);
-    default: return NULL;
+        {
+            Mutex::OptionalLock lock(machine.ioMutex());
+            machine.output() << "Error on line " << code->line + 1 << std::endl
+                             << e.what() << std::endl
+                             << "Execution halted" << std::endl;
+        }
+        machine.haltThreads();
+        return false;
     }
-
-    return &block[operandNumber];
 }
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+#undef THREADED_DISPATCH
+#undef OPCODE_TARGET
+#undef PSEUDO_OPCODE_TARGET
+#undef HANDLER_TARGET
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef ENTER
+#undef BRANCH
+#undef FIRST_OF_PAIR
+#undef COMPARE_AND_JUMP
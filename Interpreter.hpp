@@ -12,10 +12,13 @@
 #include <sstream>
 #include <vector>
 
-#include "Instruction.hpp"
+#include "Bytecode.hpp"
+#include "Program.hpp"
+#include "Jit.hpp"
 
 class Machine;
-class Block;
+class ParallelArrays;
+class Scheduler;
 
 class Interpreter
 {
@@ -23,6 +26,10 @@ public:
     enum Option
     {
         O_TIME_EXECUTION = 0,
+        O_DUMP_SUPERINSTRUCTIONS, // Lists the pairs of instructions that were fused into superinstructions
+        O_DISABLE_JIT,            // Never compiles hot code to native code
+        O_QUICKENING_STATISTICS,  // Reports how many instructions were quickened and deoptimised after running
+        O_ALLOCATOR_STATISTICS,   // Reports the state of the managed heap's free lists (and collector) after running
         OPTION_COUNT
     };
 
@@ -30,24 +37,51 @@ public:
     Interpreter(Machine & machine, unsigned optionCount, const Option * options);
     // Run from file (just plain text for now)
     Interpreter(Machine & machine, const char * fileName, unsigned optionCount, const Option * options);
+    // Run a program that has already been compiled, which may be shared with other interpreters. Throws
+    // Compiler::Error if the program can't be bound to the machine
+    Interpreter(Machine & machine, const Program & program, unsigned optionCount, const Option * options);
+    ~Interpreter();
 
     void parseOptions(unsigned optionCount, const Option * options);
 
     void tokenizeAndAddInstruction(const std::string & instruction, unsigned line);
-    void preOptimise(); // Optimisation that occurs before running the program
+    void preOptimise(); // Optimisation that occurs before running the program (compiles the instructions to bytecode)
     void run();
-    void runWithoutOptions();
+    bool runWithoutOptions(); // Returns false if execution was halted by an error
+    // Calls the function at codeIndex with argument, as the call instruction would, and puts what it returns in
+    // result (which may be argument). The machine mustn't be running anything else. Returns false if execution was
+    // halted by an error, after reporting it to the machine's output
+    bool callFunction(unsigned codeIndex, const Block & argument, Block & result);
+    // How many threads pmap and preduce can split arrays between, including the one running the program, or 0 (the
+    // default) for one per processor. A count above 1 also spreads green threads over that many carriers (see Scheduler)
+    void setParallelWorkerCount(unsigned workerCount);
+    // Carries on executing from the machine's program counter, as a scheduler's carrier does with each thread it takes.
+    // Returns false if execution was halted by an error
+    bool resume();
     void outputTokenData(const std::string & instruction);
-    void execute(const Instruction & instruction);
 
 private:
-    static const unsigned instructionReservation = 10000;
-
     bool optionEnabled[OPTION_COUNT];
     Machine & machine;
-    std::vector<Instruction> instructions;
+    Program ownProgram; // Only used when the interpreter loads the program itself
+    const Program & program;
+    Bytecode bytecode; // The program's code, bound to the machine
+    Block temporaries[2]; // Copies of constants for instructions that may write to their operands
+    Jit jit;
+    ParallelArrays * parallelArrays; // For pmap and preduce
+    Scheduler * scheduler; // For green threads. Only made for a machine that isn't a carrier itself
+
+    // Executes the bytecode from the machine's program counter until the end of the code is reached. If
+    // dispatchTable is not NULL, nothing is executed and it is set to the table of dispatch targets for each opcode
+    // (or NULL if the targets aren't used). Returns false if an instruction failed, after reporting it to the machine's
+    // output
+    bool execute(const void * const ** dispatchTable = NULL);
+    // Runs hot code natively from the given instruction, updating it to where the interpreter should carry on from.
+    // Throws if an instruction fails
+    void runNatively(const CompiledInstruction *& code);
 
-    Block * getBlockFromToken(const Token & token, bool & isLabel, const short operandNumber);
+    Interpreter(const Interpreter &);
+    Interpreter & operator =(const Interpreter &);
 };
 
 #endif // INTERPRETER_HPP
@@ -0,0 +1,883 @@
+/*
+ * Jit.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <map>
+
+#include "Jit.hpp"
+#include "Bytecode.hpp"
+#include "Machine.hpp"
+
+// Native code relies on the layout of a block, so it isn't generated for compact ones (see Block)
+#if defined(__x86_64__) && defined(__linux__) && !defined(COMPACT_BLOCKS)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+const unsigned Jit::hotThreshold;
+const unsigned Jit::deoptimisationLimit;
+
+// Set in the index that native code returns when the instruction there has to be run by the interpreter, as opposed
+// to control just having been passed to it
+const unsigned interpretFlag = 1u << 31;
+
+struct Jit::Region
+{
+    typedef unsigned (*Function)(unsigned index); // Returns the index to carry on from
+
+    unsigned start, end; // The range of code indices compiled
+    bool guarded;        // Whether integer operations were compiled inline behind type guards
+    unsigned deoptimisations;
+    std::vector<const void*> entries; // The native code for each instruction, indexed from start
+    void * memory;
+    size_t memorySize;
+    Function function;
+};
+
+// Just enough of an x86-64 assembler for the code the compiler emits. Only the first eight registers are used, so no
+// instruction needs the REX prefix's register extension bits
+class Jit::Assembler
+{
+public:
+    enum Register { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7 };
+    enum Condition
+    {
+        C_ABOVE_EQUAL = 0x3,
+        C_EQUAL = 0x4,
+        C_NOT_EQUAL = 0x5,
+        C_BELOW_EQUAL = 0x6,
+        C_LESS = 0xC,
+        C_GREATER_EQUAL = 0xD,
+        C_LESS_EQUAL = 0xE,
+        C_GREATER = 0xF
+    };
+
+    std::vector<unsigned char> code;
+
+    unsigned newLabel()
+    {
+        labelOffsets.push_back(0);
+        return labelOffsets.size() - 1;
+    }
+    void bind(const unsigned label) { labelOffsets[label] = code.size(); }
+    unsigned offsetOf(const unsigned label) const { return labelOffsets[label]; }
+
+    // Fills in the displacements of all jumps to labels
+    void resolveLabels()
+    {
+        for (unsigned i = 0; i < fixups.size(); ++i)
+        {
+            const int displacement = int(labelOffsets[fixups[i].label]) - int(fixups[i].position + 4);
+            memcpy(&code[fixups[i].position], &displacement, 4);
+        }
+    }
+
+    void move(const Register reg, const unsigned long value) { rex(); byte(0xB8 + reg); quad(value); }
+    void move(const Register reg, const void * const address) { move(reg, reinterpret_cast<unsigned long>(address)); }
+    void move32(const Register reg, const unsigned value) { byte(0xB8 + reg); dword(value); }
+    void move32(const Register dest, const Register source) { byte(0x89); direct(source, dest); }
+
+    void load32(const Register reg, const Register base, const int disp) { byte(0x8B); memory(reg, base, disp); }
+    void load64(const Register reg, const Register base, const int disp) { rex(); load32(reg, base, disp); }
+    void store32(const Register base, const int disp, const Register reg) { byte(0x89); memory(reg, base, disp); }
+    void store64(const Register base, const int disp, const Register reg) { rex(); store32(base, disp, reg); }
+
+    void add32(const Register reg, const Register base, const int disp) { byte(0x03); memory(reg, base, disp); }
+    void add64(const Register dest, const Register source) { rex(); byte(0x01); direct(source, dest); }
+    void addImmediate32(const Register reg, const unsigned value) { byte(0x81); direct(0, reg); dword(value); }
+    void subtractImmediate32(const Register reg, const unsigned value) { byte(0x81); direct(5, reg); dword(value); }
+    void addToMemory32(const Register base, const int disp, const signed char value)
+    {
+        byte(0x83); memory(0, base, disp); byte(value);
+    }
+    void addToMemory64(const Register base, const int disp, const signed char value)
+    {
+        rex(); addToMemory32(base, disp, value);
+    }
+    void addToMemory64(const Register base, const int disp, const Register reg)
+    {
+        rex(); byte(0x01); memory(reg, base, disp);
+    }
+    void subtractFromMemory64(const Register base, const int disp, const Register reg)
+    {
+        rex(); byte(0x29); memory(reg, base, disp);
+    }
+    void multiply64(const Register reg, const Register base, const int disp)
+    {
+        rex(); byte(0x0F); byte(0xAF); memory(reg, base, disp);
+    }
+    void multiplyImmediate64(const Register reg, const signed char value)
+    {
+        rex(); byte(0x6B); direct(reg, reg); byte(value);
+    }
+
+    void compare32(const Register reg, const Register base, const int disp) { byte(0x3B); memory(reg, base, disp); }
+    void compare64(const Register reg, const Register base, const int disp) { rex(); compare32(reg, base, disp); }
+    void compareImmediate32(const Register reg, const unsigned value) { byte(0x81); direct(7, reg); dword(value); }
+    void compareMemory8(const Register base, const int disp, const signed char value)
+    {
+        byte(0x80); memory(7, base, disp); byte(value);
+    }
+    void compareMemory32(const Register base, const int disp, const signed char value)
+    {
+        byte(0x83); memory(7, base, disp); byte(value);
+    }
+    void testLow8(const Register reg) { byte(0x84); direct(reg, reg); }
+    void setIf(const Condition condition, const Register base, const int disp)
+    {
+        byte(0x0F); byte(0x90 + condition); memory(0, base, disp);
+    }
+
+    void jump(const unsigned label) { byte(0xE9); fixup(label); }
+    void jumpIf(const Condition condition, const unsigned label) { byte(0x0F); byte(0x80 + condition); fixup(label); }
+    // Jumps to the address at table + index * 8
+    void jumpThroughTable(const Register table, const Register index)
+    {
+        byte(0xFF); byte(0x24); byte(0xC0 | (index << 3) | table);
+    }
+    void call(const Register reg) { byte(0xFF); direct(2, reg); }
+
+    // The frame only keeps the stack aligned for calls out of native code
+    void enterFrame() { rex(); byte(0x83); direct(5, RSP); byte(8); }
+    void leaveFrameAndReturn() { rex(); byte(0x83); direct(0, RSP); byte(8); byte(0xC3); }
+
+private:
+    static const int RSP = 4;
+
+    struct Fixup
+    {
+        unsigned position, label;
+    };
+
+    std::vector<unsigned> labelOffsets;
+    std::vector<Fixup> fixups;
+
+    void byte(const unsigned char value) { code.push_back(value); }
+    void dword(const unsigned value) { for (unsigned i = 0; i < 4; ++i) byte((value >> (i * 8)) & 0xFF); }
+    void quad(const unsigned long value) { dword(value & 0xFFFFFFFFul); dword((value >> 16) >> 16); }
+    void rex() { byte(0x48); }
+
+    void direct(const int reg, const int rm) { byte(0xC0 | (reg << 3) | rm); }
+    // [base + disp32]. base is never RSP, which would need a SIB byte
+    void memory(const int reg, const Register base, const int disp)
+    {
+        byte(0x80 | (reg << 3) | base);
+        dword(unsigned(disp));
+    }
+
+    void fixup(const unsigned label)
+    {
+        const Fixup f = { unsigned(code.size()), label };
+        fixups.push_back(f);
+        dword(0);
+    }
+};
+
+// Compiles the instructions in one region
+class Jit::RegionCompiler
+{
+public:
+    typedef Jit::Assembler A;
+
+    RegionCompiler(Jit & jit, Region & region)
+        : jit(jit), region(region), code(jit.bytecode.code), stack(jit.machine.stack_)
+    {
+#ifdef JIT_SUPPORTED
+        Block probe;
+        typeOffset = reinterpret_cast<char*>(&probe.dataType_) - reinterpret_cast<char*>(&probe);
+        dataOffset = reinterpret_cast<char*>(&probe.integerData_) - reinterpret_cast<char*>(&probe);
+#endif
+        stackPointerAddress = &stack.pointer;
+        stackBlocksAddress = stack.data.firstBlockAddress();
+        stackFrameDisplacement = reinterpret_cast<char*>(&stack.combinedFramePointer)
+                               - reinterpret_cast<char*>(&stack.pointer);
+        stackSizeDisplacement = reinterpret_cast<char*>(&stack.size_) - reinterpret_cast<char*>(&stack.pointer);
+    }
+
+    Assembler assembler;
+    std::vector<unsigned> instructionLabels; // Indexed from region.start
+
+    void compile()
+    {
+        for (unsigned i = region.start; i < region.end; ++i) instructionLabels.push_back(assembler.newLabel());
+        returnLabel = assembler.newLabel();
+
+        // Entry: jump to the code for the instruction whose index was passed in
+        assembler.enterFrame();
+        assembler.move32(A::RAX, A::RDI);
+        assembler.subtractImmediate32(A::RAX, region.start);
+        assembler.move(A::RCX, &region.entries[0]);
+        assembler.jumpThroughTable(A::RCX, A::RAX);
+
+        for (unsigned i = region.start; i < region.end; ++i)
+        {
+            assembler.bind(instructionLabels[i - region.start]);
+            compileInstruction(i);
+        }
+        jumpTo(region.end);
+
+        // Paths that are rarely taken are kept out of the way of the main code
+        for (unsigned i = 0; i < stubs.size(); ++i)
+        {
+            const Stub stub = stubs[i]; // Stubs can be added while these are emitted
+            assembler.bind(stub.label);
+            switch (stub.kind)
+            {
+            case Stub::K_SLOW_PATH:
+                callHandler(stub.index);
+                jumpTo(stub.index + 1);
+                break;
+            case Stub::K_DEOPTIMISE:
+                assembler.move(A::RAX, &region.deoptimisations);
+                assembler.addToMemory32(A::RAX, 0, 1);
+                exit(stub.index | interpretFlag);
+                break;
+            case Stub::K_INTERPRET: exit(stub.index | interpretFlag); break;
+            case Stub::K_EXIT:      exit(stub.index); break;
+            case Stub::K_POLL:
+                assembler.move(A::RAX, jit.machine.safepointFlag());
+                assembler.compareMemory8(A::RAX, 0, 0);
+                assembler.jumpIf(A::C_EQUAL, labelFor(stub.index));
+                exit(stub.index);
+                break;
+            }
+        }
+
+        assembler.bind(returnLabel);
+        assembler.leaveFrameAndReturn();
+        assembler.resolveLabels();
+    }
+
+private:
+    struct Stub
+    {
+        enum Kind
+        {
+            K_SLOW_PATH,  // Runs the instruction through its handler, then carries on with the next one
+            K_DEOPTIMISE, // A type guard failed, so the interpreter has to run the instruction
+            K_INTERPRET,  // The interpreter has to run the instruction (e.g. it threw)
+            K_EXIT,       // Control goes to an instruction outside of the region
+            K_POLL        // A backward jump, which leaves the region instead if threads have been asked to stop
+        };
+
+        unsigned label;
+        Kind kind;
+        unsigned index;
+    };
+
+    Jit & jit;
+    Region & region;
+    const std::vector<CompiledInstruction> & code;
+    Stack & stack;
+
+    int typeOffset, dataOffset; // Of the fields in a Block
+    const unsigned * stackPointerAddress;
+    Block * const * stackBlocksAddress; // Read on each use, as swapping in another thread's stack changes the blocks
+    int stackFrameDisplacement, stackSizeDisplacement; // Of the other stack fields, from the stack pointer
+
+    unsigned returnLabel;
+    std::vector<Stub> stubs;
+    std::map<unsigned, unsigned> exitLabels;
+
+    unsigned stub(const Stub::Kind kind, const unsigned index)
+    {
+        const Stub s = { assembler.newLabel(), kind, index };
+        stubs.push_back(s);
+        return s.label;
+    }
+
+    bool inRegion(const unsigned index) const { return (index >= region.start) && (index < region.end); }
+
+    unsigned labelFor(const unsigned index)
+    {
+        if (inRegion(index)) return instructionLabels[index - region.start];
+
+        std::map<unsigned, unsigned>::const_iterator exitLabel = exitLabels.find(index);
+        if (exitLabel != exitLabels.end()) return exitLabel->second;
+        return exitLabels[index] = stub(Stub::K_EXIT, index);
+    }
+
+    void jumpTo(const unsigned index) { assembler.jump(labelFor(index)); }
+
+    // Where a jump from index to target goes. Backward jumps within the region check for requests to stop first, so
+    // that loops can't keep other threads waiting (see Machine::safepoint)
+    unsigned jumpLabelFor(const unsigned index, const unsigned target)
+    {
+        if ((target > index) || !inRegion(target)) return labelFor(target);
+        return stub(Stub::K_POLL, target);
+    }
+
+    void exit(const unsigned result)
+    {
+        assembler.move32(A::RAX, result);
+        assembler.jump(returnLabel);
+    }
+
+    // Calls a helper that returns false if the instruction threw
+    void callHelper(const unsigned long helper, const unsigned index, const bool passInstruction)
+    {
+        assembler.move(A::RDI, &jit);
+        if (passInstruction) assembler.move(A::RSI, &code[index]);
+        else assembler.move32(A::RSI, index);
+        assembler.move(A::RAX, helper);
+        assembler.call(A::RAX);
+        assembler.testLow8(A::RAX);
+        assembler.jumpIf(A::C_EQUAL, stub(Stub::K_INTERPRET, index));
+    }
+
+    void callHandler(const unsigned index)
+    {
+        callHelper(reinterpret_cast<unsigned long>(&Jit::runHandler), index, true);
+    }
+
+    // Carries on from the instruction at the machine's program counter, which is only known at run time (i.e. after a
+    // return)
+    void jumpToProgramCounter()
+    {
+        const unsigned exitLabel = assembler.newLabel();
+        assembler.move(A::RAX, &jit.machine.programCounter_);
+        assembler.load32(A::RAX, A::RAX, 0);
+        assembler.move32(A::RCX, A::RAX);
+        assembler.subtractImmediate32(A::RCX, region.start);
+        assembler.compareImmediate32(A::RCX, region.end - region.start);
+        assembler.jumpIf(A::C_ABOVE_EQUAL, exitLabel);
+        assembler.move(A::RDX, &region.entries[0]);
+        assembler.jumpThroughTable(A::RDX, A::RCX);
+        assembler.bind(exitLabel);
+        assembler.jump(returnLabel); // The program counter is already in RAX
+    }
+
+    void compileInstruction(const unsigned index)
+    {
+        const CompiledInstruction & instruction = code[index];
+        switch (instruction.opcode)
+        {
+        case Opcodes::JMP:
+            assembler.jump(jumpLabelFor(index, instruction.operand1.target));
+            return;
+        case Opcodes::JE:
+        case Opcodes::JNE:
+        case Opcodes::JL:
+        case Opcodes::JG:
+        case Opcodes::JLE:
+        case Opcodes::JGE:
+            // The conditional jumps are in the same order as the flags they test
+            assembler.move(A::RAX, &jit.machine.comparisonFlagRegister_.flags[0]);
+            assembler.compareMemory8(A::RAX, instruction.opcode - Opcodes::JE, 0);
+            assembler.jumpIf(A::C_NOT_EQUAL, jumpLabelFor(index, instruction.operand1.target));
+            return;
+        case Opcodes::CALL:
+            callHelper(reinterpret_cast<unsigned long>(&Jit::call), index, false);
+            jumpTo(instruction.operand1.target);
+            return;
+        case Opcodes::RET:
+            callHandler(index);
+            jumpToProgramCounter();
+            return;
+        case Opcodes::EXTC:
+            callHelper(reinterpret_cast<unsigned long>(&Jit::extensionCall), index, false);
+            jumpToProgramCounter();
+            return;
+        case Opcodes::SPAWN:
+            callHelper(reinterpret_cast<unsigned long>(&Jit::spawn), index, false);
+            return;
+        // Another thread's context is switched in where this one's was, so its code can carry on natively as well
+        case Opcodes::YIELD:
+        case Opcodes::JOIN:
+        case Opcodes::SEND:
+        case Opcodes::RECV:
+            callHelper(reinterpret_cast<unsigned long>(&Jit::switchThread), index, false);
+            jumpToProgramCounter();
+            return;
+        case Opcodes::EXTL:
+        case CompiledInstruction::P_HALT:
+        case CompiledInstruction::P_INVALID:
+            exit(index | interpretFlag);
+            return;
+        default:
+            if (!compileInline(index)) callHandler(index);
+        }
+    }
+
+    // Operands whose blocks can be found by native code
+    static bool addressable(const Operand & operand)
+    {
+        if (operand.isPointer) return false;
+        switch (operand.kind)
+        {
+        case Operand::K_STATIC:
+        case Operand::K_CONSTANT:
+        case Operand::K_STACK_TOP:
+        case Operand::K_STACK_BOTTOM:
+        case Operand::K_STACK_NEGATIVE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Puts the address of an operand's block in reg, going to fail if it's out of the bounds of the stack. Uses RAX
+    void loadOperand(const Operand & operand, const A::Register reg, const unsigned fail)
+    {
+        switch (operand.kind)
+        {
+        case Operand::K_STATIC:   assembler.move(reg, operand.block); return;
+        case Operand::K_CONSTANT: assembler.move(reg, operand.constant); return;
+
+        case Operand::K_STACK_TOP: // combinedFramePointer + pointer - 1 - position, where position < pointer
+            assembler.move(reg, stackPointerAddress);
+            assembler.load32(A::RAX, reg, 0);
+            assembler.compareImmediate32(A::RAX, operand.stackPosition);
+            assembler.jumpIf(A::C_BELOW_EQUAL, fail);
+            assembler.add32(A::RAX, reg, stackFrameDisplacement);
+            assembler.subtractImmediate32(A::RAX, operand.stackPosition + 1);
+            break;
+        case Operand::K_STACK_BOTTOM: // combinedFramePointer + position, where position < pointer
+            assembler.move(reg, stackPointerAddress);
+            assembler.load32(A::RAX, reg, 0);
+            assembler.compareImmediate32(A::RAX, operand.stackPosition);
+            assembler.jumpIf(A::C_BELOW_EQUAL, fail);
+            assembler.load32(A::RAX, reg, stackFrameDisplacement);
+            assembler.addImmediate32(A::RAX, operand.stackPosition);
+            break;
+        case Operand::K_STACK_NEGATIVE: // combinedFramePointer - 1 - position, where position < combinedFramePointer
+            assembler.move(reg, stackPointerAddress);
+            assembler.load32(A::RAX, reg, stackFrameDisplacement);
+            assembler.compareImmediate32(A::RAX, operand.stackPosition);
+            assembler.jumpIf(A::C_BELOW_EQUAL, fail);
+            assembler.subtractImmediate32(A::RAX, operand.stackPosition + 1);
+            break;
+        default: throw(std::logic_error("Jit::RegionCompiler::loadOperand: Operand is not addressable"));
+        }
+
+        stackBlockAddress(reg);
+    }
+
+    // Turns the stack index in RAX into the address of the block there, putting it in reg
+    void stackBlockAddress(const A::Register reg)
+    {
+        assembler.multiplyImmediate64(A::RAX, sizeof(Block));
+        assembler.move(reg, stackBlocksAddress);
+        assembler.load64(reg, reg, 0);
+        assembler.add64(reg, A::RAX);
+    }
+
+    void guardType(const A::Register reg, const Block::DataType dataType, const unsigned fail)
+    {
+        assembler.compareMemory32(reg, typeOffset, dataType);
+        assembler.jumpIf(A::C_NOT_EQUAL, fail);
+    }
+
+    void guardNotPointer(const A::Register reg, const unsigned fail)
+    {
+        assembler.compareMemory32(reg, typeOffset, Block::DT_POINTER);
+        assembler.jumpIf(A::C_EQUAL, fail);
+    }
+
+    // Block assignment between blocks that aren't pointers, which needs no reference counting. Uses RAX
+    void copyBlock(const A::Register dest, const A::Register source)
+    {
+        assembler.load32(A::RAX, source, typeOffset);
+        assembler.store32(dest, typeOffset, A::RAX);
+        assembler.load64(A::RAX, source, dataOffset);
+        assembler.store64(dest, dataOffset, A::RAX);
+        assembler.load64(A::RAX, source, dataOffset + 8);
+        assembler.store64(dest, dataOffset + 8, A::RAX);
+    }
+
+    // Compiles the common cases of an instruction to native code, falling back to its handler (or the interpreter, if
+    // a type guard fails) for the rest. Returns false if the instruction should just call its handler
+    bool compileInline(const unsigned index)
+    {
+        const CompiledInstruction & instruction = code[index];
+        const Operand & operand1 = instruction.operand1, & operand2 = instruction.operand2;
+
+        switch (instruction.opcode)
+        {
+        case Opcodes::MOVE:
+        case Opcodes::SET:
+        {
+            if (!addressable(operand1) || !addressable(operand2)) return false;
+            const unsigned slowPath = stub(Stub::K_SLOW_PATH, index);
+            loadOperand(operand1, A::RSI, slowPath);
+            loadOperand(operand2, A::RDI, slowPath);
+            guardNotPointer(A::RSI, slowPath);
+            guardNotPointer(A::RDI, slowPath);
+            copyBlock(A::RSI, A::RDI);
+            return true;
+        }
+
+        case Opcodes::PUSH:
+        {
+            if (!addressable(operand1)) return false;
+            const unsigned slowPath = stub(Stub::K_SLOW_PATH, index);
+            loadOperand(operand1, A::RSI, slowPath);
+            guardNotPointer(A::RSI, slowPath);
+            assembler.move(A::RCX, stackPointerAddress);
+            assembler.load32(A::RAX, A::RCX, 0);
+            assembler.add32(A::RAX, A::RCX, stackFrameDisplacement);
+            assembler.compare32(A::RAX, A::RCX, stackSizeDisplacement);
+            assembler.jumpIf(A::C_ABOVE_EQUAL, slowPath);
+            stackBlockAddress(A::RDX);
+            guardNotPointer(A::RDX, slowPath);
+            copyBlock(A::RDX, A::RSI);
+            assembler.addToMemory32(A::RCX, 0, 1);
+            return true;
+        }
+
+        case Opcodes::POP:
+        {
+            if ((operand1.kind != Operand::K_NIL) && !addressable(operand1)) return false;
+            const unsigned slowPath = stub(Stub::K_SLOW_PATH, index);
+            if (operand1.kind == Operand::K_NIL)
+            {
+                assembler.move(A::RCX, stackPointerAddress);
+                assembler.compareMemory32(A::RCX, 0, 0);
+                assembler.jumpIf(A::C_EQUAL, slowPath);
+                assembler.addToMemory32(A::RCX, 0, -1);
+                return true;
+            }
+
+            loadOperand(operand1, A::RSI, slowPath);
+            assembler.move(A::RCX, stackPointerAddress);
+            assembler.load32(A::RAX, A::RCX, 0);
+            assembler.compareImmediate32(A::RAX, 0);
+            assembler.jumpIf(A::C_EQUAL, slowPath);
+            assembler.add32(A::RAX, A::RCX, stackFrameDisplacement);
+            assembler.subtractImmediate32(A::RAX, 1);
+            stackBlockAddress(A::RDX);
+            guardNotPointer(A::RDX, slowPath);
+            guardNotPointer(A::RSI, slowPath);
+            copyBlock(A::RSI, A::RDX);
+            assembler.addToMemory32(A::RCX, 0, -1);
+            return true;
+        }
+
+        default: break;
+        }
+
+        // The rest are specialised for integers, so they aren't compiled inline once the guards have failed too often
+        if (!region.guarded) return false;
+
+        switch (instruction.opcode)
+        {
+        case Opcodes::INC:
+        case Opcodes::DEC:
+        {
+            if (!addressable(operand1)) return false;
+            loadOperand(operand1, A::RSI, stub(Stub::K_SLOW_PATH, index));
+            guardType(A::RSI, Block::DT_INTEGER, stub(Stub::K_DEOPTIMISE, index));
+            assembler.addToMemory64(A::RSI, dataOffset, instruction.opcode == Opcodes::INC ? 1 : -1);
+            return true;
+        }
+
+        case Opcodes::ADD:
+        case Opcodes::SUB:
+        case Opcodes::MUL:
+        case Opcodes::CMP:
+        {
+            if (!addressable(operand1) || !addressable(operand2)) return false;
+            const unsigned slowPath = stub(Stub::K_SLOW_PATH, index), deoptimise = stub(Stub::K_DEOPTIMISE, index);
+            loadOperand(operand1, A::RSI, slowPath);
+            loadOperand(operand2, A::RDI, slowPath);
+            guardType(A::RSI, Block::DT_INTEGER, deoptimise);
+            guardType(A::RDI, Block::DT_INTEGER, deoptimise);
+
+            switch (instruction.opcode)
+            {
+            case Opcodes::ADD:
+                assembler.load64(A::RAX, A::RDI, dataOffset);
+                assembler.addToMemory64(A::RSI, dataOffset, A::RAX);
+                break;
+            case Opcodes::SUB:
+                assembler.load64(A::RAX, A::RDI, dataOffset);
+                assembler.subtractFromMemory64(A::RSI, dataOffset, A::RAX);
+                break;
+            case Opcodes::MUL:
+                assembler.load64(A::RAX, A::RSI, dataOffset);
+                assembler.multiply64(A::RAX, A::RDI, dataOffset);
+                assembler.store64(A::RSI, dataOffset, A::RAX);
+                break;
+            default:
+                compileCompare(index);
+            }
+            return true;
+        }
+
+        default: return false;
+        }
+    }
+
+    // The operands are in RSI and RDI, and are both integers
+    void compileCompare(const unsigned index)
+    {
+        typedef ComparisonFlagRegister CFR;
+        static const A::Condition conditions[CFR::FLAG_COUNT] =
+        {
+            A::C_EQUAL, A::C_NOT_EQUAL, A::C_LESS, A::C_GREATER, A::C_LESS_EQUAL, A::C_GREATER_EQUAL
+        };
+
+        assembler.move(A::RCX, &jit.machine.comparisonFlagRegister_.flags[0]);
+        assembler.load64(A::RAX, A::RSI, dataOffset);
+        assembler.compare64(A::RAX, A::RDI, dataOffset);
+        for (int flag = 0; flag < CFR::FLAG_COUNT; ++flag) assembler.setIf(conditions[flag], A::RCX, flag);
+
+        // A conditional jump straight after can use the processor's flags rather than reading the ones just set. It
+        // still has its own code, in case it's jumped to
+        const unsigned next = index + 1;
+        if (!inRegion(next) || (code[next].opcode < Opcodes::JE) || (code[next].opcode > Opcodes::JGE)) return;
+        assembler.jumpIf(conditions[code[next].opcode - Opcodes::JE], jumpLabelFor(next, code[next].operand1.target));
+        jumpTo(next + 1);
+    }
+};
+
+Jit::Jit(Machine & machine, const Bytecode & bytecode, Block * const temporaries)
+    : machine(machine), bytecode(bytecode), temporaries(temporaries), enabled_(false), errorPending(false)
+{
+#ifdef JIT_SUPPORTED
+    // Native code copies blocks that aren't pointers a field at a time, so it relies on their layout
+    Block probe;
+    const char * const start = reinterpret_cast<char*>(&probe);
+    enabled_ = (sizeof(Block) == 24) && (sizeof(Block::DataType) == 4)
+               && (reinterpret_cast<char*>(&probe.dataType_) == start)
+               && (reinterpret_cast<char*>(&probe.integerData_) == start + 8)
+               && (reinterpret_cast<char*>(&probe.pointerData) == start + 8);
+#endif
+}
+
+Jit::~Jit()
+{
+    for (unsigned i = 0; i < regions.size(); ++i)
+    {
+        // Each region covers a contiguous range of indices
+        if ((regions[i] != NULL) && ((i == 0) || (regions[i - 1] != regions[i]))) release(regions[i]);
+    }
+}
+
+bool Jit::enabled() const
+{
+    return enabled_;
+}
+
+void Jit::disable()
+{
+    enabled_ = false;
+}
+
+bool Jit::run(unsigned & index)
+{
+    while (true)
+    {
+        Region * const region = regionFor(index);
+        if (region == NULL) return true;
+
+        errorPending = false;
+        const unsigned result = region->function(index);
+        index = result & ~interpretFlag;
+        if (errorPending) return false;
+        if ((result & interpretFlag) != 0) return true;
+        if (__atomic_load_n(machine.safepointFlag(), __ATOMIC_RELAXED)) return true; // The interpreter stops for it
+
+        // Control has left the region. Carry on natively if the code it went to is hot as well
+        if (++machine.labelCounts_[index] < hotThreshold) return true;
+    }
+}
+
+const std::string & Jit::error() const
+{
+    return error_;
+}
+
+Jit::Region * Jit::regionFor(const unsigned index)
+{
+    if (!enabled_) return NULL;
+
+    const std::vector<CompiledInstruction> & code = bytecode.code;
+    if (regions.empty())
+    {
+        // Functions start at call targets, where threads are spawned, and where pmap calls them
+        regions.assign(code.size(), NULL);
+        functionEntries.assign(code.size(), false);
+        functionEntries[0] = true;
+        for (unsigned i = 0; i < code.size(); ++i)
+        {
+            if ((code[i].opcode == Opcodes::CALL) || (code[i].opcode == Opcodes::SPAWN))
+                functionEntries[code[i].operand1.target] = true;
+            else if (code[i].opcode == Opcodes::PMAP) functionEntries[code[i].operand2.target] = true;
+        }
+    }
+
+    Region * region = regions[index];
+    if ((region != NULL) && (!region->guarded || (region->deoptimisations < deoptimisationLimit))) return region;
+
+    unsigned start, end;
+    if (region != NULL)
+    {
+        start = region->start;
+        end = region->end;
+    }
+    else
+    {
+        for (start = index; !functionEntries[start]; --start);
+        for (end = index + 1; (end < code.size()) && !functionEntries[end]; ++end);
+    }
+
+    Region * const replacement = compile(start, end, region == NULL);
+    if (region != NULL) release(region);
+    if (replacement == NULL)
+    {
+        // Executable memory can't be had, so leave everything to the interpreter
+        enabled_ = false;
+        for (unsigned i = start; i < end; ++i) regions[i] = NULL;
+        return NULL;
+    }
+
+    for (unsigned i = start; i < end; ++i) regions[i] = replacement;
+    return replacement;
+}
+
+Jit::Region * Jit::compile(const unsigned start, const unsigned end, const bool guarded)
+{
+#ifdef JIT_SUPPORTED
+    Region * const region = new Region;
+    region->start = start;
+    region->end = end;
+    region->guarded = guarded;
+    region->deoptimisations = 0;
+    region->entries.assign(end - start, NULL);
+
+    RegionCompiler compiler(*this, *region);
+    compiler.compile();
+    const std::vector<unsigned char> & nativeCode = compiler.assembler.code;
+
+    // The memory is never writable and executable at the same time
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    region->memorySize = ((nativeCode.size() + pageSize - 1) / pageSize) * pageSize;
+    region->memory = mmap(NULL, region->memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region->memory == MAP_FAILED)
+    {
+        delete region;
+        return NULL;
+    }
+
+    memcpy(region->memory, &nativeCode[0], nativeCode.size());
+    if (mprotect(region->memory, region->memorySize, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(region->memory, region->memorySize);
+        delete region;
+        return NULL;
+    }
+
+    const char * const base = static_cast<const char*>(region->memory);
+    for (unsigned i = start; i < end; ++i)
+        region->entries[i - start] = base + compiler.assembler.offsetOf(compiler.instructionLabels[i - start]);
+    region->function = *reinterpret_cast<Region::Function*>(&region->memory);
+
+    return region;
+#else
+    (void)start;
+    (void)end;
+    (void)guarded;
+    return NULL;
+#endif
+}
+
+void Jit::release(Region * const region)
+{
+#ifdef JIT_SUPPORTED
+    munmap(region->memory, region->memorySize);
+#endif
+    delete region;
+}
+
+bool Jit::runHandler(Jit * const jit, const CompiledInstruction * const instruction)
+{
+    try { instruction->handler(jit->machine, *instruction, jit->temporaries); }
+    catch (const std::exception & e)
+    {
+        jit->error_ = e.what();
+        jit->errorPending = true;
+        return false;
+    }
+    return true;
+}
+
+bool Jit::call(Jit * const jit, const unsigned index)
+{
+    Machine & machine = jit->machine;
+    // Leaves the call to the interpreter, which stops the thread first
+    if (__atomic_load_n(machine.safepointFlag(), __ATOMIC_RELAXED)) return false;
+    try
+    {
+        machine.programCounter_ = index;
+        machine.call(jit->bytecode.code[index].operand1.target);
+    }
+    catch (const std::exception & e)
+    {
+        jit->error_ = e.what();
+        jit->errorPending = true;
+        return false;
+    }
+    return true;
+}
+
+bool Jit::spawn(Jit * const jit, const unsigned index)
+{
+    try { jit->machine.spawn(jit->bytecode.code[index].operand1.target, jit->bytecode.code.size() - 1); }
+    catch (const std::exception & e)
+    {
+        jit->error_ = e.what();
+        jit->errorPending = true;
+        return false;
+    }
+    return true;
+}
+
+bool Jit::switchThread(Jit * const jit, const unsigned index)
+{
+    Machine & machine = jit->machine;
+    const CompiledInstruction & instruction = jit->bytecode.code[index];
+    try
+    {
+        if (instruction.opcode == Opcodes::YIELD)
+        {
+            machine.programCounter_ = index + 1;
+            machine.yield();
+        }
+        else
+        {
+            machine.programCounter_ = index;
+            instruction.handler(machine, instruction, jit->temporaries);
+        }
+    }
+    catch (const std::exception & e)
+    {
+        jit->error_ = e.what();
+        jit->errorPending = true;
+        return false;
+    }
+    return true;
+}
+
+bool Jit::extensionCall(Jit * const jit, const unsigned index)
+{
+    try
+    {
+        const ExtensionFunction * const function = jit->bytecode.extensionFunctionFor(index);
+        if (function != NULL) jit->machine.extensionCall(*function);
+        else jit->machine.extensionCall(jit->bytecode.strings[jit->bytecode.code[index].operand1.nameIndex].c_str());
+    }
+    catch (const std::exception & e)
+    {
+        jit->error_ = e.what();
+        jit->errorPending = true;
+        return false;
+    }
+    return true;
+}
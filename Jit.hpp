@@ -0,0 +1,75 @@
+/*
+ * Jit.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <vector>
+#include <string>
+
+class Machine;
+class Block;
+struct Bytecode;
+struct CompiledInstruction;
+
+// A baseline compiler from bytecode to native x86-64 code, used for code that the interpreter finds to be hot. Code is
+// compiled a function at a time (a function being everything from one call target up to the next). Integer arithmetic
+// and comparisons are compiled inline behind type guards, and anything else calls the instruction's handler. When a
+// guard fails, the instruction is handed back to the interpreter (deoptimisation), and a function that keeps failing
+// its guards is recompiled without them. On platforms other than x86-64 Linux, nothing is ever compiled
+
+class Jit
+{
+public:
+    // How many calls or backward jumps to a label it takes for the code there to be compiled
+    static const unsigned hotThreshold = 1000;
+    // How many times a function's type guards can fail before it is recompiled without them
+    static const unsigned deoptimisationLimit = 16;
+
+    Jit(Machine & machine, const Bytecode & bytecode, Block * temporaries);
+    ~Jit();
+
+    bool enabled() const;
+    void disable();
+
+    // Runs native code from the instruction at index, compiling it first if need be. index is updated to the
+    // instruction the interpreter should carry on from. Returns false if that instruction failed, in which case
+    // error() gives the reason
+    bool run(unsigned & index);
+    const std::string & error() const;
+
+private:
+    struct Region;
+    class Assembler;
+    class RegionCompiler;
+
+    Machine & machine;
+    const Bytecode & bytecode;
+    Block * temporaries;
+    bool enabled_;
+
+    std::vector<bool> functionEntries;
+    std::vector<Region*> regions; // The region compiled for each instruction, indexed by code index
+    std::string error_;
+    bool errorPending;
+
+    Jit(const Jit &);
+    Jit & operator =(const Jit &);
+
+    Region * regionFor(unsigned index);
+    Region * compile(unsigned start, unsigned end, bool guarded);
+    void release(Region * region);
+
+    // Called from native code for the things it doesn't do itself. They return false if the instruction threw
+    static bool runHandler(Jit * jit, const CompiledInstruction * instruction);
+    static bool call(Jit * jit, unsigned index);
+    static bool extensionCall(Jit * jit, unsigned index);
+    static bool spawn(Jit * jit, unsigned index);
+    static bool switchThread(Jit * jit, unsigned index); // For yield and join
+};
+
+#endif // JIT_HPP
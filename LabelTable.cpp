@@ -0,0 +1,61 @@
+/*
+ * LabelTable.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <cstring>
+
+#include "LabelTable.hpp"
+#include "StringHash.hpp"
+
+LabelTable::LabelTable()
+    : slots(initialSlotCount, 0) {}
+
+const LabelTable::LabelList & LabelTable::labels() const
+{
+    return labels_;
+}
+
+bool LabelTable::add(const char * const name, const unsigned line)
+{
+    // Keep the table at most half full so that probe sequences stay short
+    if ((labels_.size() + 1) * 2 > slots.size()) grow();
+
+    const unsigned slot = slotFor(name);
+    if (slots[slot] != 0) return false;
+
+    labels_.push_back(Label(name, line));
+    slots[slot] = labels_.size();
+    return true;
+}
+
+const Label * LabelTable::find(const char * const name) const
+{
+    const unsigned slot = slotFor(name);
+    return slots[slot] == 0 ? NULL : &labels_[slots[slot] - 1];
+}
+
+void LabelTable::clear()
+{
+    labels_.clear();
+    slots.assign(initialSlotCount, 0);
+}
+
+unsigned LabelTable::slotFor(const char * const name) const
+{
+    const unsigned mask = slots.size() - 1;
+    unsigned slot = hashString(name, Label::length) & mask;
+
+    // Linear probing. The table is never full, so this always finishes
+    while ((slots[slot] != 0) && (strncmp(labels_[slots[slot] - 1].value, name, Label::length) != 0))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+void LabelTable::grow()
+{
+    slots.assign(slots.size() * 2, 0);
+    for (unsigned i = 0; i < labels_.size(); ++i) slots[slotFor(labels_[i].value)] = i + 1;
+}
@@ -0,0 +1,46 @@
+/*
+ * LabelTable.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef LABELTABLE_HPP
+#define LABELTABLE_HPP
+
+#include <vector>
+
+#include "TypeWrappers.hpp"
+
+// The labels of a program, in the order they were added, with a hash index on their names so that looking one up
+// doesn't mean comparing it against every other label. Names are compared up to Label::length characters, as that is
+// all a label keeps
+
+class LabelTable
+{
+public:
+    typedef std::vector<Label> LabelList;
+
+    LabelTable();
+
+    const LabelList & labels() const;
+
+    // Returns false (and adds nothing) if there is already a label with the same name
+    bool add(const char * name, unsigned line);
+    // Returns NULL if there is no label with the given name
+    const Label * find(const char * name) const;
+
+    void clear();
+
+private:
+    static const unsigned initialSlotCount = 64;
+
+    LabelList labels_;
+    std::vector<unsigned> slots; // Each is an index into labels_ plus one, or 0 if empty. Always a power of two long
+
+    // The slot that holds the label with the given name, or the empty slot where it would go
+    unsigned slotFor(const char * name) const;
+    void grow();
+};
+
+#endif // LABELTABLE_HPP
@@ -12,7 +12,7 @@
 #include "Lexer.hpp"
 #include "Instruction.hpp"
 #include "Opcodes.hpp"
-#include "Machine.hpp"
+#include "Token.hpp"
 
 inline std::string removeWhitespace(const std::string & str)
 {
@@ -22,11 +22,9 @@ inline std::string removeWhitespace(const std::string & str)
     return str.substr(start, (end - start) + 1);
 }
 
-const Instruction & Lexer::tokenize(const std::string & instruction, Machine & machine)
+Instruction Lexer::tokenize(const std::string & instruction)
 {
-    static Instruction tokens;
-
-    tokens.clear();
+    Instruction tokens;
     if (instruction.size() == 0) return tokens;
 
     std::string cleanString(removeWhitespace(instruction));
@@ -62,20 +60,20 @@ const Instruction & Lexer::tokenize(const std::string & instruction, Machine & m
     spacePos = cleanString.find_first_of(' ');
     if (spacePos == std::string::npos)
     {
-        tokens.operand1 = getOperandToken(cleanString, machine);
+        tokens.operand1 = getOperandToken(cleanString);
         return tokens;
     }
-    tokens.operand1 = getOperandToken(cleanString.substr(0, spacePos), machine);
+    tokens.operand1 = getOperandToken(cleanString.substr(0, spacePos));
 
     cleanString = removeWhitespace(cleanString.substr(spacePos, cleanString.size() - spacePos));
     if (cleanString.size() == 0) return tokens;
     spacePos = cleanString.find_first_of(' ');
     if (spacePos == std::string::npos)
     {
-        tokens.operand2 = getOperandToken(cleanString, machine);
+        tokens.operand2 = getOperandToken(cleanString);
         return tokens;
     }
-    tokens.operand2 = getOperandToken(cleanString.substr(0, spacePos), machine);
+    tokens.operand2 = getOperandToken(cleanString.substr(0, spacePos));
 
     return tokens;
 }
@@ -219,18 +217,18 @@ void getStackLocation(const std::string & str, const unsigned stringStart, Token
     token.stackPositionData = position;
 }
 
-void getRegister(const std::string & str, const unsigned stringStart, Token & token, Machine & machine)
+void getRegister(const std::string & str, const unsigned stringStart, Token & token)
 {
     switch (str[stringStart])
     {
-    case 'P': token.locationData = &machine.primaryRegister(); break;
-    case 'M': token.locationData = &machine.managedOutRegister(); break;
+    case 'P': token.locationData = Token::primaryRegisterLocation; break;
+    case 'M': token.locationData = Token::managedOutRegisterLocation; break;
     default: throw(std::runtime_error("Lexer::getRegister: Register not specified"));
     }
     token.type = Token::T_OPERAND_STATIC_LOCATION;
 }
 
-void getHeapLocation(const std::string & str, const unsigned stringStart, Token & token, Machine & machine)
+void getHeapLocation(const std::string & str, const unsigned stringStart, Token & token)
 {
     unsigned location = 0, previousLocation = 0;
     for (unsigned i = stringStart; i < str.size(); ++i)
@@ -243,11 +241,11 @@ void getHeapLocation(const std::string & str, const unsigned stringStart, Token
         location = (location * 10) + (int)(c - '0');
 
         // check for overflow
-        if (location < previousLocation)
+        if ((location < previousLocation) || (location >= Token::firstRegisterLocation))
             throw(std::runtime_error("Lexer::getHeapLocation: Heap location specified is too large"));
     }
 
-    token.locationData = &machine.unmanagedHeap().blockAt(location);
+    token.locationData = location;
     token.type = Token::T_OPERAND_STATIC_LOCATION;
 }
 
@@ -263,23 +261,23 @@ void getLabel(const std::string & str, const unsigned stringStart, Token & token
     token.labelData[i] = '\0';
 }
 
-void getLocation(const std::string & str, const unsigned stringStart, Token & token, Machine & machine)
+void getLocation(const std::string & str, const unsigned stringStart, Token & token)
 {
     switch (str[stringStart])
     {
     case 'S': getStackLocation(str, stringStart + 1, token); break;
-    case 'R': getRegister(str, stringStart + 1, token, machine); break;
+    case 'R': getRegister(str, stringStart + 1, token); break;
     default:
-        if (isdigit(str[stringStart])) getHeapLocation(str, stringStart, token, machine);
+        if (isdigit(str[stringStart])) getHeapLocation(str, stringStart, token);
         else if (isalpha(str[stringStart])) getLabel(str, stringStart, token);
         else throw(std::runtime_error("Lexer::getLocation: Invalid keyword given"));
         break;
     }
 }
 
-void getPointer(const std::string & str, const unsigned stringStart, Token & token, Machine & machine)
+void getPointer(const std::string & str, const unsigned stringStart, Token & token)
 {
-    getLocation(str, stringStart, token, machine);
+    getLocation(str, stringStart, token);
     token.isPointer = true;
 }
 
@@ -337,28 +335,43 @@ void getComparisonFlagId(const std::string & str, const unsigned stringStart, To
     }
 }
 
-Token Lexer::getOperandToken(const std::string & str, Machine & machine)
+void getReduction(const std::string & str, const unsigned stringStart, Token & token)
+{
+    const std::string name = str.substr(stringStart);
+    token.type = Token::T_OPERAND_REDUCTION;
+    if (name == "add") token.reductionData = Opcodes::R_ADD;
+    else if (name == "mul") token.reductionData = Opcodes::R_MULTIPLY;
+    else if (name == "min") token.reductionData = Opcodes::R_MINIMUM;
+    else if (name == "max") token.reductionData = Opcodes::R_MAXIMUM;
+    else if (name == "and") token.reductionData = Opcodes::R_AND;
+    else if (name == "or") token.reductionData = Opcodes::R_OR;
+    else throw(std::runtime_error("Lexer::getReduction: Invalid reduction given "
+                                  "(expected add, mul, min, max, and or or)"));
+}
+
+Token Lexer::getOperandToken(const std::string & str)
 {
     Token returnToken;
     if (str.size() < 2)
     {
-        if (isdigit(str[0])) getHeapLocation(str, 0, returnToken, machine);
+        if (isdigit(str[0])) getHeapLocation(str, 0, returnToken);
         else if (isalpha(str[0])) getLabel(str, 0, returnToken);
         return returnToken;
     }
     switch (str[0])
     {
     case '#': getConstant(str, 1, returnToken); break;
-    case '@': getPointer(str, 1, returnToken, machine); break;
+    case '@': getPointer(str, 1, returnToken); break;
     case '$': getDataType(str, 1, returnToken); break;
     case '?': getComparisonFlagId(str, 1, returnToken); break;
+    case '%': getReduction(str, 1, returnToken); break;
     case 'n':
         if ((str.size() == 3) && (str[1] == 'i') && (str[2] == 'l'))
         {
             returnToken.type = Token::T_OPERAND_NIL;
             break;
         } // else fall into default
-    default:  getLocation(str, 0, returnToken, machine);
+    default:  getLocation(str, 0, returnToken);
     }
     return returnToken;
 }
@@ -49,15 +49,15 @@
 
 class Instruction;
 class Token;
-class Machine;
 
 namespace Lexer
 {
 
-const Instruction & tokenize(const std::string & instruction, Machine & machine);
+// Heap locations and registers are tokenized as locations rather than blocks, so the result isn't tied to a Machine
+Instruction tokenize(const std::string & instruction);
 
 Token getOpcodeToken(const std::string & str);
-Token getOperandToken(const std::string & str, Machine & machine);
+Token getOperandToken(const std::string & str);
 
 }
 
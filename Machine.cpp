@@ -5,25 +5,59 @@
  *      Author: Max Foster
  */
 
-#include <cstdio>
+#include <iostream>
 #include <stdexcept>
+#include <algorithm>
 #include <cmath>
+#include <sstream>
 #include <dlfcn.h>
+#include <sched.h>
+#include <time.h>
 
 #include "Machine.hpp"
 #include "ExtensionFunction.hpp"
+#include "Mutex.hpp"
+#include "Channel.hpp"
+#include "ParallelArrays.hpp"
+#include "Scheduler.hpp"
 
 const Machine::locationId Machine::STACK, Machine::PRIMARY_REGISTER, Machine::MANAGED_OUT_REGISTER, Machine::NIL;
 
 std::vector<void*> Machine::extensionHandles;
 unsigned Machine::machineCount = 0;
+Mutex Machine::extensionMutex;
 const unsigned Machine::extensionMachineStackSize = 1000, Machine::extensionMachineHeapSize = 1000;
+const unsigned Machine::maximumChannelId, Machine::ownChannelCapacity, Machine::channelSpinLimit,
+               Machine::maximumChannelSleep;
+const unsigned char Machine::noSafepoint = 0;
+
+Machine::Machine(const unsigned stackSize, const unsigned unmanagedHeapSize, const unsigned managedHeapSize,
+                 const ManagedHeap::CollectionMode collectionMode)
+    : stack_(stackSize), unmanagedHeap_(unmanagedHeapSize), managedHeap_(managedHeapSize, collectionMode),
+      programCounter_(0), input_(&std::cin), output_(&std::cout), quickenedCount_(0), deoptimisedCount_(0),
+      roots(*this), currentThread_(0), threadStackSize(stackSize), scheduler(NULL), owner_(this), carrierIndex(0),
+      multiplexed_(false), channelWaits(0), parallelArrays(NULL), operand1IsPointer_(false),
+      operand2IsPointer_(false), extensionMachine(NULL)
+{
+    managedHeap_.setRootSet(&roots);
+    returnAddressStack.reserve(Stack::initialSize / 4);
+
+    Mutex::Lock lock(extensionMutex);
+    ++machineCount;
+}
 
-Machine::Machine(const unsigned stackSize, const unsigned unmanagedHeapSize, const unsigned managedHeapSize)
-    : stack_(stackSize), unmanagedHeap_(unmanagedHeapSize), managedHeap_(managedHeapSize), programCounter_(0),
+Machine::Machine(Machine & owner, Scheduler & scheduler, const unsigned carrierIndex)
+    : stack_(owner.threadStackSize), unmanagedHeap_(owner.unmanagedHeap_.maximumSize()),
+      managedHeap_(owner.managedHeap_.maximumSize(), owner.managedHeap_.collectionMode()), programCounter_(0),
+      input_(owner.input_), output_(owner.output_), quickenedCount_(0), deoptimisedCount_(0), roots(*this),
+      currentThread_(0), threadStackSize(owner.threadStackSize), scheduler(&scheduler), owner_(&owner),
+      carrierIndex(carrierIndex), multiplexed_(true), channelWaits(0), parallelArrays(NULL),
       operand1IsPointer_(false), operand2IsPointer_(false), extensionMachine(NULL)
 {
-    returnAddressStack.reserve((stackSize == 0 ? Stack::defaultSize : stackSize) / 4);
+    managedHeap_.setRootSet(&roots);
+    returnAddressStack.reserve(Stack::initialSize / 4);
+
+    Mutex::Lock lock(extensionMutex);
     ++machineCount;
 }
 
@@ -31,7 +65,13 @@ Machine::~Machine()
 {
     flush();
     if (extensionMachine != NULL) delete extensionMachine;
-    if (--machineCount == 0) for (unsigned i = 0; i < extensionHandles.size(); ++i) dlclose(extensionHandles[i]);
+
+    Mutex::Lock lock(extensionMutex);
+    if (--machineCount > 0) return;
+    // The functions go first, as they point into the extensions
+    ExtensionFunction::removeAll();
+    for (unsigned i = 0; i < extensionHandles.size(); ++i) dlclose(extensionHandles[i]);
+    extensionHandles.clear();
 }
 
 void Machine::flush()
@@ -39,10 +79,41 @@ void Machine::flush()
     comparisonFlagRegister_.reset();
     primaryRegister_.nullifyPointerData();
     managedOutRegister_.nullifyPointerData();
+    arrayBeingPopulated.stop();
+    returnAddressStack.clear();
     stack_.flush();
     unmanagedHeap_.flush();
     managedHeap_.flush();
     programCounter_ = 0;
+
+    // Whichever thread was running carries on as the main one
+    for (unsigned i = 0; i < threads.size(); ++i) delete threads[i];
+    for (unsigned i = 0; i < spareThreads.size(); ++i) delete spareThreads[i];
+    threads.clear();
+    spareThreads.clear();
+    readyThreads.clear();
+    currentThread_ = 0;
+
+    // Shared channels stay connected, like the input and output
+    disconnectChannels();
+    for (unsigned i = 0; i < channels.size(); ++i)
+    {
+        ChannelEntry & entry = channels[i];
+        if (!entry.shared)
+        {
+            delete entry.channel;
+            entry.channel = NULL;
+        }
+        entry.waitingCount = 0;
+    }
+    channelWaits = 0;
+    receivedArrays.clear();
+
+    if ((scheduler != NULL) && (owner_ == this))
+    {
+        Mutex::Lock lock(scheduler->mutex);
+        scheduler->failed = false;
+    }
 }
 
 Machine::ArrayPopulator::ArrayPopulator()
@@ -70,11 +141,52 @@ void Machine::ArrayPopulator::stop()
 
 void Machine::ArrayPopulator::add(const Block & value)
 {
-    if (arrayPointer.pointerIsNull())
+    ManagedHeap * const heap = arrayPointer.pointerManagedHeap();
+    if (heap == NULL)
         throw(std::runtime_error("Machine::ArrayPopulator::add: No array has been specified to populate"));
-    Block * element = arrayPointer.pointerArrayElementAt(++currentIndex);
-    if (element == NULL) throw(std::runtime_error("Machine::ArrayPopulator::add: Array index out of range"));
-    *element = value;
+    const unsigned address = arrayPointer.pointerAddress();
+    if (unsigned(++currentIndex) >= heap->arrayLengthAt(address))
+        throw(std::runtime_error("Machine::ArrayPopulator::add: Array index out of range"));
+    heap->setElement(address, currentIndex, value);
+}
+
+Block & Machine::ArrayPopulator::array()
+{
+    return arrayPointer;
+}
+
+void Machine::ArrayPopulator::swap(ArrayPopulator & other)
+{
+    arrayPointer.swap(other.arrayPointer);
+    std::swap(currentIndex, other.currentIndex);
+}
+
+Machine::Roots::Roots(Machine & machine)
+    : machine(machine) {}
+
+void Machine::Roots::visitRoots(ManagedHeap & heap, const bool allBlocks)
+{
+    // Popped blocks aren't cleared, so those above the top of the stack can still hold pointers
+    heap.visitRoots(machine.stack_.blocks(), allBlocks ? machine.stack_.size() : machine.stack_.depth());
+    heap.visitRoots(&machine.unmanagedHeap_.blockAt(0), machine.unmanagedHeap_.size());
+    heap.visitRoots(&machine.primaryRegister_, 1);
+    heap.visitRoots(&machine.managedOutRegister_, 1);
+    heap.visitRoots(&machine.arrayBeingPopulated.array(), 1);
+
+    // The contexts of the threads that aren't running
+    for (unsigned i = 0; i < machine.threads.size(); ++i)
+    {
+        Thread * const thread = machine.threads[i];
+        if (thread == NULL) continue;
+        Context & context = *thread->context;
+        heap.visitRoots(context.stack.blocks(), allBlocks ? context.stack.size() : context.stack.depth());
+        heap.visitRoots(&context.primaryRegister, 1);
+        heap.visitRoots(&context.managedOutRegister, 1);
+        heap.visitRoots(&context.arrayBeingPopulated.array(), 1);
+        heap.visitRoots(&thread->result, 1);
+    }
+
+    if (!machine.receivedArrays.empty()) heap.visitRoots(&machine.receivedArrays[0], machine.receivedArrays.size());
 }
 
 void Machine::_clear(Block * locationBlock)
@@ -101,17 +213,15 @@ void Machine::_swap(Block * a, Block * b)
 {
     if (a == NULL) throw(std::runtime_error("Machine::_exchange: Invalid first operand given"));
     if (b == NULL) throw(std::runtime_error("Machine::_exchange: Invalid second operand given"));
-
-    Block temp(*a);
-    *a = *b;
-    *b = temp;
+    a->swap(*b);
 }
 
 void Machine::_read(Block * destBlock)
 {
     if (destBlock == NULL) throw(std::runtime_error("Machine::_read: Invalid destination given"));
+    Mutex::OptionalLock lock(ioMutex());
     char c;
-    if (scanf("%c", &c) != 0) destBlock->setToChar(c);
+    if (input_->get(c)) destBlock->setToChar(c);
 }
 
 void Machine::_readString(Block * destBlock)
@@ -126,38 +236,37 @@ void Machine::_readString(Block * destBlock)
         throw(std::runtime_error("Machine::_readString: Destination pointer does not point to an array of characters"));
 
     const unsigned length = destBlock->pointerArrayLength();
+    Mutex::OptionalLock lock(ioMutex());
     if (length == 0)
     {
         char c;
-        if (scanf("%c", &c) != 0) data->setCharData(c);
+        if (input_->get(c)) data->setCharData(c);
     }
     else
     {
+        // Read the whole line (or as much of it as fits) before storing it in the array
+        std::vector<char> characters;
+        characters.reserve(length);
         char c;
         for (unsigned i = 0; i < length; ++i)
         {
-            if (scanf("%c", &c) != 0)
+            if (!input_->get(c) || (c == '\n') || (c == '\r') || (c == '\0'))
             {
-                if ((c == '\n') || (c == '\r') || (c == '\0'))
-                {
-                    destBlock->pointerArrayElementAt(i)->setCharData('\0');
-                    break;
-                }
-                else destBlock->pointerArrayElementAt(i)->setCharData(c);
-            }
-            else
-            {
-                destBlock->pointerArrayElementAt(i)->setCharData('\0');
+                characters.push_back('\0');
                 break;
             }
+            characters.push_back(c);
         }
+        destBlock->pointerManagedHeap()->storeCharacters(destBlock->pointerAddress(), &characters[0],
+                                                          characters.size());
     }
 }
 
 void Machine::_write(const Block * sourceBlock)
 {
     if (sourceBlock == NULL) throw(std::runtime_error("Machine::_write: Invalid source given"));
-    std::cout << *sourceBlock << std::endl;
+    Mutex::OptionalLock lock(ioMutex());
+    *output_ << *sourceBlock << std::endl;
 }
 
 void Machine::_writeString(const Block * sourceBlock)
@@ -173,17 +282,12 @@ void Machine::_writeString(const Block * sourceBlock)
                 "Machine::_writeString: Destination pointer does not point to an array of characters"));
 
     const unsigned length = sourceBlock->pointerArrayLength();
-    if (length == 0) std::cout << data->charData() << std::endl;
+    Mutex::OptionalLock lock(ioMutex());
+    if (length == 0) *output_ << data->charData() << std::endl;
     else
     {
-        char c;
-        for (unsigned i = 0; i < length; ++i)
-        {
-            c = sourceBlock->pointerArrayElementAt(i)->charData();
-            if (c == '\0') break;
-            std::cout << c;
-        }
-        std::cout << std::endl;
+        sourceBlock->pointerManagedHeap()->printCharacters(sourceBlock->pointerAddress(), *output_);
+        *output_ << std::endl;
     }
 }
 
@@ -420,10 +524,11 @@ void Machine::_getArrayElement(const Block * pointerBlock, const unsigned index)
     if (pointerBlock == NULL) throw(std::runtime_error("Machine::_getArrayElement: Invalid array pointer given"));
     if (pointerBlock->dataType() != Block::DT_POINTER)
         throw(std::runtime_error("Machine::_getArrayElement: First operand data type is invalid (expected pointer)"));
-    if (index >= pointerBlock->pointerArrayLength())
+    ManagedHeap * const heap = pointerBlock->pointerManagedHeap();
+    const unsigned address = pointerBlock->pointerAddress();
+    if ((heap == NULL) || (index >= heap->arrayLengthAt(address)))
         throw(std::runtime_error("Machine::_getArrayElement: Index given is out of array range"));
-    const Block * element = pointerBlock->pointerArrayElementAt(index);
-    if (element != NULL) managedOutRegister_ = *element;
+    heap->getElement(address, index, managedOutRegister_);
 }
 
 void Machine::_getArrayElement(const Block * pointerBlock, const Block * indexBlock)
@@ -463,16 +568,10 @@ void Machine::_copyArray(const Block * destPointerBlock, const Block * sourcePoi
     if (length > destPointerBlock->pointerArrayLength())
         throw(std::runtime_error("Machine::_copyArray: Source array being copied is larger than the destination"));
 
-    Block * sourceBlock, * destBlock;
-    for (unsigned i = 0; i < length; ++i)
-    {
-        sourceBlock = sourcePointerBlock->pointerArrayElementAt(i);
-        if (sourceBlock == NULL) throw(std::runtime_error("Machine::_copyArray: Error with source array"));
-        destBlock = destPointerBlock->pointerArrayElementAt(i);
-        if (destBlock == NULL) throw(std::runtime_error("Machine::_copyArray: Error with destination array"));;
-
-        *destBlock = *sourceBlock;
-    }
+    if (length == 0) return;
+    destPointerBlock->pointerManagedHeap()->copyElements(destPointerBlock->pointerAddress(),
+                                                         *sourcePointerBlock->pointerManagedHeap(),
+                                                         sourcePointerBlock->pointerAddress(), length);
 }
 
 void Machine::_convert(Block * destBlock, const Block * sourceBlock, const Block::DataType dataType)
@@ -620,6 +719,42 @@ void Machine::_compare(const Block * lhsBlock, const Block * rhsBlock)
     }
 }
 
+template<typename T>
+bool inequalityHolds(const T lhs, const T rhs, const ComparisonFlagRegister::ComparisonFlagId flagId)
+{
+    switch (flagId)
+    {
+    case ComparisonFlagRegister::F_LESS:          return lhs < rhs;
+    case ComparisonFlagRegister::F_GREATER:       return lhs > rhs;
+    case ComparisonFlagRegister::F_LESS_EQUAL:    return lhs <= rhs;
+    case ComparisonFlagRegister::F_GREATER_EQUAL: return lhs >= rhs;
+    default: return false;
+    }
+}
+
+void Machine::_compareForFlag(const Block * lhsBlock, const Block * rhsBlock,
+                              const ComparisonFlagRegister::ComparisonFlagId flagId)
+{
+    if (lhsBlock == NULL) throw(std::runtime_error("Machine::_compare: First operand is invalid"));
+    if (rhsBlock == NULL) throw(std::runtime_error("Machine::_compare: Second operand is invalid"));
+
+    // Gives the same value that _compare would for this flag
+    bool value = false;
+    if (flagId == ComparisonFlagRegister::F_EQUAL) value = (*lhsBlock == *rhsBlock);
+    else if (flagId == ComparisonFlagRegister::F_NOT_EQUAL) value = !(*lhsBlock == *rhsBlock);
+    else if (lhsBlock->dataType() == rhsBlock->dataType())
+    {
+        switch (lhsBlock->dataType())
+        {
+        case Block::DT_INTEGER: value = inequalityHolds(lhsBlock->integerData(), rhsBlock->integerData(), flagId); break;
+        case Block::DT_REAL:    value = inequalityHolds(lhsBlock->realData(), rhsBlock->realData(), flagId); break;
+        case Block::DT_CHAR:    value = inequalityHolds(lhsBlock->charData(), rhsBlock->charData(), flagId); break;
+        default: break;
+        }
+    }
+    comparisonFlagRegister_.setValue(flagId, value);
+}
+
 void Machine::_compareDataType(const Block * lhsBlock, const Block * rhsBlock)
 {
     if (lhsBlock == NULL) throw(std::runtime_error("Machine::_compare: First operand is invalid"));
@@ -683,60 +818,943 @@ void Machine::_logicalXor(Block * destBlock, const Block * sourceBlock)
     destBlock->setToBoolean(destBlock->booleanData() != sourceBlock->booleanData());
 }
 
-void Machine::jump(const char * labelName)
+void Machine::_returnFromCall(const Block * returnBlock)
+{
+    stack_.popFrame(returnBlock);
+    programCounter_ = returnAddressStack.back();
+    returnAddressStack.pop_back();
+}
+
+Machine::Context::Context(const unsigned stackSize)
+    : stack(stackSize), programCounter(0) {}
+
+void Machine::Context::clear()
+{
+    stack.flush();
+    returnAddressStack.clear();
+    primaryRegister.nullifyPointerData();
+    managedOutRegister.nullifyPointerData();
+    comparisonFlagRegister.reset();
+    arrayBeingPopulated.stop();
+}
+
+Machine::Thread::Thread(const unsigned stackSize)
+    : context(new Context(stackSize)), state(S_READY), waitingFor(0) {}
+
+Machine::Thread::~Thread()
+{
+    delete context;
+}
+
+void Machine::spawn(const unsigned codeIndex, const unsigned exitAddress)
+{
+    // The main thread only needs somewhere to keep its context once another thread has been started, which is also
+    // when the threads are spread over the scheduler's carriers, if it has several
+    if (threads.empty())
+    {
+        threads.push_back(new Thread(threadStackSize));
+        threads[0]->id = 0;
+        startMultiplexing(exitAddress);
+    }
+
+    const Block * const argument = stack_.empty() ? NULL : &stack_.peek();
+    Scheduler * const active = activeScheduler();
+    if (active == NULL)
+    {
+        const unsigned id = startThread(codeIndex, exitAddress, argument);
+        stack_.push(Block(Integer(id)));
+        return;
+    }
+
+    // The thread goes to whichever carrier has the fewest. It's started straight away if that's this one, and otherwise
+    // its argument is copied out for the carrier to load into its own heap
+    Scheduler::ThreadRecord * const record = new Scheduler::ThreadRecord;
+    record->codeIndex = codeIndex;
+    record->exitAddress = exitAddress;
+    record->hasArgument = argument != NULL;
+    record->finished = false;
+    unsigned id;
+    {
+        Mutex::Lock lock(active->mutex);
+        const unsigned carrierCount = std::min(unsigned(active->carriers.size()), active->carrierCount_);
+        record->carrier = 0;
+        for (unsigned i = 1; i < carrierCount; ++i)
+        {
+            if (active->carriers[i]->threadCount < active->carriers[record->carrier]->threadCount) record->carrier = i;
+        }
+        ++active->carriers[record->carrier]->threadCount;
+        id = record->id = active->addThread(record);
+    }
+
+    if (record->carrier == carrierIndex)
+    {
+        record->localId = startThread(codeIndex, exitAddress, argument);
+        threads[record->localId]->id = id;
+    }
+    else
+    {
+        try
+        {
+            if (argument != NULL) record->message.store(*argument);
+        }
+        catch (...)
+        {
+            Mutex::Lock lock(active->mutex);
+            --active->carriers[record->carrier]->threadCount;
+            active->threads[id] = NULL;
+            delete record;
+            throw;
+        }
+        Mutex::Lock lock(active->mutex);
+        Scheduler::Carrier & carrier = *active->carriers[record->carrier];
+        carrier.starts.push_back(record);
+        active->deliver(carrier); // After which the record belongs to the carrier
+    }
+
+    stack_.push(Block(Integer(id)));
+}
+
+unsigned Machine::startThread(const unsigned codeIndex, const unsigned exitAddress, const Block * const argument)
+{
+    unsigned id = 1;
+    while ((id < threads.size()) && (threads[id] != NULL)) ++id;
+    if (id == threads.size()) threads.push_back(NULL);
+    if (spareThreads.empty()) threads[id] = new Thread(threadStackSize);
+    else
+    {
+        threads[id] = spareThreads.back();
+        spareThreads.pop_back();
+    }
+
+    Thread & thread = *threads[id];
+    Context & context = *thread.context;
+    if (argument != NULL) context.stack.push(*argument);
+    context.returnAddressStack.push_back(exitAddress);
+    context.stack.pushFrame();
+    context.programCounter = codeIndex;
+    thread.state = Thread::S_READY;
+    thread.id = id;
+    readyThreads.push_back(id);
+    return id;
+}
+
+void Machine::yield()
+{
+    if (multiplexed_) takeDeliveries();
+    if (readyThreads.empty()) return;
+    threads[currentThread_]->state = Thread::S_READY;
+    readyThreads.push_back(currentThread_);
+    switchToNextThread();
+}
+
+bool Machine::finishThread()
+{
+    if (multiplexed_) return finishMultiplexedThread();
+    if (currentThread_ == 0) return false;
+
+    Thread & finished = *threads[currentThread_];
+    finished.state = Thread::S_FINISHED;
+    if (!stack_.empty()) finished.result = stack_.peek();
+
+    for (unsigned i = 0; i < threads.size(); ++i)
+    {
+        Thread * const thread = threads[i];
+        if ((thread != NULL) && (thread->state == Thread::S_WAITING) && (thread->waitingFor == currentThread_))
+        {
+            thread->state = Thread::S_READY;
+            readyThreads.push_back(i);
+        }
+    }
+
+    switchToNextThread();
+    // Nothing runs on the finished thread again, so it can be cleared out now rather than when it's joined
+    finished.context->clear();
+    return true;
+}
+
+unsigned Machine::currentThread() const
+{
+    return threads.empty() ? 0 : threads[currentThread_]->id;
+}
+
+void Machine::_join(Block * threadBlock)
+{
+    if (threadBlock == NULL) throw(std::runtime_error("Machine::_join: Invalid thread given"));
+    if (threadBlock->dataType() != Block::DT_INTEGER)
+        throw(std::runtime_error("Machine::_join: Data type of thread is invalid (integer expected)"));
+
+    if (multiplexed_)
+    {
+        joinMultiplexed(threadBlock);
+        return;
+    }
+
+    const long id = threadBlock->integerData();
+    if ((id <= 0) || (unsigned(id) >= threads.size()) || (threads[id] == NULL))
+        throw(std::runtime_error("Machine::_join: There is no thread with the id given"));
+    if (unsigned(id) == currentThread_) throw(std::runtime_error("Machine::_join: A thread cannot join itself"));
+
+    Thread & thread = *threads[id];
+    if (thread.state != Thread::S_FINISHED)
+    {
+        // The join is run again once the thread has finished
+        threads[currentThread_]->state = Thread::S_WAITING;
+        threads[currentThread_]->waitingFor = id;
+        switchToNextThread();
+        return;
+    }
+
+    *threadBlock = thread.result;
+    thread.result.clear();
+    spareThreads.push_back(&thread);
+    threads[id] = NULL;
+    ++programCounter_;
+}
+
+void Machine::switchToNextThread()
 {
-    for (unsigned i = 0; i < labels_.size(); ++i)
+    if (readyThreads.empty())
+        throw(std::runtime_error("Machine::switchToNextThread: Every thread is waiting for another or a channel"));
+
+    const unsigned nextId = readyThreads.front();
+    readyThreads.pop_front();
+    Thread & current = *threads[currentThread_], & next = *threads[nextId];
+
+    // The next thread's context goes into the machine, and the current one's into the empty context that the next
+    // thread leaves behind
+    exchangeContext(*next.context);
+    std::swap(current.context, next.context);
+    next.state = Thread::S_RUNNING;
+    currentThread_ = nextId;
+}
+
+void Machine::exchangeContext(Context & context)
+{
+    stack_.recordDepth(); // Native code doesn't keep it up to date, and can switch threads itself
+    stack_.swap(context.stack);
+    returnAddressStack.swap(context.returnAddressStack);
+    primaryRegister_.swap(context.primaryRegister);
+    managedOutRegister_.swap(context.managedOutRegister);
+    std::swap(comparisonFlagRegister_, context.comparisonFlagRegister);
+    arrayBeingPopulated.swap(context.arrayBeingPopulated);
+    std::swap(programCounter_, context.programCounter);
+}
+
+bool Machine::finishMultiplexedThread()
+{
+    Scheduler & s = *scheduler;
+    // Nothing more runs once the main thread has finished, or the threads are being stopped, and the machine waits for
+    // the carriers to be idle before the program ends
+    Thread & finished = *threads[currentThread_];
+    if (((owner_ == this) && (finished.id == 0)) || __atomic_load_n(&s.stopRequested, __ATOMIC_ACQUIRE))
+    {
+        if (owner_ == this) stopThreads();
+        return false;
+    }
+
+    finished.state = Thread::S_FINISHED;
+    Message result;
+    result.store(stack_.empty() ? Block() : stack_.peek());
     {
-        if (strcmp(labels_[i].value, labelName) == 0)
+        Mutex::Lock lock(s.mutex);
+        Scheduler::ThreadRecord & record = *s.threads[finished.id];
+        record.message.swap(result);
+        record.finished = true;
+        for (unsigned i = 0; i < record.joiners.size(); ++i)
         {
-            programCounter_ = labels_[i].line;
+            const Scheduler::ThreadRecord & joiner = *s.threads[record.joiners[i]];
+            s.wake(joiner.carrier, joiner.localId);
+        }
+        record.joiners.clear();
+        --s.carriers[carrierIndex]->threadCount;
+    }
+
+    const unsigned index = currentThread_;
+    if (!runNextThread())
+    {
+        if (owner_ == this) stopThreads();
+        return false;
+    }
+    // The result has been kept with the thread's id, so the thread itself can be reused straight away
+    finished.context->clear();
+    threads[index] = NULL;
+    spareThreads.push_back(&finished);
+    return true;
+}
+
+void Machine::joinMultiplexed(Block * const threadBlock)
+{
+    Scheduler & s = *scheduler;
+    const long id = threadBlock->integerData();
+    Thread & current = *threads[currentThread_];
+    Message result;
+    {
+        Mutex::Lock lock(s.mutex);
+        if ((id <= 0) || (unsigned(id) >= s.threads.size()) || (s.threads[id] == NULL))
+            throw(std::runtime_error("Machine::_join: There is no thread with the id given"));
+        if (unsigned(id) == current.id) throw(std::runtime_error("Machine::_join: A thread cannot join itself"));
+
+        Scheduler::ThreadRecord * const record = s.threads[id];
+        if (!record->finished)
+        {
+            // The join is run again once the thread has finished
+            record->joiners.push_back(current.id);
+            current.state = Thread::S_WAITING;
+            current.waitingFor = id;
+        }
+        else
+        {
+            result.swap(record->message);
+            s.threads[id] = NULL;
+            delete record;
+        }
+    }
+
+    if (current.state == Thread::S_WAITING)
+    {
+        runNextThread();
+        return;
+    }
+    result.load(*threadBlock, managedHeap_, receivedArrays);
+    ++programCounter_;
+}
+
+Scheduler * Machine::activeScheduler() const
+{
+    return multiplexed_ ? scheduler : NULL;
+}
+
+Mutex * Machine::ioMutex() const
+{
+    return multiplexed_ ? &scheduler->ioMutex : NULL;
+}
+
+const unsigned char * Machine::safepointFlag() const
+{
+    return scheduler == NULL ? &noSafepoint : &scheduler->stopRequested;
+}
+
+bool Machine::safepoint()
+{
+    if (!multiplexed_ || !__atomic_load_n(&scheduler->stopRequested, __ATOMIC_ACQUIRE)) return false;
+    programCounter_ = scheduler->exitAddress;
+    return true;
+}
+
+void Machine::startMultiplexing(const unsigned exitAddress)
+{
+    if ((scheduler == NULL) || (owner_ != this) || !scheduler->start()) return;
+
+    Scheduler & s = *scheduler;
+    Scheduler::ThreadRecord * const main = new Scheduler::ThreadRecord;
+    main->carrier = main->localId = 0;
+    main->finished = false;
+    {
+        Mutex::Lock lock(s.mutex);
+        for (unsigned i = 1; i < s.carriers.size(); ++i)
+        {
+            s.carriers[i]->machine->input_ = input_;
+            s.carriers[i]->machine->output_ = output_;
+        }
+        main->id = s.addThread(main);
+        s.carriers[0]->threadCount = 1;
+        s.runningCarriers = 1;
+        s.exitAddress = exitAddress;
+        s.failed = false;
+    }
+    multiplexed_ = true;
+
+    // Channels that were used before now are used through the scheduler too, so that every carrier finds them
+    for (unsigned i = 0; i < channels.size(); ++i)
+    {
+        if (channels[i].channel != NULL) shareChannel(i);
+    }
+}
+
+bool Machine::carry()
+{
+    Scheduler & s = *scheduler;
+    Scheduler::Carrier & carrier = *s.carriers[carrierIndex];
+    while (true)
+    {
+        {
+            Mutex::Lock lock(s.mutex);
+            if (!threads.empty())
+            {
+                // Back from running threads, which have been stopped. The machine is flushed before it's given more
+                carrier.idle = carrier.parked = true;
+                --s.busyCarriers;
+                s.carriers[0]->condition.signalAll();
+            }
+            while (carrier.parked && !s.destroying) carrier.condition.wait(s.mutex);
+            if (s.destroying) return false;
+        }
+
+        // A carrier has no main thread, so it keeps the context it had before its first thread in one that never runs
+        if (threads.empty())
+        {
+            threads.push_back(new Thread(threadStackSize));
+            threads[0]->state = Thread::S_FINISHED;
+        }
+        if (runNextThread()) return true;
+    }
+}
+
+void Machine::takeDeliveries()
+{
+    Scheduler::Carrier & carrier = *scheduler->carriers[carrierIndex];
+    if (!__atomic_load_n(&carrier.pending, __ATOMIC_ACQUIRE)) return;
+
+    std::vector<Scheduler::ThreadRecord*> starts;
+    std::vector<unsigned> wakes;
+    {
+        Mutex::Lock lock(scheduler->mutex);
+        starts.swap(carrier.starts);
+        wakes.swap(carrier.wakes);
+        __atomic_store_n(&carrier.pending, 0, __ATOMIC_RELAXED);
+    }
+
+    for (unsigned i = 0; i < wakes.size(); ++i)
+    {
+        Thread * const thread = threads[wakes[i]];
+        if ((thread != NULL)
+            && ((thread->state == Thread::S_WAITING) || (thread->state == Thread::S_WAITING_FOR_CHANNEL)))
+        {
+            thread->state = Thread::S_READY;
+            readyThreads.push_back(wakes[i]);
+        }
+    }
+    for (unsigned i = 0; i < starts.size(); ++i)
+    {
+        Scheduler::ThreadRecord & record = *starts[i];
+        Block argument;
+        if (record.hasArgument) record.message.load(argument, managedHeap_, receivedArrays);
+        record.localId = startThread(record.codeIndex, record.exitAddress, record.hasArgument ? &argument : NULL);
+        threads[record.localId]->id = record.id;
+    }
+}
+
+bool Machine::runNextThread()
+{
+    while (true)
+    {
+        takeDeliveries();
+        if (!readyThreads.empty()) break;
+
+        Mutex::Lock lock(scheduler->mutex);
+        if (!scheduler->park(*scheduler->carriers[carrierIndex]))
+        {
+            programCounter_ = scheduler->exitAddress;
+            return false;
+        }
+    }
+
+    // A thread that stopped waiting before the carrier parked is still in the machine
+    if (readyThreads.front() == currentThread_)
+    {
+        readyThreads.pop_front();
+        threads[currentThread_]->state = Thread::S_RUNNING;
+    }
+    else switchToNextThread();
+    return true;
+}
+
+void Machine::stopThreads()
+{
+    Scheduler & s = *scheduler;
+    {
+        Mutex::Lock lock(s.mutex);
+        s.requestStop();
+        while (s.busyCarriers > 0) s.carriers[0]->condition.wait(s.mutex);
+    }
+
+    for (unsigned i = 1; i < s.carriers.size(); ++i) s.carriers[i]->machine->flush();
+    disconnectChannels();
+    {
+        Mutex::Lock lock(s.mutex);
+        s.clear();
+    }
+    multiplexed_ = false;
+}
+
+void Machine::haltThreads()
+{
+    Scheduler * const active = activeScheduler();
+    if (active == NULL) return;
+
+    {
+        Mutex::Lock lock(active->mutex);
+        active->failed = true;
+        active->requestStop();
+    }
+    if (owner_ == this) stopThreads();
+}
+
+bool Machine::threadFailed()
+{
+    if (scheduler == NULL) return false;
+    Mutex::Lock lock(scheduler->mutex);
+    return scheduler->failed;
+}
+
+void Machine::setChannel(const unsigned id, Channel & channel)
+{
+    if (id > maximumChannelId) throw(std::runtime_error("Machine::setChannel: Channel id is out of range"));
+    if (channels.size() <= id)
+    {
+        const ChannelEntry noChannel = { NULL, false, 0, NULL };
+        channels.resize(id + 1, noChannel);
+    }
+
+    ChannelEntry & entry = channels[id];
+    if (!entry.shared) delete entry.channel;
+    entry.channel = &channel;
+    entry.shared = true;
+}
+
+unsigned Machine::channelId(const Block * channelBlock)
+{
+    if (channelBlock == NULL) throw(std::runtime_error("Machine::channelId: Invalid channel given"));
+    if (channelBlock->dataType() != Block::DT_INTEGER)
+        throw(std::runtime_error("Machine::channelId: Data type of channel is invalid (integer expected)"));
+    const long id = channelBlock->integerData();
+    if ((id < 0) || (id > long(maximumChannelId)))
+        throw(std::runtime_error("Machine::channelId: Channel id is out of range"));
+
+    if (channels.size() <= unsigned(id))
+    {
+        const ChannelEntry noChannel = { NULL, false, 0, NULL };
+        channels.resize(id + 1, noChannel);
+    }
+    if (multiplexed_)
+    {
+        if (channels[id].sharedChannel == NULL) shareChannel(id);
+    }
+    else if (channels[id].channel == NULL) channels[id].channel = new Channel(ownChannelCapacity);
+    return id;
+}
+
+void Machine::shareChannel(const unsigned id)
+{
+    ChannelEntry & entry = channels[id];
+    Mutex::Lock lock(scheduler->mutex);
+    std::map<unsigned, SharedChannel>::iterator found = scheduler->channels.find(id);
+    if (found == scheduler->channels.end())
+    {
+        // Threads on any carrier can send and receive on a channel the scheduler makes. One the machine made, before
+        // the threads were multiplexed, is handed over to the scheduler, and only has the one receiving end
+        SharedChannel channel;
+        channel.channel = entry.channel;
+        channel.owned = !entry.shared;
+        if (channel.channel == NULL) channel.channel = new Channel(ownChannelCapacity, Channel::K_MULTIPLE_CONSUMERS);
+        channel.sendersWaiting = channel.receiversWaiting = 0;
+        found = scheduler->channels.insert(std::make_pair(id, channel)).first;
+    }
+    entry.channel = found->second.channel;
+    entry.shared = true;
+    entry.sharedChannel = &found->second;
+}
+
+void Machine::disconnectChannels()
+{
+    for (unsigned i = 0; i < channels.size(); ++i)
+    {
+        ChannelEntry & entry = channels[i];
+        if (entry.sharedChannel == NULL) continue;
+        if ((owner_ != this) || entry.sharedChannel->owned)
+        {
+            entry.channel = NULL;
+            entry.shared = false;
+        }
+        entry.sharedChannel = NULL;
+    }
+}
+
+void Machine::waitForChannel(const unsigned id, const bool sending)
+{
+    ChannelEntry & entry = channels[id];
+    if ((entry.sharedChannel != NULL) && entry.sharedChannel->owned)
+    {
+        // The thread is parked until a thread on any carrier uses the channel the other way. It says it's waiting
+        // before checking the channel again, and users of the channel check for waiting threads after using it, so
+        // either it sees what they did or they see it (see channelUsed)
+        SharedChannel & channel = *entry.sharedChannel;
+        Thread & thread = *threads[currentThread_];
+        {
+            Mutex::Lock lock(scheduler->mutex);
+            std::vector<std::pair<unsigned, unsigned> > & waiting = sending ? channel.senders : channel.receivers;
+            unsigned & waitingCount = sending ? channel.sendersWaiting : channel.receiversWaiting;
+            waiting.push_back(std::make_pair(carrierIndex, currentThread_));
+            __atomic_store_n(&waitingCount, waiting.size(), __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (sending ? !channel.channel->looksFull() : !channel.channel->looksEmpty())
+            {
+                // Tried again straight away
+                waiting.pop_back();
+                __atomic_store_n(&waitingCount, waiting.size(), __ATOMIC_RELAXED);
+                return;
+            }
+        }
+        thread.state = Thread::S_WAITING_FOR_CHANNEL;
+        thread.waitingFor = id;
+        runNextThread();
+        return;
+    }
+
+    if (entry.shared)
+    {
+        // Another machine could use the channel at any moment, so it's tried again as soon as the other threads have
+        // had a turn. If there aren't any, the processor is given up, and if the channel stays unusable for long, the
+        // machine sleeps for longer and longer between tries, so that it doesn't keep a core busy while it waits
+        if (safepoint()) return;
+        if (multiplexed_) takeDeliveries();
+        if (!readyThreads.empty())
+        {
+            yield();
+            return;
+        }
+        if (channelWaits < channelSpinLimit)
+        {
+            ++channelWaits;
+            sched_yield();
             return;
         }
+        const unsigned shift = channelWaits - channelSpinLimit;
+        if (shift < 10) ++channelWaits;
+        const timespec sleep = { 0, long(std::min(1000u << shift, maximumChannelSleep)) };
+        nanosleep(&sleep, NULL);
+        return;
     }
-    throw(std::runtime_error("Machine::jump: Unknown label '" + std::string(labelName) + "'"));
+
+    // Only this machine's threads can use the channel, so nothing will change it if none of them are ready
+    if (readyThreads.empty())
+        throw(std::runtime_error("Machine::waitForChannel: Every thread is waiting for another or a channel"));
+    threads[currentThread_]->state = Thread::S_WAITING_FOR_CHANNEL;
+    threads[currentThread_]->waitingFor = id;
+    ++entry.waitingCount;
+    switchToNextThread();
 }
 
-void Machine::jump(const unsigned lineNumber)
+void Machine::channelUsed(const unsigned id, const bool sent)
 {
-    programCounter_ = lineNumber;
+    ChannelEntry & entry = channels[id];
+    channelWaits = 0;
+    if (entry.sharedChannel != NULL)
+    {
+        // The threads waiting to do the opposite may be able to now. Only those are woken, and the mutex is only taken
+        // if there are any
+        SharedChannel & channel = *entry.sharedChannel;
+        unsigned & waitingCount = sent ? channel.receiversWaiting : channel.sendersWaiting;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&waitingCount, __ATOMIC_RELAXED) == 0) return;
+
+        Mutex::Lock lock(scheduler->mutex);
+        std::vector<std::pair<unsigned, unsigned> > & waiting = sent ? channel.receivers : channel.senders;
+        for (unsigned i = 0; i < waiting.size(); ++i) scheduler->wake(waiting[i].first, waiting[i].second);
+        waiting.clear();
+        __atomic_store_n(&waitingCount, 0, __ATOMIC_RELAXED);
+        return;
+    }
+    if (entry.waitingCount == 0) return;
+
+    // Everything waiting is woken, whether to send or receive, and anything that still can't goes back to waiting
+    for (unsigned i = 0; i < threads.size(); ++i)
+    {
+        Thread * const thread = threads[i];
+        if ((thread != NULL) && (thread->state == Thread::S_WAITING_FOR_CHANNEL) && (thread->waitingFor == id))
+        {
+            thread->state = Thread::S_READY;
+            readyThreads.push_back(i);
+        }
+    }
+    entry.waitingCount = 0;
 }
 
-void Machine::_returnFromCall(const Block * returnBlock)
+void Machine::_send(const Block * channelBlock, const Block * valueBlock)
 {
-    stack_.popFrame(returnBlock);
-    programCounter_ = returnAddressStack.back();
-    returnAddressStack.pop_back();
+    if (valueBlock == NULL) throw(std::runtime_error("Machine::_send: Invalid value given"));
+    const unsigned id = channelId(channelBlock);
+    if (!channels[id].channel->trySend(*valueBlock))
+    {
+        waitForChannel(id, true);
+        return;
+    }
+    channelUsed(id, true);
+    ++programCounter_;
+}
+
+void Machine::_receive(const Block * channelBlock)
+{
+    const unsigned id = channelId(channelBlock);
+    if (!channels[id].channel->tryReceive(managedOutRegister_, managedHeap_, receivedArrays))
+    {
+        waitForChannel(id, false);
+        return;
+    }
+    channelUsed(id, false);
+    ++programCounter_;
+}
+
+void Machine::_tryReceive(const Block * channelBlock)
+{
+    const unsigned id = channelId(channelBlock);
+    const bool received = channels[id].channel->tryReceive(managedOutRegister_, managedHeap_, receivedArrays);
+    if (received) channelUsed(id, false);
+
+    comparisonFlagRegister_.reset();
+    comparisonFlagRegister_.setValue(ComparisonFlagRegister::F_EQUAL, received);
+    comparisonFlagRegister_.setValue(ComparisonFlagRegister::F_NOT_EQUAL, !received);
+}
+
+void Machine::_mapArray(const Block * pointerBlock, const unsigned functionIndex)
+{
+    if (pointerBlock == NULL) throw(std::runtime_error("Machine::_mapArray: Array pointer is invalid"));
+    if (pointerBlock->dataType() != Block::DT_POINTER)
+        throw(std::runtime_error("Machine::_mapArray: First operand data type is invalid (expected pointer)"));
+    ManagedHeap * const heap = pointerBlock->pointerManagedHeap();
+    if (pointerBlock->pointerIsNull() || (heap == NULL))
+        throw(std::runtime_error("Machine::_mapArray: Array pointer does not point to an array in a managed heap"));
+    if (parallelArrays == NULL)
+        throw(std::runtime_error("Machine::_mapArray: Functions can only be mapped by an interpreter"));
+
+    Mutex * const mutex = ioMutex();
+    if (mutex == NULL)
+    {
+        parallelArrays->map(*heap, pointerBlock->pointerAddress(), functionIndex, *output_);
+        return;
+    }
+    // Threads on other carriers can write at any time, so the output is only written once it's all there
+    std::ostringstream output;
+    parallelArrays->map(*heap, pointerBlock->pointerAddress(), functionIndex, output);
+    Mutex::Lock lock(*mutex);
+    *output_ << output.str();
+}
+
+void Machine::_reduceArray(const Block * pointerBlock, const Opcodes::Reduction reduction)
+{
+    if (pointerBlock == NULL) throw(std::runtime_error("Machine::_reduceArray: Array pointer is invalid"));
+    if (pointerBlock->dataType() != Block::DT_POINTER)
+        throw(std::runtime_error("Machine::_reduceArray: First operand data type is invalid (expected pointer)"));
+    const ManagedHeap * const heap = pointerBlock->pointerManagedHeap();
+    if (pointerBlock->pointerIsNull() || (heap == NULL))
+        throw(std::runtime_error("Machine::_reduceArray: Array pointer does not point to an array in a managed heap"));
+    if (parallelArrays == NULL)
+        throw(std::runtime_error("Machine::_reduceArray: Arrays can only be reduced by an interpreter"));
+
+    parallelArrays->reduce(*heap, pointerBlock->pointerAddress(), reduction, managedOutRegister_);
+}
+
+ManagedHeap & Machine::arrayHeap(const Block * const pointerBlock, const char * const function)
+{
+    if (pointerBlock == NULL) throw(std::runtime_error(std::string(function) + ": Array pointer is invalid"));
+    if (pointerBlock->dataType() != Block::DT_POINTER)
+        throw(std::runtime_error(std::string(function) + ": Array pointer data type is invalid (expected pointer)"));
+    ManagedHeap * const heap = pointerBlock->pointerManagedHeap();
+    if (pointerBlock->pointerIsNull() || (heap == NULL))
+    {
+        throw(std::runtime_error(std::string(function)
+                                 + ": Array pointer does not point to an array in a managed heap"));
+    }
+    return *heap;
+}
+
+void Machine::operateOnArray(const Block * const pointerBlock, const Block * const sourceBlock,
+                             const ArrayKernels::Operation operation,
+                             void (Machine::* const scalarOperation)(Block *, const Block *),
+                             const char * const function)
+{
+    ManagedHeap & heap = arrayHeap(pointerBlock, function);
+    if (sourceBlock == NULL) throw(std::runtime_error(std::string(function) + ": Invalid source given"));
+    const unsigned address = pointerBlock->pointerAddress(), length = heap.arrayLengthAt(address);
+
+    const Block value = *sourceBlock; // Copied in case it is one of the elements that are about to change
+    ManagedHeap * sourceHeap = NULL;
+    unsigned sourceAddress = 0;
+    if (value.dataType() == Block::DT_POINTER)
+    {
+        sourceHeap = &arrayHeap(&value, function);
+        sourceAddress = value.pointerAddress();
+        if (sourceHeap->arrayLengthAt(sourceAddress) != length)
+            throw(std::runtime_error(std::string(function) + ": Arrays are of different lengths"));
+    }
+    if (length == 0) return;
+
+    // First elements are kept in the heap whether or not their arrays are packed, so they are always done as blocks,
+    // which also checks that the data types match
+    Block element, sourceElement;
+    heap.getElement(address, 0, element);
+    if (sourceHeap != NULL) sourceHeap->getElement(sourceAddress, 0, sourceElement);
+    (this->*scalarOperation)(&element, sourceHeap == NULL ? &value : &sourceElement);
+
+    long * const integers = heap.packedIntegersAt(address);
+    double * const reals = heap.packedRealsAt(address);
+    bool applied = true;
+    if (sourceHeap == NULL)
+    {
+        if ((integers != NULL) && (value.dataType() == Block::DT_INTEGER))
+            ArrayKernels::apply(operation, integers, value.integerData(), length - 1);
+        else if ((reals != NULL) && (value.dataType() == Block::DT_REAL))
+            ArrayKernels::apply(operation, reals, value.realData(), length - 1);
+        else applied = false;
+    }
+    else
+    {
+        const long * const sourceIntegers = sourceHeap->packedIntegersAt(sourceAddress);
+        const double * const sourceReals = sourceHeap->packedRealsAt(sourceAddress);
+        if ((integers != NULL) && (sourceIntegers != NULL))
+            ArrayKernels::apply(operation, integers, sourceIntegers, length - 1);
+        else if ((reals != NULL) && (sourceReals != NULL))
+            ArrayKernels::apply(operation, reals, sourceReals, length - 1);
+        else applied = false;
+    }
+    heap.setElement(address, 0, element);
+    if (applied) return;
+
+    for (unsigned i = 1; i < length; ++i)
+    {
+        heap.getElement(address, i, element);
+        if (sourceHeap != NULL) sourceHeap->getElement(sourceAddress, i, sourceElement);
+        (this->*scalarOperation)(&element, sourceHeap == NULL ? &value : &sourceElement);
+        heap.setElement(address, i, element);
+    }
+}
+
+void Machine::_addArrays(const Block * pointerBlock, const Block * sourceBlock)
+{
+    operateOnArray(pointerBlock, sourceBlock, ArrayKernels::O_ADD, &Machine::_add, "Machine::_addArrays");
+}
+
+void Machine::_subtractArrays(const Block * pointerBlock, const Block * sourceBlock)
+{
+    operateOnArray(pointerBlock, sourceBlock, ArrayKernels::O_SUBTRACT, &Machine::_subtract,
+                   "Machine::_subtractArrays");
+}
+
+void Machine::_multiplyArrays(const Block * pointerBlock, const Block * sourceBlock)
+{
+    operateOnArray(pointerBlock, sourceBlock, ArrayKernels::O_MULTIPLY, &Machine::_multiply,
+                   "Machine::_multiplyArrays");
+}
+
+void Machine::_divideArrays(const Block * pointerBlock, const Block * sourceBlock)
+{
+    operateOnArray(pointerBlock, sourceBlock, ArrayKernels::O_DIVIDE, &Machine::_divide, "Machine::_divideArrays");
+}
+
+void Machine::_fillArray(const Block * pointerBlock, const Block * valueBlock)
+{
+    ManagedHeap & heap = arrayHeap(pointerBlock, "Machine::_fillArray");
+    if (valueBlock == NULL) throw(std::runtime_error("Machine::_fillArray: Invalid value given"));
+    heap.fillElements(pointerBlock->pointerAddress(), Block(*valueBlock));
+}
+
+void Machine::_dotProduct(const Block * lhsPointerBlock, const Block * rhsPointerBlock)
+{
+    ManagedHeap & lhsHeap = arrayHeap(lhsPointerBlock, "Machine::_dotProduct");
+    ManagedHeap & rhsHeap = arrayHeap(rhsPointerBlock, "Machine::_dotProduct");
+    const unsigned lhsAddress = lhsPointerBlock->pointerAddress(), rhsAddress = rhsPointerBlock->pointerAddress(),
+                   length = lhsHeap.arrayLengthAt(lhsAddress);
+    if (rhsHeap.arrayLengthAt(rhsAddress) != length)
+        throw(std::runtime_error("Machine::_dotProduct: Arrays are of different lengths"));
+    if (length == 0)
+    {
+        managedOutRegister_.setToInteger(0);
+        return;
+    }
+
+    // As in operateOnArray, the first elements are multiplied as blocks
+    Block total, element;
+    lhsHeap.getElement(lhsAddress, 0, total);
+    rhsHeap.getElement(rhsAddress, 0, element);
+    _multiply(&total, &element);
+
+    const long * const lhsIntegers = lhsHeap.packedIntegersAt(lhsAddress);
+    const long * const rhsIntegers = rhsHeap.packedIntegersAt(rhsAddress);
+    const double * const lhsReals = lhsHeap.packedRealsAt(lhsAddress);
+    const double * const rhsReals = rhsHeap.packedRealsAt(rhsAddress);
+    if ((lhsIntegers != NULL) && (rhsIntegers != NULL))
+    {
+        element.setToInteger(ArrayKernels::dot(lhsIntegers, rhsIntegers, length - 1));
+        _add(&total, &element);
+    }
+    else if ((lhsReals != NULL) && (rhsReals != NULL))
+    {
+        element.setToReal(ArrayKernels::dot(lhsReals, rhsReals, length - 1));
+        _add(&total, &element);
+    }
+    else
+    {
+        Block product;
+        for (unsigned i = 1; i < length; ++i)
+        {
+            lhsHeap.getElement(lhsAddress, i, product);
+            rhsHeap.getElement(rhsAddress, i, element);
+            _multiply(&product, &element);
+            _add(&total, &product);
+        }
+    }
+    managedOutRegister_ = total;
 }
 
 void Machine::loadExtension(const char * fileName)
 {
+    Mutex::Lock lock(extensionMutex);
     void * handle = dlopen(fileName, RTLD_LAZY);
     char * error = dlerror();
     if ((handle == NULL) || (error != NULL))
         throw(std::runtime_error("Machine::loadExtension: " + std::string(error)));
 
+    // An extension can add functions of either calling convention, or both, but has to add something
     void * f = dlsym(handle, "tvmLoadExtension");
     error = dlerror();
-    if ((f == NULL) || (error != NULL)) throw(std::runtime_error("Machine::loadExtension: " + std::string(error)));
+    const std::string loaderError(error == NULL ? "" : error);
+    void * spanF = dlsym(handle, "tvmLoadSpanExtension");
+    dlerror();
+    if ((f == NULL) && (spanF == NULL)) throw(std::runtime_error("Machine::loadExtension: " + loaderError));
 
-    typedef void(*AddNewFunctionFunction)(const char *, ExtensionFunction::Pointer, unsigned);
-    typedef void(*LoaderFunction)(AddNewFunctionFunction);
-    LoaderFunction loadFunction = *reinterpret_cast<LoaderFunction*>(&f);
-    loadFunction(ExtensionFunction::addNew);
+    if (f != NULL)
+    {
+        typedef void(*AddNewFunctionFunction)(const char *, ExtensionFunction::Pointer, unsigned);
+        typedef void(*LoaderFunction)(AddNewFunctionFunction);
+        LoaderFunction loadFunction = *reinterpret_cast<LoaderFunction*>(&f);
+        loadFunction(ExtensionFunction::addNew);
+    }
+    if (spanF != NULL)
+    {
+        typedef void(*AddNewSpanFunctionFunction)(const char *, ExtensionFunction::SpanPointer, unsigned);
+        typedef void(*SpanLoaderFunction)(AddNewSpanFunctionFunction);
+        SpanLoaderFunction loadFunction = *reinterpret_cast<SpanLoaderFunction*>(&spanF);
+        loadFunction(ExtensionFunction::addNewSpan);
+    }
 
     extensionHandles.push_back(handle);
 }
 
 void Machine::extensionCall(const char * functionName)
 {
-    ExtensionFunction * function = ExtensionFunction::find(functionName);
+    const ExtensionFunction * function = ExtensionFunction::find(functionName);
     if (function == NULL)
         throw(std::runtime_error(
                 "Machine::extensionCall: Unknown extension function '" + std::string(functionName) + "'"));
 
+    extensionCall(*function);
+}
+
+void Machine::extensionCall(const ExtensionFunction & function)
+{
     if (extensionMachine == NULL)
         extensionMachine = new Machine(extensionMachineStackSize, extensionMachineHeapSize, extensionMachineHeapSize);
-    const Block block = function->call(stack_, extensionMachine);
+
+    if (function.takesArgumentSpan())
+    {
+        // The result goes straight into the slot that was reserved for it when the stack frame was pushed
+        Block & result = stack_.fromTopBelow(0);
+        function.call(stack_, extensionMachine, result);
+        _returnFromCall(&result);
+        return;
+    }
+
+    const Block block = function.call(stack_, extensionMachine);
 
     _returnFromCall(&block);
 }
@@ -776,24 +1794,24 @@ unsigned & Machine::programCounter()
     return programCounter_;
 }
 
-const Machine::LabelList & Machine::labels() const
+std::istream & Machine::input()
 {
-    return labels_;
+    return *input_;
 }
 
-void Machine::addLabel(const char * labelName, unsigned lineNumber)
+std::ostream & Machine::output()
 {
-    if (strlen(labelName) == 0) return;
-    labels_.push_back(Label(labelName, lineNumber));
+    return *output_;
 }
 
-unsigned Machine::labelLineNumber(const char * labelName) const
+void Machine::setInput(std::istream & stream)
 {
-    for (unsigned i = 0; i < labels_.size(); ++i)
-    {
-        if (strcmp(labels_[i].value, labelName) == 0) return labels_[i].line;
-    }
-    throw(std::runtime_error("Machine::labelLineNumber: Label '" + std::string(labelName) + "' could not be found"));
+    input_ = &stream;
+}
+
+void Machine::setOutput(std::ostream & stream)
+{
+    output_ = &stream;
 }
 
 bool & Machine::operand1IsPointer()
@@ -899,3 +1917,21 @@ const Block * Machine::getBlockFrom(const Block & pointer, const short operandNu
 
     return &pointer;
 }
+
+Block * Machine::getIndirectBlock(Block & pointer, Block & previous)
+{
+    Block * const block = getBlockFrom(pointer, 3);
+    const ManagedHeap * const heap = (pointer.dataType() == Block::DT_POINTER) && !pointer.pointerIsNull()
+                                     ? pointer.pointerManagedHeap() : NULL;
+    if ((heap != NULL) && heap->arrayIsPackedAt(pointer.pointerAddress())) previous = *block;
+    else previous.setToPointer();
+    return block;
+}
+
+void Machine::checkIndirectWrite(Block * const block, const Block & previous)
+{
+    if ((previous.dataType() == Block::DT_POINTER) || (block == NULL) || (block->dataType() == previous.dataType()))
+        return;
+    *block = previous;
+    throw(std::runtime_error("Machine::checkIndirectWrite: Value does not match the data type of the packed array"));
+}
@@ -10,15 +10,24 @@
 
 #include <map>
 #include <vector>
+#include <deque>
+#include <iosfwd>
 
 #include "Stack.hpp"
 #include "ManagedHeap.hpp"
 #include "ComparisonFlagRegister.hpp"
+#include "Opcodes.hpp"
+#include "ArrayKernels.hpp"
+
+class ExtensionFunction;
+class Mutex;
+class Channel;
+class ParallelArrays;
+class Scheduler;
 
 class Machine
 {
 public:
-    typedef std::vector<Label> LabelList;
     typedef std::vector<unsigned> ReturnAddressStack;
 
     enum locationId
@@ -33,7 +42,9 @@ public:
     MANAGED_OUT_REGISTER = L_MANAGED_OUT_REGISTER,
     NIL = L_NIL;
 
-    Machine(unsigned stackSize = 0, unsigned unmanagedHeapSize = 0, unsigned managedHeapSize = 0);
+    // Sizes are the most blocks each can grow to, or 0 for the defaults
+    Machine(unsigned stackSize = 0, unsigned unmanagedHeapSize = 0, unsigned managedHeapSize = 0,
+            ManagedHeap::CollectionMode collectionMode = ManagedHeap::CM_REFERENCE_COUNTING);
     ~Machine();
 
     void flush(); // Clears out all of the data in the machine
@@ -213,14 +224,10 @@ public:
     template <typename T1, typename T2>
     void logicalXor(const T1 & destination, const T2 & source);
 
-    void jump(const char * labelName);
-    void jump(unsigned lineNumber);
-
-    template <typename T> // Does not accept blocks! Only const char* and unsigned int
-    void conditionalJump(const T labelNameOrLineNumber, CFR::ComparisonFlagId condition);
-
-    template <typename T> // Does not accept blocks! Only const char* and unsigned int
-    void call(const T labelNameOrLineNumber);
+    // Labels are resolved when the program is compiled (see Program), so these only take code indices
+    void jump(unsigned codeIndex);
+    void conditionalJump(unsigned codeIndex, CFR::ComparisonFlagId condition);
+    void call(unsigned codeIndex);
 
     template<typename T>
     void returnFromCall(const T & returnValue);
@@ -228,6 +235,31 @@ public:
     void loadExtension(const char * fileName);
     // returnFromCall is called in this function, so stack frame and arguments must already be pushed before calling!
     void extensionCall(const char * functionName);
+    void extensionCall(const ExtensionFunction & function); // For callers that have already looked the function up
+
+    // Green threads. Each has its own stack, registers and comparison flags, and they all share the heaps. Only one
+    // runs at a time, until it yields, waits to join another thread or finishes. The thread that was running when the
+    // machine was created (or last flushed) is the main one, with id 0.
+    // With a scheduler that has several carriers (see Scheduler), threads are spread over the carriers, which run at
+    // once, with one thread at a time each. Threads on the same carrier share its heaps, but threads on different ones
+    // share no memory: a thread's argument and result are copied between heaps, as values sent on channels are. So
+    // threads should only pass data to each other through those and channels, which work the same either way
+    // Starts a thread at codeIndex, as if its function had been called with a copy of the value at the top of the
+    // stack, and pushes the new thread's id. When the function returns, the thread goes to exitAddress, which should
+    // be where the code ends (see finishThread)
+    void spawn(unsigned codeIndex, unsigned exitAddress);
+    void yield(); // Switches to the next thread that is ready, if any. The program counter must be where to resume
+    // For when the running thread reaches the end of the code. Returns false if it's the main thread, which ends the
+    // program (and stops any threads still running on other carriers). Otherwise the value at the top of its stack is
+    // kept for whichever thread joins it, and the next thread that is ready is switched to. Throws if every other
+    // thread is waiting
+    bool finishThread();
+    unsigned currentThread() const;
+
+    // Channels carry values between threads, or between machines, which are named in programs by integer ids. A
+    // channel that a program uses without one having been set here is made by the machine, and can only be used by its
+    // own threads. A shared channel must outlive the machine (see Channel for which kinds can be shared how)
+    void setChannel(unsigned id, Channel & channel);
 
     Stack & stack();
     Heap & unmanagedHeap();
@@ -237,9 +269,12 @@ public:
     Block & managedOutRegister();
     unsigned & programCounter();
 
-    const LabelList & labels() const;
-    void addLabel(const char * labelName, unsigned lineNumber);
-    unsigned labelLineNumber(const char * labelName) const;
+    // Where in, ins, out and outs read and write (std::cin and std::cout unless set otherwise). Errors that halt
+    // execution are reported to the output too
+    std::istream & input();
+    std::ostream & output();
+    void setInput(std::istream & stream);
+    void setOutput(std::ostream & stream);
 
     bool & operand1IsPointer();
     bool operand1IsPointer() const;
@@ -252,11 +287,29 @@ public:
     Block * getBlockFrom(Block & pointer, short operandNumber);
     const Block * getBlockFrom(const Block & pointer, short operandNumber);
 
+    // The interpreter and its handlers resolve operands themselves when running bytecode, so they call the underscored
+    // functions directly
+    friend class Interpreter;
+    friend class Handlers;
+    friend class Jit;
+    friend class Scheduler;
+
 private:
+    // Extensions are shared by every machine, and unloaded along with their functions once the last one is destroyed
     static std::vector<void*> extensionHandles;
     static unsigned machineCount;
+    static Mutex extensionMutex; // Guards the two above
     static const unsigned extensionMachineStackSize, extensionMachineHeapSize;
 
+    // A machine that carries threads for owner's scheduler, with heaps of its own of the same sizes
+    Machine(Machine & owner, Scheduler & scheduler, unsigned carrierIndex);
+
+    // For the handlers' '@' operands. The first element of a packed array has to keep the array's data type, so if the
+    // block pointer points to is one, its value is kept in previous for checkIndirectWrite, which puts it back and
+    // throws if an instruction has written a value of another type. Otherwise previous is set to a null pointer
+    Block * getIndirectBlock(Block & pointer, Block & previous);
+    void checkIndirectWrite(Block * block, const Block & previous);
+
     Stack stack_;
     Heap unmanagedHeap_;
     ManagedHeap managedHeap_;
@@ -264,9 +317,16 @@ private:
     Block primaryRegister_,
     managedOutRegister_; // a register for storing the output of managed heap functions
     unsigned programCounter_;
+    std::istream * input_;
+    std::ostream * output_;
 
-    LabelList labels_;
     ReturnAddressStack returnAddressStack;
+    // How many times each instruction has been called or jumped back to, indexed by code index. Only kept up to date
+    // when hot code is being compiled
+    std::vector<unsigned> labelCounts_;
+    // How many instructions have been quickened to handlers specialised for the data types of their operands, and how
+    // many of those have since gone back to the generic handler because the data types changed
+    unsigned quickenedCount_, deoptimisedCount_;
 
     class ArrayPopulator
     {
@@ -275,12 +335,159 @@ private:
         void start(const Block & pointerToArray, long startIndex);
         void stop();
         void add(const Block & value);
+        Block & array();
+        void swap(ArrayPopulator & other);
 
     private:
         Block arrayPointer;
         int currentIndex;
     } arrayBeingPopulated;
 
+    // Everything in the machine that can point into the managed heap, for when it is collected by mark-sweep
+    class Roots : public ManagedHeap::RootSet
+    {
+    public:
+        Roots(Machine & machine);
+        void visitRoots(ManagedHeap & heap, bool allBlocks);
+
+    private:
+        Machine & machine;
+    } roots;
+
+    // Everything a green thread has to itself. The running thread's context is kept in the machine, so that the
+    // interpreter and native code always find it in the same place, and switching threads exchanges contexts
+    struct Context
+    {
+        explicit Context(unsigned stackSize);
+        void clear(); // Empties the context, so that it holds no pointers
+
+        Stack stack;
+        ReturnAddressStack returnAddressStack;
+        Block primaryRegister, managedOutRegister;
+        ComparisonFlagRegister comparisonFlagRegister;
+        ArrayPopulator arrayBeingPopulated;
+        unsigned programCounter;
+    };
+
+    class Thread
+    {
+    public:
+        enum State
+        {
+            S_READY,
+            S_RUNNING,
+            S_WAITING, // For the thread waitingFor to finish
+            S_WAITING_FOR_CHANNEL, // For something to be sent or received on the channel waitingFor
+            S_FINISHED
+        };
+
+        explicit Thread(unsigned stackSize);
+        ~Thread();
+
+        Context * context; // Where the thread's context is kept while it isn't running. Empty while it is
+        Block result;
+        State state;
+        unsigned waitingFor;
+        unsigned id; // The thread's id in the program, which is its index in threads unless they're multiplexed
+
+    private:
+        Thread(const Thread &);
+        Thread & operator =(const Thread &);
+    };
+
+    std::vector<Thread*> threads; // Indexed by id, NULL where an id is free. Empty until the first thread is spawned
+    std::vector<Thread*> spareThreads; // Joined threads, kept to be reused
+    std::deque<unsigned> readyThreads;
+    unsigned currentThread_, threadStackSize;
+
+    void switchToNextThread(); // Throws if no thread is ready
+    void exchangeContext(Context & context);
+    // Takes a free index in threads for a thread that starts at codeIndex with argument on its stack (unless it's
+    // NULL), and queues it. Returns the index
+    unsigned startThread(unsigned codeIndex, unsigned exitAddress, const Block * argument);
+
+    // Runs green threads M:N, with this machine as the first of its carriers. Belongs to the interpreter running the
+    // machine, as the carriers need the program. NULL while there isn't one, and shared by the carriers
+    Scheduler * scheduler;
+    Machine * owner_; // The machine whose threads a carrier runs, or this one
+    unsigned carrierIndex;
+    // Whether the threads are spread over the scheduler's carriers, from when the first is spawned until the main one
+    // finishes. Always true for the other carriers
+    bool multiplexed_;
+    static const unsigned char noSafepoint; // What safepointFlag points to without a scheduler
+
+    Scheduler * activeScheduler() const; // The scheduler while the threads are multiplexed, otherwise NULL
+    Mutex * ioMutex() const; // Guards the input and output while the threads are multiplexed, otherwise NULL
+    // Set while the threads are being stopped, for the interpreter and native code to poll at safepoints
+    const unsigned char * safepointFlag() const;
+    // Sends the running thread to the end of the code if the threads are being stopped, and returns whether they are
+    bool safepoint();
+    void startMultiplexing(unsigned exitAddress); // If the scheduler has several carriers
+    // Waits for a carrier to be given threads, and switches to the first. Returns false once the scheduler is being
+    // destroyed
+    bool carry();
+    // Takes the threads and wakeups delivered to the carrier
+    void takeDeliveries();
+    // Switches to the next thread that is ready, parking the carrier until there is one. Returns false if the threads
+    // are being stopped instead, leaving the program counter at the end of the code
+    bool runNextThread();
+    // For finishThread and _join while the threads are multiplexed
+    bool finishMultiplexedThread();
+    void joinMultiplexed(Block * threadBlock);
+    void stopThreads(); // Stops every thread, and waits for the carriers to be idle. Called by the main thread
+    void haltThreads(); // For when a thread fails, which stops them all
+    bool threadFailed(); // Whether any thread has failed since the machine was last flushed
+
+    // A channel used by threads on several carriers. Those that wait on it are parked, and woken by whichever thread
+    // next uses the channel the other way
+    struct SharedChannel
+    {
+        Channel * channel;
+        bool owned; // Made by the scheduler, rather than set on the machine
+        // How many threads are waiting to send and to receive, which are read without taking the scheduler's mutex,
+        // and which threads those are, by carrier and index in its machine
+        unsigned sendersWaiting, receiversWaiting;
+        std::vector<std::pair<unsigned, unsigned> > senders, receivers;
+    };
+
+    struct ChannelEntry
+    {
+        Channel * channel; // NULL until the channel is first used
+        bool shared; // Set with setChannel (or shared by the scheduler) rather than owned by the machine
+        unsigned waitingCount; // How many threads are waiting on the channel
+        SharedChannel * sharedChannel; // While the threads are multiplexed
+    };
+
+    static const unsigned maximumChannelId = 0xFFFF, ownChannelCapacity = 256;
+    // How many times in a row a shared channel is tried by giving up the processor before backing off to sleeping,
+    // and the longest sleep in nanoseconds
+    static const unsigned channelSpinLimit = 100, maximumChannelSleep = 1000000;
+
+    std::vector<ChannelEntry> channels; // Indexed by id
+    unsigned channelWaits; // How many times in a row the machine has waited for a shared channel with nothing to run
+    std::vector<Block> receivedArrays; // Arrays that are being allocated for a value that has been received
+
+    unsigned channelId(const Block * channelBlock); // Makes the channel if it doesn't exist yet
+    void shareChannel(unsigned id); // Connects the channel to the one the scheduler has with the id, or gives it one
+    // Drops the connections to the scheduler's channels. Those it made go with it, and any that were set on the
+    // machine go back to being used directly
+    void disconnectChannels();
+    // Leaves the program counter where it is, so that the instruction using the channel is tried again later
+    void waitForChannel(unsigned id, bool sending);
+    void channelUsed(unsigned id, bool sent); // Wakes the threads waiting on the channel
+
+    // Calls functions for pmap, and splits arrays up for it and preduce. Belongs to the interpreter running the
+    // machine, as it needs the program to call functions from. NULL while there isn't one
+    ParallelArrays * parallelArrays;
+
+    // The heap holding the array pointerBlock points to, after checking that it does point to one. function is the
+    // name of the instruction's function, for errors
+    static ManagedHeap & arrayHeap(const Block * pointerBlock, const char * function);
+    // Does what scalarOperation does to one block to every element of an array, with the source given to a bulk array
+    // instruction. Packed arrays of integers and reals are handed to the kernels, if the source matches them
+    void operateOnArray(const Block * pointerBlock, const Block * sourceBlock, ArrayKernels::Operation operation,
+                        void (Machine::*scalarOperation)(Block *, const Block *), const char * function);
+
     bool operand1IsPointer_, operand2IsPointer_;
 
     Machine * extensionMachine; // A separate machine for extension functions to work inside
@@ -320,6 +527,9 @@ private:
     void _convertToDataTypeOf(Block * destBlock, const Block * sourceBlock);
     void _dereference(Block * destBlock, const Block * pointerBlock);
     void _compare(const Block * lhsBlock, const Block * rhsBlock);
+    // Only sets the given flag, leaving the others as they were. Used by fused compare and jump instructions when the
+    // other flags are known not to be read
+    void _compareForFlag(const Block * lhsBlock, const Block * rhsBlock, ComparisonFlagRegister::ComparisonFlagId flagId);
     void _compareDataType(const Block * lhsBlock, const Block * rhsBlock);
     void _isDataType(const Block * block, Block::DataType dataType);
     void _copyFlag(Block * destBlock, ComparisonFlagRegister::ComparisonFlagId flagId);
@@ -328,6 +538,21 @@ private:
     void _logicalOr(Block * destBlock, const Block * sourceBlock);
     void _logicalXor(Block * destBlock, const Block * sourceBlock);
     void _returnFromCall(const Block * returnBlock);
+    void _join(Block * threadBlock); // Leaves the program counter on the join if the thread has to wait
+    // Values are received into the managed out register, as any arrays that come with them are allocated. The first
+    // two leave the program counter where it is if the thread has to wait, and the last sets the equal flags
+    void _send(const Block * channelBlock, const Block * valueBlock);
+    void _receive(const Block * channelBlock);
+    void _tryReceive(const Block * channelBlock);
+    void _mapArray(const Block * pointerBlock, unsigned functionIndex);
+    void _reduceArray(const Block * pointerBlock, Opcodes::Reduction reduction); // Into the managed out register
+    // The source of each of these is either a value for every element, or a pointer to an array of the same length
+    void _addArrays(const Block * pointerBlock, const Block * sourceBlock);
+    void _subtractArrays(const Block * pointerBlock, const Block * sourceBlock);
+    void _multiplyArrays(const Block * pointerBlock, const Block * sourceBlock);
+    void _divideArrays(const Block * pointerBlock, const Block * sourceBlock);
+    void _fillArray(const Block * pointerBlock, const Block * valueBlock);
+    void _dotProduct(const Block * lhsPointerBlock, const Block * rhsPointerBlock); // Into the managed out register
     void _extensionCall(const char * functionName);
 };
 
@@ -686,17 +911,20 @@ void Machine::logicalXor(const T1 & destination, const T2 & source)
     _logicalXor(getBlockFrom(destination, 1), getBlockFrom(source, 2));
 }
 
-template <typename T>
-void Machine::conditionalJump(const T labelNameOrLineNumber, const CFR::ComparisonFlagId condition)
+inline void Machine::jump(const unsigned codeIndex)
 {
-    if (comparisonFlagRegister_.getValue(condition)) jump(labelNameOrLineNumber);
+    programCounter_ = codeIndex;
 }
 
-template <typename T>
-void Machine::call(const T labelNameOrLineNumber)
+inline void Machine::conditionalJump(const unsigned codeIndex, const CFR::ComparisonFlagId condition)
+{
+    if (comparisonFlagRegister_.getValue(condition)) jump(codeIndex);
+}
+
+inline void Machine::call(const unsigned codeIndex)
 {
     const unsigned returnAddress = programCounter_ + 1;
-    jump(labelNameOrLineNumber);
+    jump(codeIndex);
     returnAddressStack.push_back(returnAddress);
     stack_.pushFrame();
 }
@@ -6,66 +6,629 @@
  */
 
 #include <stdexcept>
+#include <algorithm>
+#include <sys/time.h>
 
 #include "ManagedHeap.hpp"
 #include "Block.hpp"
 
-ManagedHeap::ManagedHeap(const unsigned size)
-    : Heap(size), arrayLength(size == 0 ? defaultSize : size, 0) {}
+// The elements after the first of a packed array. Only the vector for the array's data type is used
+struct ManagedHeap::PackedArray
+{
+    const Block::DataType dataType;
+    std::vector<long> integers;
+    std::vector<double> reals;
+    std::vector<char> characters;
+    std::vector<bool> booleans; // One bit each
+
+    PackedArray(const Block::DataType dataType, const unsigned count)
+        : dataType(dataType)
+    {
+        switch (dataType)
+        {
+        case Block::DT_INTEGER: integers.resize(count, 0); break;
+        case Block::DT_REAL:    reals.resize(count, 0.0); break;
+        case Block::DT_CHAR:    characters.resize(count, '\0'); break;
+        case Block::DT_BOOLEAN: booleans.resize(count, false); break;
+        default: throw(std::runtime_error("ManagedHeap::PackedArray: Only scalar data types can be packed"));
+        }
+    }
+
+    static bool canHold(const Block::DataType dataType)
+    {
+        return (dataType == Block::DT_INTEGER) || (dataType == Block::DT_REAL) || (dataType == Block::DT_CHAR)
+                || (dataType == Block::DT_BOOLEAN);
+    }
+
+    void get(const unsigned index, Block & destination) const
+    {
+        switch (dataType)
+        {
+        case Block::DT_INTEGER: destination.setToInteger(integers[index]); break;
+        case Block::DT_REAL:    destination.setToReal(reals[index]); break;
+        case Block::DT_CHAR:    destination.setToChar(characters[index]); break;
+        default:                destination.setToBoolean(booleans[index]); break;
+        }
+    }
+
+    void get(const unsigned first, const unsigned count, Block * const destination) const
+    {
+        switch (dataType)
+        {
+        case Block::DT_INTEGER:
+            for (unsigned i = 0; i < count; ++i) destination[i].setToInteger(integers[first + i]);
+            break;
+        case Block::DT_REAL:
+            for (unsigned i = 0; i < count; ++i) destination[i].setToReal(reals[first + i]);
+            break;
+        case Block::DT_CHAR:
+            for (unsigned i = 0; i < count; ++i) destination[i].setToChar(characters[first + i]);
+            break;
+        default:
+            for (unsigned i = 0; i < count; ++i) destination[i].setToBoolean(booleans[first + i]);
+            break;
+        }
+    }
+
+    void set(const unsigned index, const Block & value)
+    {
+        if (value.dataType() != dataType)
+            throw(std::runtime_error("ManagedHeap::setElement: Value does not match the data type of the packed array"));
+
+        switch (dataType)
+        {
+        case Block::DT_INTEGER: integers[index] = value.integerData(); break;
+        case Block::DT_REAL:    reals[index] = value.realData(); break;
+        case Block::DT_CHAR:    characters[index] = value.charData(); break;
+        default:                booleans[index] = value.booleanData(); break;
+        }
+    }
+
+    void copy(const PackedArray & source, const unsigned count)
+    {
+        switch (dataType)
+        {
+        case Block::DT_INTEGER: std::copy(source.integers.begin(), source.integers.begin() + count, integers.begin());
+            break;
+        case Block::DT_REAL: std::copy(source.reals.begin(), source.reals.begin() + count, reals.begin()); break;
+        case Block::DT_CHAR:
+            std::copy(source.characters.begin(), source.characters.begin() + count, characters.begin());
+            break;
+        default: std::copy(source.booleans.begin(), source.booleans.begin() + count, booleans.begin()); break;
+        }
+    }
+};
+
+ManagedHeap::ManagedHeap(const unsigned size, const CollectionMode collectionMode)
+    : Heap(size, true), arrayLength(Heap::size(), 0), packedArrays(Heap::size(), NULL), freeRunLength(Heap::size(), 0),
+      nextFreeRun(Heap::size(), noRun), previousFreeRun(Heap::size(), noRun), collectionMode_(collectionMode),
+      rootSet(NULL), compacting(false), freeingArrays(false)
+{
+    countsReferences_ = collectionMode == CM_REFERENCE_COUNTING;
+    collectionStatistics_.collectionCount = collectionStatistics_.arraysCollected = 0;
+    collectionStatistics_.totalPauseMilliseconds = collectionStatistics_.longestPauseMilliseconds = 0.0;
+    compactionStatistics_.compactionCount = 0;
+    compactionStatistics_.bytesMoved = 0;
+    compactionStatistics_.totalMilliseconds = compactionStatistics_.longestMilliseconds = 0.0;
+
+    for (unsigned i = 0; i < sizeClassCount; ++i) freeListHeads[i] = noRun;
+    insertFreeRun(0, Heap::size());
+}
+
+ManagedHeap::~ManagedHeap()
+{
+    for (unsigned i = 0; i < packedArrays.size(); ++i) delete packedArrays[i];
+}
+
+void ManagedHeap::flush()
+{
+    Heap::flush();
+    resetAccessedRange();
+}
 
 void ManagedHeap::allocate(Block & pointerDestination, const Block::DataType dataType, const unsigned amount)
 {
-    unsigned size_ = size(), index;
-    bool success = false;
-    // First search for an empty space
-    for (index = 0; index < size_; ++index)
+    const bool packed = (amount > 1) && PackedArray::canHold(dataType);
+    const unsigned blockCount = packed || (amount == 0) ? 1 : amount; // Empty arrays still need a block to point to
+    unsigned index = reserve(blockCount);
+    if (index == noRun)
     {
-        if (referenceCountAt(index) == 0)
+        // pointerDestination mightn't be a root, so it mustn't hold a pointer into the heap while it is compacted
+        pointerDestination.setToPointer();
+
+        if (collectionMode_ == CM_MARK_SWEEP)
+        {
+            collectGarbage();
+            index = reserve(blockCount);
+        }
+        if ((index == noRun) && (blockCount <= maximumSize() - size()))
         {
-            success = true;
-            // When a space is found, make sure all blocks ahead that are required are free
-            for (unsigned j = 1; j < amount; ++j)
-            {
-                if (index + j >= size_)
-                {
-                    success = false;
-                    break;
-                }
-                if (referenceCountAt(index + j) != 0)
-                {
-                    success = false;
-                    index += amount - 1; // No point looking at blocks before the used block, so jump to space after it.
-                    break;               // Add amount - 1 (as apposed to just amount) to negate +1 of outer loop
-                }
-            }
+            // Grow by at least enough for the allocation, doubling the heap if possible so that growing is rare
+            const unsigned growth = blockCount > size() ? blockCount : size();
+            grow(growth <= maximumSize() - size() ? size() + growth : maximumSize());
+            index = reserve(blockCount);
+        }
+        if (index == noRun)
+        {
+            compact();
+            index = reserve(blockCount);
+        }
+        if (index == noRun) throw(std::runtime_error("ManagedHeap::allocate: Data could not be allocated"));
+    }
+
+    arrayLength[index] = amount;
+    for (unsigned i = 0; i < (packed ? 1 : amount); ++i) blockAt(index + i).setTo(dataType);
+    if (packed) packedArrays[index] = new PackedArray(dataType, amount - 1);
+    pointerDestination.setToPointer(index, *this);
+}
 
+void ManagedHeap::getElement(const unsigned index, const unsigned element, Block & destination)
+{
+    if (element >= arrayLengthAt(index))
+        throw(std::out_of_range("ManagedHeap::getElement: Element index out of range"));
+
+    // The value is read before destination is changed, so this is fine even if destination holds the last pointer
+    // to the array
+    if ((element == 0) || (packedArrays[index] == NULL)) destination = blockAt(index + element);
+    else packedArrays[index]->get(element - 1, destination);
+}
+
+void ManagedHeap::setElement(const unsigned index, const unsigned element, const Block & value)
+{
+    if (element >= arrayLengthAt(index))
+        throw(std::out_of_range("ManagedHeap::setElement: Element index out of range"));
+
+    PackedArray * const packed = packedArrays[index];
+    if (packed == NULL) blockAt(index + element) = value;
+    else if (element > 0) packed->set(element - 1, value);
+    else if (value.dataType() != packed->dataType)
+        throw(std::runtime_error("ManagedHeap::setElement: Value does not match the data type of the packed array"));
+    else blockAt(index) = value;
+}
+
+void ManagedHeap::getScalarElements(const unsigned index, unsigned first, unsigned count, Block * destination) const
+{
+    const unsigned length = arrayLengthAt(index);
+    if ((first > length) || (count > length - first))
+        throw(std::out_of_range("ManagedHeap::getScalarElements: Element index out of range"));
+    if (count == 0) return;
+
+    // The elements after the first of a packed array can only be scalars. The first is kept in the heap itself, so it's
+    // checked like those of an unpacked array
+    const PackedArray * const packed = packedArrays[index];
+    if (packed != NULL)
+    {
+        if (first == 0)
+        {
+            const Block & block = existingBlockAt(index);
+            if (block.dataType() == Block::DT_POINTER)
+                throw(std::runtime_error("ManagedHeap::getScalarElements: Element is a pointer"));
+            *destination++ = block;
+            ++first;
+            --count;
         }
-        if (success) break;
+        packed->get(first - 1, count, destination);
+        return;
     }
 
-    if (success)
+    for (unsigned i = 0; i < count; ++i)
     {
-        arrayLength[index] = amount;
-        for (unsigned i = 0; i < amount; ++i) blockAt(index + i).setTo(dataType);
-        pointerDestination.setToPointer(index, *this);
+        const Block & block = existingBlockAt(index + first + i);
+        if (block.dataType() == Block::DT_POINTER)
+            throw(std::runtime_error("ManagedHeap::getScalarElements: Element is a pointer"));
+        destination[i] = block;
     }
-    else
+}
+
+void ManagedHeap::fillElements(const unsigned index, const Block & value)
+{
+    const unsigned length = arrayLengthAt(index);
+    PackedArray * const packed = packedArrays[index];
+    if ((length == 0) || (packed == NULL))
     {
-        pointerDestination.setToPointer();
-        throw(std::runtime_error("ManagedHeap::allocate: Data could not be allocated"));
+        for (unsigned i = 0; i < length; ++i) blockAt(index + i) = value;
+        return;
+    }
+
+    if (value.dataType() != packed->dataType)
+        throw(std::runtime_error("ManagedHeap::fillElements: Value does not match the data type of the packed array"));
+    blockAt(index) = value;
+    switch (packed->dataType)
+    {
+    case Block::DT_INTEGER: std::fill(packed->integers.begin(), packed->integers.end(), value.integerData()); break;
+    case Block::DT_REAL:    std::fill(packed->reals.begin(), packed->reals.end(), value.realData()); break;
+    case Block::DT_CHAR:    std::fill(packed->characters.begin(), packed->characters.end(), value.charData()); break;
+    default:                std::fill(packed->booleans.begin(), packed->booleans.end(), value.booleanData()); break;
+    }
+}
+
+long * ManagedHeap::packedIntegersAt(const unsigned index)
+{
+    PackedArray * const packed = packedArrays[index];
+    return (packed != NULL) && (packed->dataType == Block::DT_INTEGER) ? &packed->integers[0] : NULL;
+}
+
+const long * ManagedHeap::packedIntegersAt(const unsigned index) const
+{
+    const PackedArray * const packed = packedArrays[index];
+    return (packed != NULL) && (packed->dataType == Block::DT_INTEGER) ? &packed->integers[0] : NULL;
+}
+
+double * ManagedHeap::packedRealsAt(const unsigned index)
+{
+    PackedArray * const packed = packedArrays[index];
+    return (packed != NULL) && (packed->dataType == Block::DT_REAL) ? &packed->reals[0] : NULL;
+}
+
+const double * ManagedHeap::packedRealsAt(const unsigned index) const
+{
+    const PackedArray * const packed = packedArrays[index];
+    return (packed != NULL) && (packed->dataType == Block::DT_REAL) ? &packed->reals[0] : NULL;
+}
+
+void ManagedHeap::copyElements(const unsigned destIndex, ManagedHeap & source, const unsigned sourceIndex,
+                               const unsigned count)
+{
+    if ((count == 0) || ((&source == this) && (destIndex == sourceIndex))) return;
+
+    PackedArray * const destPacked = packedArrays[destIndex];
+    const PackedArray * const sourcePacked = source.packedArrays[sourceIndex];
+    if (destPacked != NULL)
+    {
+        // Every element is checked before any is written, so a copy that fails leaves the destination as it was
+        bool compatible = (sourcePacked != NULL) && (sourcePacked->dataType == destPacked->dataType);
+        if (sourcePacked == NULL)
+        {
+            compatible = true;
+            for (unsigned i = 0; compatible && (i < count); ++i)
+                compatible = source.blockAt(sourceIndex + i).dataType() == destPacked->dataType;
+        }
+        if (!compatible)
+        {
+            throw(std::runtime_error("ManagedHeap::copyElements: Values do not match the data type of the packed "
+                                     "array"));
+        }
+    }
+
+    blockAt(destIndex) = source.blockAt(sourceIndex);
+    if ((destPacked != NULL) && (sourcePacked != NULL))
+    {
+        destPacked->copy(*sourcePacked, count - 1);
+        return;
+    }
+
+    Block element;
+    for (unsigned i = 1; i < count; ++i)
+    {
+        source.getElement(sourceIndex, i, element);
+        setElement(destIndex, i, element);
+    }
+}
+
+void ManagedHeap::storeCharacters(const unsigned index, const char * const characters, const unsigned count)
+{
+    if (count == 0) return;
+    blockAt(index).setCharData(characters[0]);
+
+    PackedArray * const packed = packedArrays[index];
+    if (packed == NULL)
+    {
+        for (unsigned i = 1; i < count; ++i) blockAt(index + i).setCharData(characters[i]);
+        return;
+    }
+
+    if (packed->dataType != Block::DT_CHAR)
+        throw(std::runtime_error("ManagedHeap::storeCharacters: Array is not an array of characters"));
+    std::copy(characters + 1, characters + count, packed->characters.begin());
+}
+
+void ManagedHeap::printCharacters(const unsigned index, std::ostream & stream)
+{
+    const unsigned length = arrayLengthAt(index);
+    const PackedArray * const packed = packedArrays[index];
+    if (packed == NULL)
+    {
+        for (unsigned i = 0; i < length; ++i)
+        {
+            const char c = blockAt(index + i).charData();
+            if (c == '\0') break;
+            stream << c;
+        }
+        return;
     }
+
+    if (packed->dataType != Block::DT_CHAR)
+        throw(std::runtime_error("ManagedHeap::printCharacters: Array is not an array of characters"));
+
+    const char first = blockAt(index).charData();
+    if (first == '\0') return;
+    stream << first;
+
+    const std::vector<char> & characters = packed->characters;
+    stream.write(&characters[0], std::find(characters.begin(), characters.end(), '\0') - characters.begin());
 }
 
-unsigned ManagedHeap::arrayLengthAt(const unsigned index)
+void ManagedHeap::freeArray(const unsigned index)
 {
-    if (index >= size()) throw(std::out_of_range("ManagedHeap::arrayLengthAt: Array length index out of range"));
+    // Arrays freed by releasing the pointers in this one are queued rather than freed recursively, so that freeing a
+    // long chain of arrays can't overflow the native stack
+    arraysToFree.push_back(index);
+    if (freeingArrays) return;
+
+    freeingArrays = true;
+    while (!arraysToFree.empty())
+    {
+        const unsigned array = arraysToFree.back();
+        arraysToFree.pop_back();
+
+        const unsigned blockCount = blockCountAt(array);
+        for (unsigned i = 0; i < blockCount; ++i) blockAt(array + i).nullifyPointerData();
+        arrayLength[array] = 0;
+        delete packedArrays[array];
+        packedArrays[array] = NULL;
+        release(array, blockCount);
+    }
+    freeingArrays = false;
+}
+
+bool ManagedHeap::grow(const unsigned size)
+{
+    const unsigned oldSize = Heap::size();
+    if (!Heap::grow(size)) return false;
+
+    const unsigned newSize = Heap::size();
+    arrayLength.resize(newSize, 0);
+    packedArrays.resize(newSize, NULL);
+    freeRunLength.resize(newSize, 0);
+    nextFreeRun.resize(newSize, noRun);
+    previousFreeRun.resize(newSize, noRun);
+    if (newSize > oldSize) release(oldSize, newSize - oldSize);
+    return true;
+}
+
+unsigned ManagedHeap::blockCountAt(const unsigned index) const
+{
+    if ((packedArrays[index] != NULL) || (arrayLength[index] == 0)) return 1;
     return arrayLength[index];
 }
 
-void ManagedHeap::referenceCountChangeCallback(const unsigned index)
+ManagedHeap::AllocatorStatistics ManagedHeap::allocatorStatistics() const
 {
-    unsigned refCount = referenceCountAt(index);
-    if (refCount == 0) arrayLength[index] = 0;
-    // Entire array needs to have reference count updated so that ManagedHeap::allocate works simply
-    for (unsigned i = 1; i < arrayLength[index]; ++i) setReferenceCountAt(index + i, refCount, false);
+    AllocatorStatistics statistics;
+    statistics.freeBlockCount = statistics.freeRunCount = statistics.largestFreeRun = 0;
+    for (unsigned i = 0; i < sizeClassCount; ++i)
+    {
+        statistics.freeListLengths[i] = 0;
+        for (unsigned start = freeListHeads[i]; start != noRun; start = nextFreeRun[start])
+        {
+            ++statistics.freeListLengths[i];
+            statistics.freeBlockCount += freeRunLength[start];
+            if (freeRunLength[start] > statistics.largestFreeRun) statistics.largestFreeRun = freeRunLength[start];
+        }
+        statistics.freeRunCount += statistics.freeListLengths[i];
+    }
+
+    statistics.fragmentation = statistics.freeBlockCount == 0 ? 0.0
+            : 1.0 - double(statistics.largestFreeRun) / double(statistics.freeBlockCount);
+    return statistics;
+}
+
+ManagedHeap::CollectionMode ManagedHeap::collectionMode() const
+{
+    return collectionMode_;
+}
+
+void ManagedHeap::setRootSet(RootSet * const rootSet)
+{
+    this->rootSet = rootSet;
+}
+
+void ManagedHeap::visitRoots(Block * const blocks, const unsigned count)
+{
+    if (compacting) for (unsigned i = 0; i < count; ++i) forward(blocks[i]);
+    else for (unsigned i = 0; i < count; ++i) mark(blocks[i]);
+}
+
+void ManagedHeap::collectGarbage()
+{
+    if ((collectionMode_ != CM_MARK_SWEEP) || (rootSet == NULL)) return;
+
+    timeval start, end;
+    gettimeofday(&start, NULL);
+
+    marked.assign(size(), false);
+    rootSet->visitRoots(*this, false);
+    while (!markStack.empty())
+    {
+        const unsigned index = markStack.back();
+        markStack.pop_back();
+        // Only arrays of pointers can hold pointers after the first element, but any first element can be set to one
+        const unsigned blockCount = blockCountAt(index);
+        for (unsigned i = 0; i < blockCount; ++i) mark(blockAt(index + i));
+    }
+
+    // Find all the unmarked arrays before freeing any, as a freed array is merged with any free run after it, which
+    // would stop the walk from finding the start of that run
+    for (unsigned index = 0; index < size(); )
+    {
+        if (freeRunLength[index] != 0) index += freeRunLength[index];
+        else
+        {
+            if (!marked[index]) markStack.push_back(index);
+            index += blockCountAt(index);
+        }
+    }
+
+    collectionStatistics_.arraysCollected += markStack.size();
+    for (unsigned i = 0; i < markStack.size(); ++i) freeArray(markStack[i]);
+    markStack.clear();
+
+    gettimeofday(&end, NULL);
+    const double pause = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+    ++collectionStatistics_.collectionCount;
+    collectionStatistics_.totalPauseMilliseconds += pause;
+    if (pause > collectionStatistics_.longestPauseMilliseconds) collectionStatistics_.longestPauseMilliseconds = pause;
+}
+
+const ManagedHeap::CollectionStatistics & ManagedHeap::collectionStatistics() const
+{
+    return collectionStatistics_;
+}
+
+void ManagedHeap::compact()
+{
+    if (rootSet == NULL) return;
+
+    timeval start, end;
+    gettimeofday(&start, NULL);
+
+    // Arrays keep their order, with the free space between them squeezed out
+    forwardingAddress.assign(size(), noRun);
+    unsigned destination = 0, movedBlockCount = 0;
+    for (unsigned index = 0; index < size(); )
+    {
+        if (freeRunLength[index] != 0) index += freeRunLength[index];
+        else
+        {
+            const unsigned blockCount = blockCountAt(index);
+            forwardingAddress[index] = destination;
+            if (destination != index) movedBlockCount += blockCount;
+            destination += blockCount;
+            index += blockCount;
+        }
+    }
+    if (movedBlockCount == 0) return;
+
+    // Rewrite the pointers first, while the arrays can still be found where they are
+    compacting = true;
+    rootSet->visitRoots(*this, true);
+    compacting = false;
+    for (unsigned index = 0; index < size(); ++index)
+    {
+        if (forwardingAddress[index] == noRun) continue;
+        const unsigned blockCount = blockCountAt(index);
+        for (unsigned i = 0; i < blockCount; ++i) forward(blockAt(index + i));
+    }
+
+    // An array only ever moves down, to below where the next one starts, so moving them in order overwrites nothing
+    // that is yet to be moved
+    for (unsigned index = 0; index < size(); ++index)
+    {
+        const unsigned to = forwardingAddress[index];
+        if ((to == noRun) || (to == index)) continue;
+
+        const unsigned blockCount = blockCountAt(index);
+        for (unsigned i = 0; i < blockCount; ++i) blockAt(to + i).moveFrom(blockAt(index + i));
+        arrayLength[to] = arrayLength[index];
+        packedArrays[to] = packedArrays[index];
+        setReferenceCountAt(to, referenceCountAt(index));
+        arrayLength[index] = 0;
+        packedArrays[index] = NULL;
+        setReferenceCountAt(index, 0);
+    }
+
+    // What is left after the last array are either free blocks or ones that have been moved from
+    for (unsigned i = destination; i < size(); ++i) blockAt(i).nullifyPointerData(false);
+    freeRunLength.assign(size(), 0);
+    for (unsigned i = 0; i < sizeClassCount; ++i) freeListHeads[i] = noRun;
+    if (destination < size()) insertFreeRun(destination, size() - destination);
+
+    gettimeofday(&end, NULL);
+    const double time = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+    ++compactionStatistics_.compactionCount;
+    compactionStatistics_.bytesMoved += (unsigned long)movedBlockCount * sizeof(Block);
+    compactionStatistics_.totalMilliseconds += time;
+    if (time > compactionStatistics_.longestMilliseconds) compactionStatistics_.longestMilliseconds = time;
+}
+
+const ManagedHeap::CompactionStatistics & ManagedHeap::compactionStatistics() const
+{
+    return compactionStatistics_;
+}
+
+unsigned ManagedHeap::sizeClassOf(unsigned length)
+{
+    unsigned sizeClass = 0;
+    while (length >>= 1) ++sizeClass;
+    return sizeClass;
+}
+
+unsigned ManagedHeap::reserve(const unsigned blockCount)
+{
+    // Runs in the size class of the request may be too short, so those have to be checked
+    unsigned sizeClass = sizeClassOf(blockCount), start = freeListHeads[sizeClass];
+    while ((start != noRun) && (freeRunLength[start] < blockCount)) start = nextFreeRun[start];
+    // Any run in a larger size class will do
+    while ((start == noRun) && (++sizeClass < sizeClassCount)) start = freeListHeads[sizeClass];
+    if (start == noRun) return noRun;
+
+    const unsigned length = freeRunLength[start];
+    removeFreeRun(start);
+    if (length > blockCount) insertFreeRun(start + blockCount, length - blockCount);
+    return start;
+}
+
+void ManagedHeap::release(unsigned start, unsigned length)
+{
+    // A block is only ever marked with a run length if it is at one end of a free run, so the block before this run
+    // being marked means it is the last block of a free run
+    if ((start > 0) && (freeRunLength[start - 1] != 0))
+    {
+        start -= freeRunLength[start - 1];
+        length += freeRunLength[start];
+        removeFreeRun(start);
+    }
+
+    const unsigned end = start + length;
+    if ((end < freeRunLength.size()) && (freeRunLength[end] != 0))
+    {
+        length += freeRunLength[end];
+        removeFreeRun(end);
+    }
+
+    insertFreeRun(start, length);
+}
+
+void ManagedHeap::insertFreeRun(const unsigned start, const unsigned length)
+{
+    freeRunLength[start] = freeRunLength[start + length - 1] = length;
+
+    unsigned & head = freeListHeads[sizeClassOf(length)];
+    previousFreeRun[start] = noRun;
+    nextFreeRun[start] = head;
+    if (head != noRun) previousFreeRun[head] = start;
+    head = start;
+}
+
+void ManagedHeap::removeFreeRun(const unsigned start)
+{
+    const unsigned length = freeRunLength[start];
+
+    if (previousFreeRun[start] != noRun) nextFreeRun[previousFreeRun[start]] = nextFreeRun[start];
+    else freeListHeads[sizeClassOf(length)] = nextFreeRun[start];
+    if (nextFreeRun[start] != noRun) previousFreeRun[nextFreeRun[start]] = previousFreeRun[start];
+
+    freeRunLength[start] = freeRunLength[start + length - 1] = 0;
+}
+
+void ManagedHeap::mark(const Block & block)
+{
+    if ((block.dataType() != Block::DT_POINTER) || (block.pointerHeap() != this) || (block.pointerAddress() < 0))
+        return;
+
+    const unsigned index = block.pointerAddress();
+    if (marked[index]) return;
+    marked[index] = true;
+    markStack.push_back(index);
+}
+
+void ManagedHeap::forward(Block & block)
+{
+    if ((block.dataType() != Block::DT_POINTER) || (block.pointerHeap() != this) || (block.pointerAddress() < 0))
+        return;
+
+    const unsigned address = forwardingAddress[block.pointerAddress()];
+    // Only a block that is out of use can point to an array that has been freed
+    if (address == noRun) block.nullifyPointerData(false);
+    else block.setPointerAddress(address);
 }
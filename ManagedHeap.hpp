@@ -9,26 +9,179 @@
 #define MANAGEDHEAP_HPP
 
 #include <vector>
+#include <iostream>
+#include <stdexcept>
 
 #include "Heap.hpp"
 #include "Block.hpp"
 
 // A heap with memory allocation functions and garbage collection. Accessed with pointer type Blocks rather than
-// directly, although direct access is possible
+// directly, although direct access is possible.
+// Arrays of more than one integer, real, character or boolean are packed. Their first element is a block in the heap
+// like any other, so that it can still be pointed to and used directly, but the rest are kept in separate storage
+// without type tags (booleans take a bit each), so a packed array only takes up one block of the heap. Packed arrays
+// can only hold values of the type they were allocated with. Arrays of pointers are runs of blocks.
+// Free space is kept as runs of blocks on segregated free lists (one per power of two of run length). A run is taken
+// from the smallest list that can satisfy an allocation and split, and freed runs are merged with free neighbours.
+// An array's reference count is kept at its first block alone, so copying a pointer costs the same whatever the length
+// of the array it points to.
+// Arrays are freed either by reference counting, as soon as nothing points to them, or by a mark-sweep collector that
+// traces from a RootSet when an allocation doesn't fit. Under mark-sweep, pointers into the heap are copied without
+// touching reference counts, so pointer cycles are freed too, but anything not reachable from the root set when an
+// allocation is made (a Block local to an extension function, for instance) may be collected.
+// When an allocation still doesn't fit, the heap grows if it hasn't reached its maximum size, and failing that it is
+// compacted: live arrays are slid down to the start of the heap, in order, and every pointer to them in the root set
+// and in the heap is rewritten. Pointers held anywhere else are left out of date
 
 class ManagedHeap : public Heap
 {
 public:
-    ManagedHeap(unsigned size);
+    static const unsigned sizeClassCount = 32; // Size class n holds free runs of 2^n to 2^(n + 1) - 1 blocks
+
+    struct AllocatorStatistics
+    {
+        unsigned freeBlockCount, freeRunCount, largestFreeRun;
+        double fragmentation; // The fraction of free blocks outside the largest free run
+        unsigned freeListLengths[sizeClassCount];
+    };
+
+    enum CollectionMode
+    {
+        CM_REFERENCE_COUNTING = 0,
+        CM_MARK_SWEEP
+    };
+
+    // The blocks outside the heap that can hold pointers into it
+    class RootSet
+    {
+    public:
+        virtual ~RootSet() {}
+        // Should pass every root to ManagedHeap::visitRoots. If allBlocks is true, that includes blocks that are out of
+        // use but may still hold pointers, such as those above the top of a stack
+        virtual void visitRoots(ManagedHeap & heap, bool allBlocks) = 0;
+    };
+
+    struct CollectionStatistics
+    {
+        unsigned collectionCount, arraysCollected;
+        double totalPauseMilliseconds, longestPauseMilliseconds;
+    };
+
+    struct CompactionStatistics
+    {
+        unsigned compactionCount;
+        unsigned long bytesMoved;
+        double totalMilliseconds, longestMilliseconds;
+    };
+
+    ManagedHeap(unsigned size, CollectionMode collectionMode = CM_REFERENCE_COUNTING);
+    ~ManagedHeap();
+
+    // Unlike the unmanaged heap, whose blocks compiled programs refer to directly, a managed heap forgets which blocks
+    // have been accessed once it has been flushed, so the next flush only covers what has been accessed since
+    void flush();
 
     void allocate(Block & pointerDestination, Block::DataType dataType, unsigned amount);
-    unsigned arrayLengthAt(unsigned index);
+    unsigned arrayLengthAt(unsigned index) const;
+    bool arrayIsPackedAt(unsigned index) const;
+    AllocatorStatistics allocatorStatistics() const;
+
+    CollectionMode collectionMode() const;
+    void setRootSet(RootSet * rootSet);
+    void visitRoots(Block * blocks, unsigned count);
+    // Frees every array that can't be reached from the root set. Does nothing unless collecting by mark-sweep
+    void collectGarbage();
+    const CollectionStatistics & collectionStatistics() const;
+    // Moves every array to the start of the heap, leaving all of the free space in one run
+    void compact();
+    const CompactionStatistics & compactionStatistics() const;
+
+    // Element access that works on either kind of array. index is the address of the array, and element must be less
+    // than its length
+    void getElement(unsigned index, unsigned element, Block & destination);
+    void setElement(unsigned index, unsigned element, const Block & value);
+    // Copies count elements of an array, starting at first, to destination. Unlike getElement, this only reads the heap
+    // (getElement notes which blocks have been accessed), so that several threads can read the same array at once.
+    // Throws if any of the elements are pointers, as copying them would count them
+    void getScalarElements(unsigned index, unsigned first, unsigned count, Block * destination) const;
+
+    // Sets every element of an array to value
+    void fillElements(unsigned index, const Block & value);
+    // The elements after the first of a packed array of integers or reals, which are stored one after another without
+    // type tags, so that the bulk array instructions can work on them directly. NULL unless the array is packed with
+    // that data type
+    long * packedIntegersAt(unsigned index);
+    const long * packedIntegersAt(unsigned index) const;
+    double * packedRealsAt(unsigned index);
+    const double * packedRealsAt(unsigned index) const;
+
+    // Copies the first count elements of an array in source (which may be this heap) to the start of the one at
+    // destIndex. Packed arrays of the same type are copied directly
+    void copyElements(unsigned destIndex, ManagedHeap & source, unsigned sourceIndex, unsigned count);
+    // Sets the character data of the first count elements of an array, as Block::setCharData would
+    void storeCharacters(unsigned index, const char * characters, unsigned count);
+    // Writes the character data of the elements of an array to stream, up to the first null character
+    void printCharacters(unsigned index, std::ostream & stream);
 
 protected:
-    void referenceCountChangeCallback(unsigned index);
+    bool grow(unsigned size);
 
 private:
+    friend class Heap; // To free arrays whose reference counts drop to 0
+
+    struct PackedArray;
+
+    static const unsigned noRun = ~0u;
+
     std::vector<unsigned> arrayLength; // The sizes of each array of data allocated
+    std::vector<PackedArray*> packedArrays; // The elements after the first of each packed array, NULL for the rest
+
+    std::vector<unsigned> freeRunLength; // Set at the first and last block of each free run, 0 everywhere else
+    std::vector<unsigned> nextFreeRun, previousFreeRun; // Free list links, kept at the first block of each free run
+    unsigned freeListHeads[sizeClassCount];
+
+    const CollectionMode collectionMode_;
+    RootSet * rootSet;
+    std::vector<bool> marked; // By the first block of each array
+    std::vector<unsigned> markStack; // Arrays that have been marked but whose elements haven't been yet
+    CollectionStatistics collectionStatistics_;
+
+    bool compacting; // Whether visitRoots should rewrite pointers rather than mark what they point to
+    std::vector<unsigned> forwardingAddress; // Where each array is moving to while compacting, by its first block
+    CompactionStatistics compactionStatistics_;
+
+    std::vector<unsigned> arraysToFree;
+    bool freeingArrays;
+
+    ManagedHeap(const ManagedHeap &);
+    ManagedHeap & operator =(const ManagedHeap &);
+
+    unsigned blockCountAt(unsigned index) const; // How many blocks of the heap an array takes up
+    // Also releases the pointers held in the array, which may free more arrays
+    void freeArray(unsigned index);
+
+    static unsigned sizeClassOf(unsigned length);
+    // Takes a run of blockCount blocks off the free lists. Returns noRun if there isn't one
+    unsigned reserve(unsigned blockCount);
+    // Gives a run back to the free lists, merging it with any free runs either side of it
+    void release(unsigned start, unsigned length);
+    void insertFreeRun(unsigned start, unsigned length);
+    void removeFreeRun(unsigned start);
+
+    void mark(const Block & block);
+    void forward(Block & block);
 };
 
+inline unsigned ManagedHeap::arrayLengthAt(const unsigned index) const
+{
+    if (index >= arrayLength.size())
+        throw(std::out_of_range("ManagedHeap::arrayLengthAt: Array length index out of range"));
+    return arrayLength[index];
+}
+
+inline bool ManagedHeap::arrayIsPackedAt(const unsigned index) const
+{
+    return (index < packedArrays.size()) && (packedArrays[index] != NULL);
+}
+
 #endif // MANAGEDHEAP_HPP
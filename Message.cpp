@@ -0,0 +1,121 @@
+/*
+ * Message.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "Message.hpp"
+#include "ManagedHeap.hpp"
+
+Message::Message()
+    : arrayCount(0) {}
+
+void Message::store(const Block & value)
+{
+    arrayCount = 0;
+    if ((value.dataType() != Block::DT_POINTER) || value.pointerIsNull())
+    {
+        this->value = value;
+        return;
+    }
+
+    // Arrays are copied in the order they're found, breadth first, so that deep structures don't need deep recursion
+    ArrayIndices indices;
+    std::vector<Block> pending;
+    indexOf(value, indices, pending);
+    Block element;
+    for (unsigned i = 0; i < pending.size(); ++i)
+    {
+        ManagedHeap & heap = *pending[i].pointerManagedHeap();
+        const int address = pending[i].pointerAddress();
+        const unsigned length = heap.arrayLengthAt(address);
+
+        if (arrays.size() <= i) arrays.resize(i + 1);
+        Array & array = arrays[i];
+        array.elements.resize(length);
+        array.references.clear();
+        for (unsigned j = 0; j < length; ++j)
+        {
+            heap.getElement(address, j, element);
+            if ((element.dataType() == Block::DT_POINTER) && !element.pointerIsNull())
+            {
+                array.elements[j] = Block(Integer(indexOf(element, indices, pending)));
+                array.references.push_back(j);
+            }
+            else array.elements[j] = element;
+        }
+        array.dataType = heap.arrayIsPackedAt(address) ? array.elements[0].dataType() : Block::DT_POINTER;
+
+        // Checked here, so that the sender is told, rather than the receiver finding it can't load the message
+        if ((array.dataType != Block::DT_POINTER) && (length > 1) && (array.elements[1].dataType() != array.dataType))
+            throw(std::runtime_error("Message::store: Array does not match the data type it's packed as"));
+    }
+    arrayCount = pending.size();
+}
+
+void Message::load(Block & destination, ManagedHeap & heap, std::vector<Block> & allocated)
+{
+    if (arrayCount == 0)
+    {
+        destination = value;
+        return;
+    }
+
+    // The message is used up either way. If it can't be loaded, whatever was allocated is left for the heap to collect
+    try
+    {
+        // Every array is allocated before any are filled in, as an allocation can move the arrays allocated before it
+        allocated.resize(arrayCount);
+        for (unsigned i = 0; i < arrayCount; ++i)
+            heap.allocate(allocated[i], arrays[i].dataType, arrays[i].elements.size());
+
+        for (unsigned i = 0; i < arrayCount; ++i)
+        {
+            const Array & array = arrays[i];
+            const unsigned address = allocated[i].pointerAddress();
+            unsigned nextReference = 0;
+            for (unsigned j = 0; j < array.elements.size(); ++j)
+            {
+                if ((nextReference < array.references.size()) && (array.references[nextReference] == j))
+                {
+                    heap.setElement(address, j, allocated[array.elements[j].integerData()]);
+                    ++nextReference;
+                }
+                else heap.setElement(address, j, array.elements[j]);
+            }
+        }
+    }
+    catch (...)
+    {
+        allocated.clear();
+        arrayCount = 0;
+        throw;
+    }
+
+    destination = allocated[0];
+    allocated.clear();
+    arrayCount = 0;
+}
+
+void Message::swap(Message & other)
+{
+    value.swap(other.value);
+    arrays.swap(other.arrays);
+    std::swap(arrayCount, other.arrayCount);
+}
+
+unsigned Message::indexOf(const Block & pointer, ArrayIndices & indices, std::vector<Block> & pending)
+{
+    const ManagedHeap * const heap = pointer.pointerManagedHeap();
+    if (heap == NULL)
+        throw(std::runtime_error("Message::store: Only pointers to arrays in a managed heap can be sent"));
+
+    const std::pair<ArrayIndices::iterator, bool> added
+        = indices.insert(std::make_pair(std::make_pair(heap, pointer.pointerAddress()), unsigned(pending.size())));
+    if (added.second) pending.push_back(pointer);
+    return added.first->second;
+}
@@ -0,0 +1,56 @@
+/*
+ * Message.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef MESSAGE_HPP
+#define MESSAGE_HPP
+
+#include <vector>
+#include <map>
+
+#include "Block.hpp"
+
+class ManagedHeap;
+
+// A value on its way from one heap to another. It never holds a pointer into a heap, so it can be passed between
+// threads freely.
+// Arrays can't be shared between heaps, so a value that points to one is stored as a deep copy: the array is copied out
+// of the sender's heap, along with any arrays it points to in turn (once each, so that arrays that are pointed to more
+// than once, or in a cycle, come out the same way), and they are allocated again in the receiver's heap
+
+class Message
+{
+public:
+    Message();
+
+    // Copies any arrays value points to. Throws if it points anywhere other than an array in a managed heap, or to an
+    // array that doesn't match the data type it's packed as
+    void store(const Block & value);
+    // Any arrays the value points to are allocated in heap, and kept in allocated while they are, which should be among
+    // the heap's roots so that none of them are collected before they're all linked together. Leaves allocated empty.
+    // The message is used up either way, even if this throws
+    void load(Block & destination, ManagedHeap & heap, std::vector<Block> & allocated);
+    void swap(Message & other);
+
+private:
+    typedef std::map<std::pair<const ManagedHeap*, int>, unsigned> ArrayIndices;
+
+    struct Array
+    {
+        Block::DataType dataType; // The type of the elements if the array is packed, otherwise a pointer
+        std::vector<Block> elements; // Elements that point to other arrays hold their index in the message instead
+        std::vector<unsigned> references; // Which elements those are
+    };
+
+    Block value; // Unless there are arrays, in which case the value points to the first of them
+    std::vector<Array> arrays; // Only the first arrayCount are in use. The rest are kept to be reused
+    unsigned arrayCount;
+
+    // The index of the array that pointer points to, making it the next to be copied if it hasn't been seen yet
+    unsigned indexOf(const Block & pointer, ArrayIndices & indices, std::vector<Block> & pending);
+};
+
+#endif // MESSAGE_HPP
@@ -0,0 +1,80 @@
+/*
+ * Mutex.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef MUTEX_HPP
+#define MUTEX_HPP
+
+#include <pthread.h>
+
+// Guards what little state is shared between machines (the extensions that have been loaded, for instance, or the
+// threads of a machine's scheduler). Everything else belongs to a single Machine, so different machines can be run on
+// different threads without any locking
+
+class Condition;
+
+class Mutex
+{
+public:
+    // Keeps a mutex locked for as long as it exists
+    class Lock
+    {
+    public:
+        explicit Lock(Mutex & mutex) : mutex(mutex) { pthread_mutex_lock(&mutex.mutex); }
+        ~Lock() { pthread_mutex_unlock(&mutex.mutex); }
+
+    private:
+        Mutex & mutex;
+
+        Lock(const Lock &);
+        Lock & operator =(const Lock &);
+    };
+
+    // Like Lock, but only locks the mutex if it's given one
+    class OptionalLock
+    {
+    public:
+        explicit OptionalLock(Mutex * mutex) : mutex(mutex) { if (mutex != NULL) pthread_mutex_lock(&mutex->mutex); }
+        ~OptionalLock() { if (mutex != NULL) pthread_mutex_unlock(&mutex->mutex); }
+
+    private:
+        Mutex * mutex;
+
+        OptionalLock(const OptionalLock &);
+        OptionalLock & operator =(const OptionalLock &);
+    };
+
+    Mutex() { pthread_mutex_init(&mutex, NULL); }
+    ~Mutex() { pthread_mutex_destroy(&mutex); }
+
+private:
+    friend class Condition;
+
+    pthread_mutex_t mutex;
+
+    Mutex(const Mutex &);
+    Mutex & operator =(const Mutex &);
+};
+
+// Lets threads sleep until another tells them that something guarded by a mutex has changed
+class Condition
+{
+public:
+    Condition() { pthread_cond_init(&condition, NULL); }
+    ~Condition() { pthread_cond_destroy(&condition); }
+
+    // Unlocks mutex (which must be locked) while waiting. Can wake spuriously, so should be called in a loop
+    void wait(Mutex & mutex) { pthread_cond_wait(&condition, &mutex.mutex); }
+    void signalAll() { pthread_cond_broadcast(&condition); }
+
+private:
+    pthread_cond_t condition;
+
+    Condition(const Condition &);
+    Condition & operator =(const Condition &);
+};
+
+#endif // MUTEX_HPP
@@ -26,7 +26,10 @@ const std::string opcodeStrings[] =
   "cpyf","not", "and",  "or",   "xor",   //  9
   "jmp", "je",  "jne",  "jl",   "jg",    // 10
   "jle", "jge", "call", "ret",  "extl",  // 11
-  "extc", "#" };                         // 12
+  "extc","spawn","yield","join","send",  // 12
+  "recv","tryrecv","pmap","preduce","vadd", // 13
+  "vsub","vmul","vdiv", "vfill","vdot",  // 14
+  "#" };                                 // 15
 
 const short opcodeOperandCounts[] =
 {   1,     2,     2,      2,      1,     //  1
@@ -40,7 +43,10 @@ const short opcodeOperandCounts[] =
     2,     1,     2,      2,      2,     //  9
     1,     1,     1,      1,      1,     // 10
     1,     1,     1,      1,      1,     // 11
-    1,     -1                            // 12
+    1,     1,     0,      1,      2,     // 12
+    1,     1,     2,      2,      2,     // 13
+    2,     2,     2,      2,      2,     // 14
+    -1                                   // 15
 };
 
 enum Id
@@ -100,7 +106,32 @@ enum Id
     CALL,    // A function call to label A. Pushes the frame stack pointer and jumps to A
     RET,     // Returns from the function call, returning A by pushing it to the top of the stack
     EXTL,    // Loads an extension library, whose name is given by label A
-    EXTC     // Calls an extension library function of name A
+    EXTC,    // Calls an extension library function of name A
+    SPAWN,   // Starts a thread running function A, called with the value at the top of the stack. Pushes its id
+    YIELD,   // Lets the next thread that is ready run, coming back to this one after it
+    JOIN,    // Waits for the thread whose id is A to finish, then replaces A with the value it returned
+    SEND,    // Sends a copy of B on the channel whose id is A, waiting for there to be room first if need be
+    RECV,    // Waits for a value to be sent on the channel whose id is A, and puts it in the managed out register
+    TRYRECV, // As RECV if a value has been sent, setting the equal flag. Otherwise sets the not equal flag
+    PMAP,    // Replaces each element of the array pointed to by A with what function B returns when called with it
+    PREDUCE, // Combines the elements of the array pointed to by A with reduction B, into the managed out register
+    VADD,    // Adds B, or the matching element of the array B points to, to each element of the array pointed to by A
+    VSUB,    // As VADD, but takes away
+    VMUL,    // As VADD, but multiplies
+    VDIV,    // As VADD, but divides
+    VFILL,   // Sets every element of the array pointed to by A to B
+    VDOT     // Puts the dot product of the arrays pointed to by A and B into the managed out register
+};
+
+// The ways preduce can combine elements, given as %add, %mul, %min, %max, %and or %or
+enum Reduction
+{
+    R_ADD = 0,
+    R_MULTIPLY,
+    R_MINIMUM,
+    R_MAXIMUM,
+    R_AND,
+    R_OR
 };
 
 int getOpcodeId(const std::string & opcode);
@@ -0,0 +1,319 @@
+/*
+ * ParallelArrays.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+
+#include "ParallelArrays.hpp"
+#include "ArrayKernels.hpp"
+#include "Machine.hpp"
+#include "Program.hpp"
+
+const unsigned ParallelArrays::minimumParallelMapLength, ParallelArrays::minimumParallelReduceLength;
+
+// Parts are handed out to whichever worker is free, so splitting a map more finely than one part per worker evens
+// things out when some elements take longer than others
+const unsigned mapPartsPerWorker = 4;
+
+struct ParallelArrays::Worker
+{
+    Machine machine;
+    Interpreter interpreter;
+    std::ostringstream output; // The machine's output, for the part of the array being mapped
+
+    explicit Worker(const ParallelArrays & arrays)
+        : machine(0, 0, 0, arrays.collectionMode),
+          interpreter(machine, arrays.program, arrays.options.size(),
+                      arrays.options.empty() ? NULL : &arrays.options[0])
+    {
+        machine.setOutput(output);
+        interpreter.setParallelWorkerCount(1); // The other threads are already busy
+    }
+
+    // Replaces value with what the function returns when called with it
+    void call(const unsigned functionIndex, Block & value)
+    {
+        const std::streamoff callStart = output.tellp();
+        if (!interpreter.callFunction(functionIndex, value, value))
+        {
+            // Reported after whatever this call output, as "Error on line n", then the error, then that execution
+            // was halted, which it isn't yet. Only the report is kept, as what the rest of the part output is dropped
+            std::string error = output.str().substr(callStart);
+            output.str("");
+            machine.flush();
+            error.erase(0, std::min(error.rfind("Error on line"), error.size()));
+            error.erase(std::min(error.rfind("Execution halted"), error.size()));
+            while (!error.empty() && (error[error.size() - 1] == '\n')) error.erase(error.size() - 1);
+            const size_t lineEnd = error.find('\n');
+            if (lineEnd != std::string::npos) error.replace(lineEnd, 1, ": ");
+            throw(std::runtime_error("ParallelArrays::map: " + error));
+        }
+        if (value.dataType() == Block::DT_POINTER)
+        {
+            value = Block();
+            output.str("");
+            machine.flush();
+            throw(std::runtime_error("ParallelArrays::map: Function returned a pointer (expected a scalar)"));
+        }
+    }
+};
+
+class ParallelArrays::MapTask : public WorkerPool::Task
+{
+public:
+    MapTask(ParallelArrays & arrays, const ManagedHeap & heap, const unsigned address, const unsigned functionIndex,
+            const unsigned partLength, const unsigned partCount)
+        : arrays(arrays), heap(heap), address(address), functionIndex(functionIndex), partLength(partLength),
+          partOutputs(partCount) {}
+
+    void runPart(const unsigned worker, const unsigned part)
+    {
+        Worker & self = arrays.worker(worker);
+        std::vector<Block> & values = arrays.values;
+        const unsigned begin = part * partLength, end = std::min<unsigned long>(begin + partLength, values.size());
+        heap.getScalarElements(address, begin, end - begin, &values[begin]);
+        for (unsigned i = begin; i < end; ++i) self.call(functionIndex, values[i]);
+        partOutputs[part] = self.output.str();
+        self.output.str("");
+    }
+
+    // What the function output, in the order of the elements it was called with
+    void writeOutput(std::ostream & output) const
+    {
+        for (unsigned i = 0; i < partOutputs.size(); ++i) output << partOutputs[i];
+    }
+
+private:
+    ParallelArrays & arrays;
+    const ManagedHeap & heap;
+    const unsigned address, functionIndex, partLength;
+    std::vector<std::string> partOutputs;
+};
+
+template <typename T, T (Block::*data)() const>
+T combined(T total, const Block * const elements, const unsigned count, const Opcodes::Reduction reduction)
+{
+    switch (reduction)
+    {
+    case Opcodes::R_ADD:      for (unsigned i = 0; i < count; ++i) total += (elements[i].*data)(); break;
+    case Opcodes::R_MULTIPLY: for (unsigned i = 0; i < count; ++i) total *= (elements[i].*data)(); break;
+    case Opcodes::R_MINIMUM:
+        for (unsigned i = 0; i < count; ++i) total = std::min(total, (elements[i].*data)());
+        break;
+    default:
+        for (unsigned i = 0; i < count; ++i) total = std::max(total, (elements[i].*data)());
+        break;
+    }
+    return total;
+}
+
+// Combines count elements into total, which they must all be the same data type as
+void combine(Block & total, const Block * const elements, const unsigned count, const Opcodes::Reduction reduction)
+{
+    const Block::DataType dataType = total.dataType();
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (elements[i].dataType() != dataType)
+            throw(std::runtime_error("ParallelArrays::reduce: Elements must all be of the same data type"));
+    }
+
+    switch (dataType)
+    {
+    case Block::DT_INTEGER:
+        total.setToInteger(combined<long, &Block::integerData>(total.integerData(), elements, count, reduction));
+        break;
+    case Block::DT_REAL:
+        total.setToReal(combined<double, &Block::realData>(total.realData(), elements, count, reduction));
+        break;
+    default:
+    {
+        bool value = total.booleanData();
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (reduction == Opcodes::R_AND) value = value && elements[i].booleanData();
+            else value = value || elements[i].booleanData();
+        }
+        total.setToBoolean(value);
+    }
+    }
+}
+
+// Each part is reduced on its own, then the parts are combined in order
+class ParallelArrays::ReduceTask : public WorkerPool::Task
+{
+public:
+    ReduceTask(const ManagedHeap & heap, const unsigned address, const unsigned length,
+               const Opcodes::Reduction reduction, const Block::DataType dataType, const unsigned partLength,
+               const unsigned partCount)
+        : heap(heap), address(address), length(length), reduction(reduction), dataType(dataType),
+          partLength(partLength), partTotals(partCount) {}
+
+    void runPart(unsigned, const unsigned part)
+    {
+        const unsigned begin = part * partLength, end = std::min<unsigned long>(begin + partLength, length);
+        Block & total = partTotals[part];
+        heap.getScalarElements(address, begin, 1, &total);
+        if (total.dataType() != dataType)
+            throw(std::runtime_error("ParallelArrays::reduce: Elements must all be of the same data type"));
+
+        // Packed integers and reals are summed, or searched for their minimum or maximum, where they're stored. The
+        // packed elements start from the array's second
+        if (reduction != Opcodes::R_MULTIPLY)
+        {
+            const long * const integers = heap.packedIntegersAt(address);
+            const double * const reals = heap.packedRealsAt(address);
+            if ((integers != NULL) && (dataType == Block::DT_INTEGER))
+            {
+                total.setToInteger(ArrayKernels::reduce(reduction, total.integerData(), integers + begin,
+                                                        end - begin - 1));
+                return;
+            }
+            if ((reals != NULL) && (dataType == Block::DT_REAL))
+            {
+                total.setToReal(ArrayKernels::reduce(reduction, total.realData(), reals + begin, end - begin - 1));
+                return;
+            }
+        }
+
+        // Otherwise they're read in batches, so that the data type of the array and the reduction are only looked at
+        // once per batch
+        Block elements[batchLength];
+        for (unsigned i = begin + 1; i < end; i += batchLength)
+        {
+            const unsigned count = std::min(end - i, batchLength);
+            heap.getScalarElements(address, i, count, elements);
+            combine(total, elements, count, reduction);
+        }
+    }
+
+    void total(Block & destination) const
+    {
+        Block result = partTotals[0];
+        if (partTotals.size() > 1) combine(result, &partTotals[1], partTotals.size() - 1, reduction);
+        destination = result;
+    }
+
+private:
+    const ManagedHeap & heap;
+    const unsigned address, length;
+    const Opcodes::Reduction reduction;
+    const Block::DataType dataType;
+    const unsigned partLength;
+    std::vector<Block> partTotals;
+
+    static const unsigned batchLength = 256;
+};
+
+const unsigned ParallelArrays::ReduceTask::batchLength;
+
+ParallelArrays::ParallelArrays(const Program & program, const ManagedHeap::CollectionMode collectionMode,
+                               const unsigned optionCount, const Interpreter::Option * const options)
+    : program(program), collectionMode(collectionMode), options(options, options + optionCount),
+      workerCount_(WorkerPool::processorCount()), pool(NULL), workers(workerCount_, NULL) {}
+
+ParallelArrays::~ParallelArrays()
+{
+    delete pool;
+    for (unsigned i = 0; i < workers.size(); ++i) delete workers[i];
+}
+
+void ParallelArrays::setWorkerCount(const unsigned workerCount)
+{
+    delete pool;
+    pool = NULL;
+    workerCount_ = workerCount == 0 ? WorkerPool::processorCount() : workerCount;
+    for (unsigned i = workerCount_; i < workers.size(); ++i) delete workers[i];
+    workers.resize(workerCount_, NULL);
+}
+
+unsigned ParallelArrays::workerCount() const
+{
+    return workerCount_;
+}
+
+void ParallelArrays::map(ManagedHeap & heap, const unsigned address, const unsigned functionIndex,
+                         std::ostream & output)
+{
+    const unsigned length = heap.arrayLengthAt(address);
+    if (length == 0) return;
+
+    const unsigned partCount = (length < minimumParallelMapLength) ? 1 : workerCount_ * mapPartsPerWorker,
+                   partLength = (length + partCount - 1) / partCount;
+    values.resize(length);
+    MapTask task(*this, heap, address, functionIndex, partLength, (length + partLength - 1) / partLength);
+    run(task, (length + partLength - 1) / partLength);
+
+    // A packed array can only take results of its own data type, which is checked before any are written
+    if (heap.arrayIsPackedAt(address))
+    {
+        Block first;
+        heap.getScalarElements(address, 0, 1, &first);
+        for (unsigned i = 0; i < length; ++i)
+        {
+            if (values[i].dataType() != first.dataType())
+                throw(std::runtime_error("ParallelArrays::map: Function returned a different data type to the "
+                                         "elements of a packed array"));
+        }
+    }
+    for (unsigned i = 0; i < length; ++i) heap.setElement(address, i, values[i]);
+    values.clear();
+    task.writeOutput(output);
+}
+
+void ParallelArrays::reduce(const ManagedHeap & heap, const unsigned address, const Opcodes::Reduction reduction,
+                            Block & destination)
+{
+    const unsigned length = heap.arrayLengthAt(address);
+    const bool logical = (reduction == Opcodes::R_AND) || (reduction == Opcodes::R_OR);
+    if (length == 0)
+    {
+        switch (reduction)
+        {
+        case Opcodes::R_ADD:      destination.setToInteger(0); return;
+        case Opcodes::R_MULTIPLY: destination.setToInteger(1); return;
+        case Opcodes::R_AND:      destination.setToBoolean(true); return;
+        case Opcodes::R_OR:       destination.setToBoolean(false); return;
+        default: throw(std::runtime_error("ParallelArrays::reduce: An empty array has no minimum or maximum"));
+        }
+    }
+
+    Block first;
+    heap.getScalarElements(address, 0, 1, &first);
+    const Block::DataType dataType = first.dataType();
+    if (logical && (dataType != Block::DT_BOOLEAN))
+        throw(std::runtime_error("ParallelArrays::reduce: Elements must be booleans for and and or"));
+    if (!logical && (dataType != Block::DT_INTEGER) && (dataType != Block::DT_REAL))
+    {
+        throw(std::runtime_error("ParallelArrays::reduce: Elements must be integers or reals for add, mul, min "
+                                 "and max"));
+    }
+
+    const unsigned partCount = (length < minimumParallelReduceLength) ? 1 : workerCount_,
+                   partLength = (length + partCount - 1) / partCount;
+    ReduceTask task(heap, address, length, reduction, dataType, partLength, (length + partLength - 1) / partLength);
+    run(task, (length + partLength - 1) / partLength);
+    task.total(destination);
+}
+
+void ParallelArrays::run(WorkerPool::Task & task, const unsigned partCount)
+{
+    if ((partCount == 1) || (workerCount_ == 1))
+    {
+        for (unsigned i = 0; i < partCount; ++i) task.runPart(0, i);
+        return;
+    }
+
+    if (pool == NULL) pool = new WorkerPool(workerCount_);
+    pool->run(task, partCount);
+}
+
+ParallelArrays::Worker & ParallelArrays::worker(const unsigned index)
+{
+    if (workers[index] == NULL) workers[index] = new Worker(*this);
+    return *workers[index];
+}
@@ -0,0 +1,75 @@
+/*
+ * ParallelArrays.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef PARALLELARRAYS_HPP
+#define PARALLELARRAYS_HPP
+
+#include <vector>
+#include <ostream>
+
+#include "Interpreter.hpp"
+#include "ManagedHeap.hpp"
+#include "Opcodes.hpp"
+#include "WorkerPool.hpp"
+
+class Program;
+
+// Carries out pmap and preduce for an interpreter. Arrays long enough to be worth it are split into parts that are
+// shared out between a pool of threads, and shorter ones are done on the calling thread alone.
+// The function pmap calls is always run on a machine of its own, whichever thread it is on, so it only sees the
+// element it's called with: not the registers, stack or heaps of the machine running pmap. Only arrays of scalars can
+// be mapped or reduced, and a mapped function has to return a scalar, so that nothing points into another machine's
+// heap. The array is only written to once every element has been mapped, so it's left as it was if any call fails.
+// Likewise, whatever the function outputs is held back until then, and then written in the order of the elements
+
+class ParallelArrays
+{
+public:
+    // Arrays shorter than these are worked on by the calling thread alone. Reducing an element costs far less than
+    // calling a function with it, so it takes a much longer array for reducing to be worth splitting
+    static const unsigned minimumParallelMapLength = 1024, minimumParallelReduceLength = 1u << 16;
+
+    // Functions are called on machines bound to program, with the given options (of which only O_DISABLE_JIT has any
+    // effect). Worker machines and threads are only made when they're first needed
+    ParallelArrays(const Program & program, ManagedHeap::CollectionMode collectionMode, unsigned optionCount,
+                   const Interpreter::Option * options);
+    ~ParallelArrays();
+
+    // Including the calling thread, or 0 (the default) for one per processor
+    void setWorkerCount(unsigned workerCount);
+    unsigned workerCount() const;
+
+    // Replaces each element of the array at address with what the function at functionIndex returns when called with
+    // it, writing what the calls output to output
+    void map(ManagedHeap & heap, unsigned address, unsigned functionIndex, std::ostream & output);
+    // Combines the elements of the array at address into destination. Adding, multiplying, and finding the minimum or
+    // maximum take integers or reals, and and and or take booleans. All of the elements have to be the same type.
+    // Packed integers and reals are added up, or searched, by the array kernels (see ArrayKernels)
+    void reduce(const ManagedHeap & heap, unsigned address, Opcodes::Reduction reduction, Block & destination);
+
+private:
+    struct Worker;
+    class MapTask;
+    class ReduceTask;
+
+    const Program & program;
+    const ManagedHeap::CollectionMode collectionMode;
+    std::vector<Interpreter::Option> options;
+    unsigned workerCount_;
+    WorkerPool * pool; // Started the first time an array is long enough to be split
+    std::vector<Worker*> workers; // Indexed as the pool's workers are. Each is made by the thread that first uses it
+    std::vector<Block> values; // The elements of the array being mapped, which become the results
+
+    // Runs the parts of task on the pool, or on the calling thread if there's only one
+    void run(WorkerPool::Task & task, unsigned partCount);
+    Worker & worker(unsigned index);
+
+    ParallelArrays(const ParallelArrays &);
+    ParallelArrays & operator =(const ParallelArrays &);
+};
+
+#endif // PARALLELARRAYS_HPP
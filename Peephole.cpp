@@ -0,0 +1,149 @@
+/*
+ * Peephole.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <vector>
+
+#include "Peephole.hpp"
+#include "Bytecode.hpp"
+
+inline bool isConditionalJump(const unsigned char opcode)
+{
+    return (opcode >= Opcodes::JE) && (opcode <= Opcodes::JGE);
+}
+
+// Instructions that reset every comparison flag
+inline bool setsFlags(const unsigned char opcode)
+{
+    return (opcode == Opcodes::CMP) || (opcode == Opcodes::CMPT) || (opcode == Opcodes::IST)
+           || (opcode == Opcodes::TRYRECV);
+}
+
+// Works out, for each instruction, whether the comparison flags might be read before they are next set if execution
+// were to start at that instruction
+std::vector<bool> flagsLiveAt(const Bytecode & bytecode)
+{
+    const std::vector<CompiledInstruction> & code = bytecode.code;
+    std::vector<bool> live(code.size(), false);
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (unsigned i = code.size(); i-- > 0;)
+        {
+            const CompiledInstruction & instruction = code[i];
+            bool value;
+            switch (instruction.opcode)
+            {
+            case CompiledInstruction::P_HALT:
+            case CompiledInstruction::P_INVALID:
+                value = false;
+                break;
+            case Opcodes::CPYF:
+                value = true;
+                break;
+            case Opcodes::JMP:
+            case Opcodes::CALL:
+                value = live[instruction.operand1.target];
+                break;
+            // Where these go to isn't known until they're executed
+            case Opcodes::RET:
+            case Opcodes::EXTC:
+                value = true;
+                break;
+            default:
+                if (isConditionalJump(instruction.opcode)) value = true;
+                else if (setsFlags(instruction.opcode)) value = false;
+                else value = live[i + 1];
+            }
+
+            if (value != live[i])
+            {
+                live[i] = value;
+                changed = true;
+            }
+        }
+    }
+
+    return live;
+}
+
+// Whether an instruction can be part of a superinstruction. Those whose handler decides where execution goes next can't
+inline bool fusable(const CompiledInstruction & instruction)
+{
+    return (instruction.handler != NULL) && (instruction.opcode != Opcodes::RET)
+           && (instruction.opcode != Opcodes::JOIN) && (instruction.opcode != Opcodes::SEND)
+           && (instruction.opcode != Opcodes::RECV);
+}
+
+unsigned Peephole::fuseSuperinstructions(Bytecode & bytecode, const void * const * const dispatchTable,
+                                         std::ostream * const log)
+{
+    std::vector<CompiledInstruction> & code = bytecode.code;
+    if (code.size() < 2) return 0;
+
+    const std::vector<bool> flagsLive = flagsLiveAt(bytecode);
+    std::vector<bool> onlyTestedFlagSet(code.size(), false);
+    unsigned fusionCount = 0;
+
+    // Go backwards so that whether the next instruction starts a superinstruction is already known
+    for (unsigned i = code.size() - 1; i-- > 0;)
+    {
+        CompiledInstruction & first = code[i];
+        const CompiledInstruction & second = code[i + 1];
+        if (!fusable(first)) continue;
+
+        switch (second.opcode)
+        {
+        case Opcodes::JMP:  first.dispatchOpcode = CompiledInstruction::S_HANDLER_JUMP; break;
+        case Opcodes::CALL: first.dispatchOpcode = CompiledInstruction::S_HANDLER_CALL; break;
+        case Opcodes::RET:  first.dispatchOpcode = CompiledInstruction::S_HANDLER_RETURN; break;
+        default:
+            if (isConditionalJump(second.opcode))
+            {
+                if (!setsFlags(first.opcode)) break;
+
+                // The conditional jumps are in the same order as the flags they test
+                const CFR::ComparisonFlagId flagId = CFR::ComparisonFlagId(second.opcode - Opcodes::JE);
+                first.dispatchOpcode = CompiledInstruction::S_COMPARE_JE + flagId;
+
+                // If nothing reads the flags after the jump, the comparison only has to work out the flag it tests
+                if (!flagsLive[i + 2] && !flagsLive[second.operand1.target])
+                {
+                    const Handlers::Handler handler = Handlers::selectCompareForFlag(first, flagId);
+                    if (handler != NULL)
+                    {
+                        first.handler = handler;
+                        onlyTestedFlagSet[i] = true;
+                    }
+                }
+            }
+            // Instructions that start a superinstruction of their own are left alone so that it isn't split up
+            else if (fusable(second) && (second.dispatchOpcode == second.opcode))
+                first.dispatchOpcode = CompiledInstruction::S_HANDLER_PAIR;
+        }
+
+        if (first.dispatchOpcode == first.opcode) continue;
+
+        if (dispatchTable != NULL) first.target = dispatchTable[first.dispatchOpcode];
+        ++fusionCount;
+    }
+
+    if (log != NULL)
+    {
+        for (unsigned i = 0; i + 1 < code.size(); ++i)
+        {
+            if (code[i].dispatchOpcode == code[i].opcode) continue;
+            *log << "Line " << code[i].line + 1 << ": " << Opcodes::opcodeStrings[code[i].opcode] << " + "
+                 << Opcodes::opcodeStrings[code[i + 1].opcode]
+                 << (onlyTestedFlagSet[i] ? " (only the tested flag is set)" : "") << std::endl;
+        }
+        *log << fusionCount << " superinstruction(s) fused" << std::endl;
+    }
+
+    return fusionCount;
+}
@@ -0,0 +1,28 @@
+/*
+ * Peephole.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef PEEPHOLE_HPP
+#define PEEPHOLE_HPP
+
+#include <iostream>
+
+struct Bytecode;
+
+// Optimisations done on compiled Bytecode by looking at neighbouring instructions
+
+namespace Peephole
+{
+
+// Turns common pairs of instructions (e.g. cmp followed by a conditional jump) into superinstructions, which are
+// executed with one dispatch. Only the dispatch opcode and target of the first instruction of a pair are changed, so
+// the second instruction can still be jumped to on its own. If log is not NULL, each fusion is written to it. Returns
+// the number of fusions made
+unsigned fuseSuperinstructions(Bytecode & bytecode, const void * const * dispatchTable, std::ostream * log = NULL);
+
+}
+
+#endif // PEEPHOLE_HPP
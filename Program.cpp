@@ -0,0 +1,140 @@
+/*
+ * Program.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "Program.hpp"
+#include "Lexer.hpp"
+#include "Compiler.hpp"
+#include "Peephole.hpp"
+#include "Machine.hpp"
+
+const unsigned Program::instructionReservation;
+
+Program::Program()
+    : compiled_(false)
+{
+    instructions.reserve(instructionReservation);
+}
+
+Program::Program(const char * const fileName)
+    : compiled_(false)
+{
+    if ((fileName == NULL) || (strlen(fileName) == 0))
+        throw(std::runtime_error("Program::Program: Invalid file name given"));
+
+    std::fstream file(fileName, std::ios_base::in);
+    if (!file.is_open()) throw(std::runtime_error("Program::Program: File could not be opened"));
+
+    instructions.reserve(instructionReservation);
+    unsigned line = 0;
+    std::string buffer;
+    buffer.reserve(128);
+    do
+    {
+        getline(file, buffer);
+        try { addLine(buffer, line); }
+        catch (const std::exception & e) { throw(Compiler::Error(e.what(), line)); }
+        ++line;
+    } while (!file.eof());
+
+    compile();
+}
+
+void Program::addLine(const std::string & line, const unsigned lineNumber)
+{
+    if (compiled_) throw(std::runtime_error("Program::addLine: Program has already been compiled"));
+
+    const Instruction instruction = Lexer::tokenize(line.substr(0, line.find_first_of(';')));
+    if (!instruction.label.isNull() && (strlen(instruction.label.labelData) > 0)
+        && !labels_.add(instruction.label.labelData, lineNumber))
+    {
+        std::stringstream message;
+        message << "Program::addLine: Label '" << instruction.label.labelData << "' is already defined on line "
+                << labels_.find(instruction.label.labelData)->line + 1;
+        throw(std::runtime_error(message.str()));
+    }
+
+    // Even though the Instruction might contain nothing, we still need to add it in order to give helpful error
+    // messages (i.e to show line number)
+    if (instructions.size() <= lineNumber) instructions.resize(lineNumber + 1);
+    instructions[lineNumber] = instruction;
+}
+
+void Program::compile(std::ostream * const superinstructionLog)
+{
+    if (compiled_) return;
+
+    // Dispatch targets depend on the interpreter, so they are only set when the code is bound
+    Compiler::compile(instructions, *this, NULL, bytecode_);
+    Peephole::fuseSuperinstructions(bytecode_, NULL, superinstructionLog);
+
+    std::vector<Instruction>().swap(instructions);
+    compiled_ = true;
+}
+
+bool Program::compiled() const
+{
+    return compiled_;
+}
+
+const Program::LabelList & Program::labels() const
+{
+    return labels_.labels();
+}
+
+unsigned Program::labelLineNumber(const char * const labelName) const
+{
+    const Label * const label = labels_.find(labelName);
+    if (label == NULL)
+        throw(std::runtime_error("Program::labelLineNumber: Label '" + std::string(labelName) + "' could not be found"));
+    return label->line;
+}
+
+unsigned Program::entryPoint() const
+{
+    return bytecode_.codeIndexAtLine(labelLineNumber("main"));
+}
+
+const Bytecode & Program::bytecode() const
+{
+    return bytecode_;
+}
+
+void bindOperand(Machine & machine, Operand & operand)
+{
+    if (operand.kind != Operand::K_STATIC) return;
+    switch (operand.location)
+    {
+    case Token::primaryRegisterLocation:    operand.block = &machine.primaryRegister(); break;
+    case Token::managedOutRegisterLocation: operand.block = &machine.managedOutRegister(); break;
+    default:                                operand.block = &machine.unmanagedHeap().blockAt(operand.location);
+    }
+}
+
+void Program::bind(Machine & machine, const void * const * const dispatchTable, Bytecode & destination) const
+{
+    if (!compiled_) throw(std::runtime_error("Program::bind: Program has not been compiled"));
+
+    destination.clear();
+    destination.code = bytecode_.code;
+    destination.strings = bytecode_.strings;
+    for (unsigned i = 0; i < destination.code.size(); ++i)
+    {
+        CompiledInstruction & instruction = destination.code[i];
+        try
+        {
+            bindOperand(machine, instruction.operand1);
+            bindOperand(machine, instruction.operand2);
+        }
+        catch (const std::exception & e) { throw(Compiler::Error(e.what(), instruction.line)); }
+        if (dispatchTable != NULL) instruction.target = dispatchTable[instruction.dispatchOpcode];
+    }
+}
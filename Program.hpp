@@ -0,0 +1,65 @@
+/*
+ * Program.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef PROGRAM_HPP
+#define PROGRAM_HPP
+
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "Instruction.hpp"
+#include "LabelTable.hpp"
+#include "Bytecode.hpp"
+
+class Machine;
+
+// A program's code, labels and constants, compiled to bytecode that isn't tied to any Machine. Operands that refer to
+// the registers or the unmanaged heap are kept as locations, and each interpreter that runs the program binds its own
+// copy of the code to its machine (see bind). That copy is what gets quickened and has its extension functions looked
+// up, so once a program has been compiled it is never changed, and can be run by any number of interpreters at once
+
+class Program
+{
+public:
+    typedef LabelTable::LabelList LabelList;
+
+    Program();
+    // Loads and compiles a file. Throws Compiler::Error for the first line that can't be loaded
+    explicit Program(const char * fileName);
+
+    // Adds a line of source, where lineNumber counts from 0. Anything after a ';' is a comment. Throws if the line
+    // can't be tokenized, or defines a label that already exists
+    void addLine(const std::string & line, unsigned lineNumber);
+    // Throws Compiler::Error. If superinstructionLog is not NULL, the superinstructions fused are listed in it
+    void compile(std::ostream * superinstructionLog = NULL);
+    bool compiled() const;
+
+    const LabelList & labels() const;
+    unsigned labelLineNumber(const char * labelName) const;
+    // The index into the code that execution starts from (at the main label)
+    unsigned entryPoint() const;
+
+    const Bytecode & bytecode() const;
+    // Copies the code into destination, binding its static operands to machine's blocks and setting each
+    // instruction's dispatch target from dispatchTable (which may be NULL, as for Compiler::compile)
+    void bind(Machine & machine, const void * const * dispatchTable, Bytecode & destination) const;
+
+private:
+    static const unsigned instructionReservation = 10000;
+
+    std::vector<Instruction> instructions; // Only kept until the program is compiled
+    LabelTable labels_;
+    Bytecode bytecode_;
+    bool compiled_;
+
+    // Compiled operands point into the constant pool, so a copy would refer to the original's constants
+    Program(const Program &);
+    Program & operator =(const Program &);
+};
+
+#endif // PROGRAM_HPP
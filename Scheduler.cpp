@@ -0,0 +1,187 @@
+/*
+ * Scheduler.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+
+#include "Scheduler.hpp"
+#include "Channel.hpp"
+
+Scheduler::Carrier::Carrier()
+    : machine(NULL), interpreter(NULL), parked(true), idle(true), threadCount(0), pending(0) {}
+
+Scheduler::Scheduler(Machine & machine, const Program & program, const unsigned optionCount,
+                     const Interpreter::Option * const options)
+    : machine(machine), program(program), options(options, options + optionCount), carrierCount_(1),
+      stopRequested(0), failed(false), destroying(false), runningCarriers(0), busyCarriers(0), exitAddress(0) {}
+
+Scheduler::~Scheduler()
+{
+    {
+        Mutex::Lock lock(mutex);
+        destroying = true;
+        for (unsigned i = 1; i < carriers.size(); ++i) carriers[i]->condition.signalAll();
+    }
+    for (unsigned i = 1; i < carriers.size(); ++i) pthread_join(carriers[i]->thread, NULL);
+
+    machine.disconnectChannels();
+    for (unsigned i = 1; i < carriers.size(); ++i) carriers[i]->machine->disconnectChannels();
+    clear();
+    for (unsigned i = 0; i < carriers.size(); ++i)
+    {
+        delete carriers[i]->interpreter;
+        if (i > 0) delete carriers[i]->machine;
+        delete carriers[i];
+    }
+}
+
+void Scheduler::setCarrierCount(const unsigned carrierCount)
+{
+    Mutex::Lock lock(mutex);
+    carrierCount_ = carrierCount == 0 ? 1 : carrierCount;
+}
+
+unsigned Scheduler::carrierCount() const
+{
+    return carrierCount_;
+}
+
+bool Scheduler::start()
+{
+    unsigned target;
+    {
+        Mutex::Lock lock(mutex);
+        target = carrierCount_;
+        if (target == 1) return false;
+        if (carriers.empty())
+        {
+            Carrier * const owner = new Carrier;
+            owner->machine = &machine;
+            owner->parked = owner->idle = false;
+            carriers.push_back(owner);
+        }
+    }
+
+    for (unsigned index = carriers.size(); index < target; ++index)
+    {
+        Carrier * const carrier = new Carrier;
+        carrier->machine = new Machine(machine, *this, index);
+        carrier->interpreter = new Interpreter(*carrier->machine, program, options.size(),
+                                               options.empty() ? NULL : &options[0]);
+        carrier->interpreter->setParallelWorkerCount(1);
+        {
+            Mutex::Lock lock(mutex);
+            carriers.push_back(carrier);
+        }
+        if (pthread_create(&carrier->thread, NULL, runCarrier, carrier) != 0)
+        {
+            // Threads are simply spread over the carriers there are
+            {
+                Mutex::Lock lock(mutex);
+                carriers.pop_back();
+            }
+            delete carrier->interpreter;
+            delete carrier->machine;
+            delete carrier;
+            break;
+        }
+    }
+    return true;
+}
+
+void * Scheduler::runCarrier(void * const carrierPointer)
+{
+    Carrier & carrier = *static_cast<Carrier*>(carrierPointer);
+    while (carrier.machine->carry()) carrier.interpreter->resume();
+    return NULL;
+}
+
+unsigned Scheduler::addThread(ThreadRecord * const record)
+{
+    unsigned id = 0;
+    while ((id < threads.size()) && (threads[id] != NULL)) ++id;
+    if (id == threads.size()) threads.push_back(record);
+    else threads[id] = record;
+    record->id = id;
+    return id;
+}
+
+void Scheduler::wake(const unsigned carrier, const unsigned localId)
+{
+    carriers[carrier]->wakes.push_back(localId);
+    deliver(*carriers[carrier]);
+}
+
+void Scheduler::deliver(Carrier & carrier)
+{
+    if (stopRequested) return;
+    __atomic_store_n(&carrier.pending, 1, __ATOMIC_RELEASE);
+    if (carrier.parked)
+    {
+        carrier.parked = false;
+        ++runningCarriers;
+    }
+    if (carrier.idle)
+    {
+        carrier.idle = false;
+        ++busyCarriers;
+    }
+    carrier.condition.signalAll();
+}
+
+bool Scheduler::park(Carrier & carrier)
+{
+    if (carrier.pending) return !stopRequested;
+    if (stopRequested) return false;
+
+    carrier.parked = true;
+    if (--runningCarriers == 0)
+    {
+        carrier.parked = false;
+        ++runningCarriers;
+        throw(std::runtime_error("Machine::runNextThread: Every thread is waiting for another or a channel"));
+    }
+    while (carrier.parked && !stopRequested) carrier.condition.wait(mutex);
+    if (carrier.parked)
+    {
+        carrier.parked = false;
+        ++runningCarriers;
+    }
+    return !stopRequested;
+}
+
+void Scheduler::requestStop()
+{
+    __atomic_store_n(&stopRequested, 1, __ATOMIC_RELEASE);
+    unparkAll();
+}
+
+void Scheduler::unparkAll()
+{
+    for (unsigned i = 0; i < carriers.size(); ++i) carriers[i]->condition.signalAll();
+}
+
+void Scheduler::clear()
+{
+    for (unsigned i = 0; i < threads.size(); ++i) delete threads[i];
+    threads.clear();
+    for (unsigned i = 0; i < carriers.size(); ++i)
+    {
+        Carrier & carrier = *carriers[i];
+        carrier.starts.clear();
+        carrier.wakes.clear();
+        carrier.pending = 0;
+        carrier.threadCount = 0;
+        if (i > 0) carrier.parked = carrier.idle = true;
+    }
+    for (std::map<unsigned, Machine::SharedChannel>::iterator i = channels.begin(); i != channels.end(); ++i)
+    {
+        if (i->second.owned) delete i->second.channel;
+    }
+    channels.clear();
+    stopRequested = 0;
+    runningCarriers = 0;
+}
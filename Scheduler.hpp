@@ -0,0 +1,118 @@
+/*
+ * Scheduler.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <vector>
+#include <map>
+#include <pthread.h>
+
+#include "Interpreter.hpp"
+#include "Machine.hpp"
+#include "Message.hpp"
+#include "Mutex.hpp"
+
+class Program;
+
+// Runs the green threads of a machine M:N, on a pool of OS threads called carriers, so that threads doing work can use
+// every core. The machine itself is the first carrier, running on the OS thread that runs the program, and the others
+// each have a machine and interpreter of their own, bound to the same program. Each thread is run on the carrier that
+// had the fewest threads when it was spawned, N:1 alongside the others there, and never moves, so that the carriers
+// never share a heap (see Machine::spawn). Carriers only take the mutex to hand threads and wakeups to each other, and
+// an OS thread only sleeps while every thread on its carrier is waiting.
+// Carriers are started when a thread is first spawned, and the threads are stopped when the main one finishes or any
+// of them fails. Machines poll for that at calls and backward jumps (safepoints).
+// With a single carrier, which is the default, threads are simply run N:1 on the machine
+
+class Scheduler
+{
+public:
+    // Carriers' interpreters have the given options (of which only O_DISABLE_JIT has any effect)
+    Scheduler(Machine & machine, const Program & program, unsigned optionCount, const Interpreter::Option * options);
+    ~Scheduler();
+
+    // How many carriers threads are spread over, including the machine itself (0 is taken as 1). Takes effect from the
+    // next time the machine starts running threads
+    void setCarrierCount(unsigned carrierCount);
+    unsigned carrierCount() const;
+
+private:
+    friend class Machine; // Which does the scheduling itself, mostly under the mutex
+
+    // What a thread leaves behind for the one that joins it, and how to wake those that are waiting to. Indexed by the
+    // ids threads are given in the program, which are unique across the carriers
+    struct ThreadRecord
+    {
+        unsigned id;
+        unsigned carrier, localId; // Where the thread runs, and its index in that machine's threads
+        unsigned codeIndex, exitAddress; // For the carrier to start it with
+        bool hasArgument, finished;
+        Message message; // The thread's argument until it starts, then its result once it finishes
+        std::vector<unsigned> joiners; // The ids of the threads waiting for it to finish
+    };
+
+    struct Carrier
+    {
+        Carrier();
+
+        Machine * machine;
+        Interpreter * interpreter; // NULL for the machine itself, as are the rest
+        pthread_t thread;
+        Condition condition; // For the carrier to sleep on while none of its threads are ready
+        bool parked;
+        bool idle; // Whether the carrier has had no threads to run since it last ran out of them
+        unsigned threadCount; // How many threads that haven't finished are run on the carrier
+        // Threads for the carrier to start, and the indices in its machine of those to wake. pending is set while
+        // either has anything in it, so that the carrier can check without taking the mutex
+        std::vector<ThreadRecord*> starts;
+        std::vector<unsigned> wakes;
+        unsigned char pending;
+    };
+
+    Machine & machine;
+    const Program & program;
+    std::vector<Interpreter::Option> options;
+
+    Mutex mutex; // Guards everything below
+    std::vector<Carrier*> carriers; // Only ever added to, as carriers past the count just stay idle
+    unsigned carrierCount_;
+    std::vector<ThreadRecord*> threads; // NULL where an id is free
+    std::map<unsigned, Machine::SharedChannel> channels; // The channels threads use while they're multiplexed, by id
+    // Set while the threads are being stopped, which is polled without taking the mutex
+    unsigned char stopRequested;
+    bool failed; // Whether a thread has failed since the machine was last flushed
+    bool destroying;
+    // How many carriers are running threads, i.e. aren't parked, and how many other than the machine have been given
+    // any to run since they were last idle
+    unsigned runningCarriers, busyCarriers;
+    unsigned exitAddress; // Where the code ends, for threads to go to when they are stopped
+
+    Mutex ioMutex; // Guards the machine's input and output while the threads are multiplexed
+
+    // Starts the carriers if there aren't enough yet. Returns false if there are to be none. Called with the mutex
+    // unlocked, while no thread is running
+    bool start();
+    static void * runCarrier(void * carrier);
+
+    // These are called with the mutex locked
+    unsigned addThread(ThreadRecord * record); // Returns the thread's id
+    void wake(unsigned carrier, unsigned localId);
+    void deliver(Carrier & carrier); // Marks the carrier as having something pending, and unparks it
+    // Sleeps until something is delivered to the carrier. Returns false if the threads are being stopped instead.
+    // Throws if no other carrier is running, as its threads would then wait forever
+    bool park(Carrier & carrier);
+    void requestStop();
+    void unparkAll();
+    // Forgets every thread and the channels they used, once the carriers are idle
+    void clear();
+
+    Scheduler(const Scheduler &);
+    Scheduler & operator =(const Scheduler &);
+};
+
+#endif // SCHEDULER_HPP
@@ -13,21 +13,16 @@
 #include "Stack.hpp"
 #include "Block.hpp"
 
-const unsigned Stack::defaultSize = USHRT_MAX + 1;
+const unsigned Stack::defaultMaximumSize = 1u << 22, Stack::initialSize = 1024;
 
-Stack::Stack(const unsigned size)
-    : size_(size == 0 ? defaultSize : size), pointer(0), combinedFramePointer(0), data(size_, Block())
+Stack::Stack(const unsigned maximumSize)
+    : pointer(0), combinedFramePointer(0), data(initialSize, maximumSize == 0 ? defaultMaximumSize : maximumSize),
+      deepest(0)
 {
+    size_ = data.count();
     framePointerStack.reserve(size_ / 4); // Just an arbitrary value really
 }
 
-void Stack::push(const Block & data_)
-{
-    if (combinedFramePointer + pointer >= size_) throw(std::runtime_error("Stack::push: Stack overflow"));
-    data[combinedFramePointer + pointer] = data_;
-    ++pointer;
-}
-
 void Stack::pop()
 {
     if (pointer == 0) throw(std::runtime_error("Stack::pop: Stack underflow"));
@@ -46,36 +41,18 @@ const Block & Stack::peek() const
     return data[combinedFramePointer + pointer - 1];
 }
 
-Block & Stack::at(const unsigned index)
-{
-    if (index >= pointer) throw(std::out_of_range("Stack::at: Stack block index out of range"));
-    return data[combinedFramePointer + index];
-}
-
 const Block & Stack::at(const unsigned index) const
 {
     if (index >= pointer) throw(std::out_of_range("Stack::at: Stack block index out of range"));
     return data[combinedFramePointer + index];
 }
 
-Block & Stack::fromTop(const unsigned index)
-{
-    if (index >= pointer) throw(std::out_of_range("Stack::fromTop: Stack block index out of range"));
-    return data[combinedFramePointer + pointer - 1 - index];
-}
-
 const Block & Stack::fromTop(const unsigned index) const
 {
     if (index >= pointer) throw(std::out_of_range("Stack::fromTop: Stack block index out of range"));
     return data[combinedFramePointer + pointer - 1 - index];
 }
 
-Block & Stack::fromTopBelow(const unsigned index)
-{
-    if (index >= combinedFramePointer)
-        throw(std::out_of_range("Stack::fromTopBelow: Stack block index out of range"));
-    return data[combinedFramePointer - 1 - index];
-}
 const Block & Stack::fromTopBelow(const unsigned index) const
 {
     if (index >= combinedFramePointer)
@@ -85,9 +62,12 @@ const Block & Stack::fromTopBelow(const unsigned index) const
 
 void Stack::pushFrame()
 {
+    if ((combinedFramePointer + pointer >= size_) && !grow(combinedFramePointer + pointer + 1))
+        throw(std::runtime_error("Stack::pushFrame: Stack overflow"));
     combinedFramePointer += ++pointer; // reserve a space for return value
     framePointerStack.push_back(pointer);
     pointer = 0;
+    recordDepth();
 }
 
 void Stack::popFrame(const Block * returnValue)
@@ -101,7 +81,7 @@ void Stack::popFrame(const Block * returnValue)
     for ( ; oldPointer > pointer; --oldPointer) data[combinedFramePointer + oldPointer].clear();
 
     if (returnValue == NULL) --pointer, --combinedFramePointer;
-    else data[combinedFramePointer - 1] = *returnValue;
+    else if (returnValue != &data[combinedFramePointer - 1]) data[combinedFramePointer - 1] = *returnValue;
     combinedFramePointer -= pointer;
 }
 
@@ -120,8 +100,27 @@ unsigned Stack::size() const
     return size_;
 }
 
+Block * Stack::blocks()
+{
+    return &data[0];
+}
+
+unsigned Stack::depth() const
+{
+    return combinedFramePointer + pointer;
+}
+
 void Stack::flush()
 {
-    for (unsigned i = 0; i < data.size(); ++i) data[i].nullifyPointerData();
-    combinedFramePointer = pointer = 0;
+    // Blocks above the deepest the stack has been were last cleared by the previous flush, if they were used at all
+    for (unsigned i = 0; i < deepest; ++i) data[i].nullifyPointerData();
+    combinedFramePointer = pointer = deepest = 0;
+    framePointerStack.clear();
+}
+
+bool Stack::grow(const unsigned size)
+{
+    if (!data.grow(size)) return false;
+    size_ = data.count();
+    return true;
 }
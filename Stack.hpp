@@ -9,15 +9,20 @@
 #define STACK_HPP
 
 #include <vector>
+#include <stdexcept>
+#include <algorithm>
 
-class Block;
+#include "Block.hpp"
+#include "BlockRegion.hpp"
+
+// Grows on demand, up to a maximum size
 
 class Stack
 {
 public:
-    static const unsigned defaultSize;
+    static const unsigned defaultMaximumSize, initialSize;
 
-    Stack(unsigned size);
+    Stack(unsigned maximumSize); // 0 for the default
 
     void push(const Block & data);
     void pop();
@@ -36,14 +41,76 @@ public:
 
     bool empty() const;
     unsigned count() const;
-    unsigned size() const;
+    unsigned size() const; // How many blocks the stack has grown to
+
+    // Every block of the stack, counting from the bottom rather than the current frame, and how many of them are in use
+    // by any frame. For the garbage collector
+    Block * blocks();
+    unsigned depth() const;
+    // For code that moves the stack pointer without calling push, so that flush knows how far the stack has been used
+    void recordDepth();
 
-    void flush();
+    void flush(); // Only clears the blocks that have been used since the last flush
+    // Exchanges everything in the two stacks. Blocks stay where they are, so pointers to them remain valid (for the
+    // stack they now belong to)
+    void swap(Stack & other);
 
 private:
-    unsigned size_, pointer, combinedFramePointer;
-    std::vector<Block> data;
+    friend class Jit; // Native code works on the stack directly
+
+    unsigned size_, pointer, combinedFramePointer; // size_ mirrors data.count(), for native code to read
+    BlockRegion data;
     std::vector<unsigned> framePointerStack;
+    unsigned deepest; // The most blocks that have been in use at once since the last flush
+
+    bool grow(unsigned size);
 };
 
+// The accessors used to fetch operands, and push, are defined here so that they can be inlined into the interpreter's
+// handlers
+
+inline void Stack::push(const Block & data_)
+{
+    if ((combinedFramePointer + pointer >= size_) && !grow(combinedFramePointer + pointer + 1))
+        throw(std::runtime_error("Stack::push: Stack overflow"));
+    data[combinedFramePointer + pointer] = data_;
+    ++pointer;
+    recordDepth();
+}
+
+inline void Stack::recordDepth()
+{
+    if (combinedFramePointer + pointer > deepest) deepest = combinedFramePointer + pointer;
+}
+
+inline Block & Stack::at(const unsigned index)
+{
+    if (index >= pointer) throw(std::out_of_range("Stack::at: Stack block index out of range"));
+    return data[combinedFramePointer + index];
+}
+
+inline Block & Stack::fromTop(const unsigned index)
+{
+    if (index >= pointer) throw(std::out_of_range("Stack::fromTop: Stack block index out of range"));
+    return data[combinedFramePointer + pointer - 1 - index];
+}
+
+inline Block & Stack::fromTopBelow(const unsigned index)
+{
+    if (index >= combinedFramePointer)
+        throw(std::out_of_range("Stack::fromTopBelow: Stack block index out of range"));
+    return data[combinedFramePointer - 1 - index];
+}
+
+// Inlined as it's part of every switch between threads (see Machine)
+inline void Stack::swap(Stack & other)
+{
+    std::swap(size_, other.size_);
+    std::swap(pointer, other.pointer);
+    std::swap(combinedFramePointer, other.combinedFramePointer);
+    data.swap(other.data);
+    framePointerStack.swap(other.framePointerStack);
+    std::swap(deepest, other.deepest);
+}
+
 #endif // STACK_HPP
@@ -0,0 +1,24 @@
+/*
+ * StringHash.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef STRINGHASH_HPP
+#define STRINGHASH_HPP
+
+// FNV-1a hash of a null-terminated string, looking at no more than maxLength characters
+
+inline unsigned hashString(const char * const str, const unsigned maxLength = ~0u)
+{
+    unsigned value = 2166136261u;
+    for (unsigned i = 0; (i < maxLength) && (str[i] != '\0'); ++i)
+    {
+        value ^= (unsigned char)str[i];
+        value *= 16777619u;
+    }
+    return value;
+}
+
+#endif // STRINGHASH_HPP
@@ -6,25 +6,42 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <exception>
 #include <cstring>
+#include <cstdlib>
 
 #include "Machine.hpp"
 #include "Interpreter.hpp"
+#include "Program.hpp"
+#include "BatchRunner.hpp"
+#include "Compiler.hpp"
 
-void parseCommandLineArguments(int argc, char * argv[], std::vector<Interpreter::Option> & options, char ** fileName);
+void parseCommandLineArguments(int argc, char * argv[], std::vector<Interpreter::Option> & options,
+                               ManagedHeap::CollectionMode & collectionMode, char ** fileName,
+                               std::vector<char*> & inputFileNames, unsigned & workerCount);
+int runBatch(const char * fileName, const std::vector<char*> & inputFileNames, unsigned workerCount,
+             ManagedHeap::CollectionMode collectionMode, const std::vector<Interpreter::Option> & options);
 
 int main(int argc, char * argv[])
 {
-    Machine machine;
-
     char * fileName = NULL;
     std::vector<Interpreter::Option> options;
-    parseCommandLineArguments(argc, argv, options, &fileName);
+    ManagedHeap::CollectionMode collectionMode = ManagedHeap::CM_REFERENCE_COUNTING;
+    std::vector<char*> inputFileNames;
+    unsigned workerCount = 0;
+    parseCommandLineArguments(argc, argv, options, collectionMode, &fileName, inputFileNames, workerCount);
+
+    // Any files after the program are inputs to run it on, as a batch
+    if (!inputFileNames.empty()) return runBatch(fileName, inputFileNames, workerCount, collectionMode, options);
+
+    Machine machine(0, 0, 0, collectionMode);
 
     if (fileName != NULL)
     {
         Interpreter interpreter(machine, fileName, options.size(), options.data());
+        interpreter.setParallelWorkerCount(workerCount);
         interpreter.run();
     }
     else
@@ -36,30 +53,112 @@ int main(int argc, char * argv[])
     return 0;
 }
 
-void addOption(std::vector<Interpreter::Option> & options, const char option)
+void addOption(std::vector<Interpreter::Option> & options, ManagedHeap::CollectionMode & collectionMode,
+               const char option)
 {
     switch (option)
     {
     case 't': options.push_back(Interpreter::O_TIME_EXECUTION); break;
+    case 's': options.push_back(Interpreter::O_DUMP_SUPERINSTRUCTIONS); break;
+    case 'n': options.push_back(Interpreter::O_DISABLE_JIT); break;
+    case 'q': options.push_back(Interpreter::O_QUICKENING_STATISTICS); break;
+    case 'a': options.push_back(Interpreter::O_ALLOCATOR_STATISTICS); break;
+    case 'm': collectionMode = ManagedHeap::CM_MARK_SWEEP; break;
     default: break;
     }
 }
 
-void addOption(std::vector<Interpreter::Option> & options, const char * option)
+void addOption(std::vector<Interpreter::Option> & options, ManagedHeap::CollectionMode & collectionMode,
+               const char * option)
 {
     if (strcmp(option, "time") == 0) options.push_back(Interpreter::O_TIME_EXECUTION);
+    else if (strcmp(option, "superinstructions") == 0) options.push_back(Interpreter::O_DUMP_SUPERINSTRUCTIONS);
+    else if (strcmp(option, "nojit") == 0) options.push_back(Interpreter::O_DISABLE_JIT);
+    else if (strcmp(option, "quickening") == 0) options.push_back(Interpreter::O_QUICKENING_STATISTICS);
+    else if (strcmp(option, "allocator") == 0) options.push_back(Interpreter::O_ALLOCATOR_STATISTICS);
+    else if (strcmp(option, "marksweep") == 0) collectionMode = ManagedHeap::CM_MARK_SWEEP;
 }
 
-void parseCommandLineArguments(int argc, char * argv[], std::vector<Interpreter::Option> & options, char ** fileName)
+void parseCommandLineArguments(int argc, char * argv[], std::vector<Interpreter::Option> & options,
+                               ManagedHeap::CollectionMode & collectionMode, char ** fileName,
+                               std::vector<char*> & inputFileNames, unsigned & workerCount)
 {
     if (argc > 1) options.reserve(argc - 1); // -1 because the first option is always the path of the executable
     for (int i = 1; i < argc; ++i)
     {
-        if (strstr(argv[i], "--") == argv[i]) addOption(options, argv[i][2]);
+        if (strstr(argv[i], "--") == argv[i]) addOption(options, collectionMode, argv[i][2]);
         else if (strstr(argv[i], "-") == argv[i])
         {
-            for (int j = 1; argv[i][j] != '\0'; ++j) addOption(options, argv[i][j]);
+            for (int j = 1; argv[i][j] != '\0'; ++j)
+            {
+                // -j is followed by the number of worker threads for a batch, or for pmap, preduce and green threads
+                if (argv[i][j] == 'j')
+                {
+                    char * end;
+                    workerCount = strtoul(argv[i] + j + 1, &end, 10);
+                    j = end - argv[i] - 1;
+                }
+                else addOption(options, collectionMode, argv[i][j]);
+            }
+        }
+        else if (*fileName == NULL) *fileName = argv[i];
+        else inputFileNames.push_back(argv[i]);
+    }
+}
+
+int runBatch(const char * const fileName, const std::vector<char*> & inputFileNames, const unsigned workerCount,
+             const ManagedHeap::CollectionMode collectionMode, const std::vector<Interpreter::Option> & options)
+{
+    int result = 0;
+    try
+    {
+        Program program(fileName);
+
+        // Inputs are read up front, so that there is no limit on how many files can be open at once. One that can't be
+        // opened is skipped, and the batch counts as failed
+        std::vector<std::istringstream*> inputs(inputFileNames.size(), NULL);
+        std::vector<std::ostringstream*> outputs(inputFileNames.size(), NULL);
+        BatchRunner runner(program, workerCount, collectionMode, options.size(), options.data());
+        for (unsigned i = 0; i < inputFileNames.size(); ++i)
+        {
+            std::ifstream file(inputFileNames[i]);
+            if (!file.is_open())
+            {
+                std::cout << "Input file '" << inputFileNames[i] << "' could not be opened" << std::endl;
+                result = 1;
+                continue;
+            }
+            std::stringstream contents;
+            contents << file.rdbuf();
+            inputs[i] = new std::istringstream(contents.str());
+            outputs[i] = new std::ostringstream;
+            runner.add(*inputs[i], *outputs[i]);
+        }
+
+        runner.run();
+
+        // Outputs are written in the order of the inputs, whichever order the jobs finished in
+        for (unsigned i = 0; i < outputs.size(); ++i)
+        {
+            if (outputs[i] != NULL) std::cout << outputs[i]->str();
+            delete inputs[i];
+            delete outputs[i];
         }
-        else *fileName = argv[i];
+        runner.reportStatistics(std::cout);
     }
+    catch (const Compiler::Error & e)
+    {
+        std::cout << "Error on line " << e.line + 1 << std::endl
+                  << e.what() << std::endl
+                  << "Execution halted" << std::endl;
+        result = 1;
+    }
+    catch (const std::exception & e)
+    {
+        std::cout << e.what() << std::endl
+                  << "Execution halted" << std::endl;
+        result = 1;
+    }
+
+    return result;
 }
@@ -11,6 +11,8 @@
 #include "Token.hpp"
 #include "TypeWrappers.hpp"
 
+const unsigned Token::firstRegisterLocation, Token::primaryRegisterLocation, Token::managedOutRegisterLocation;
+
 Token::Token()
     : type(T_NULL), isPointer(false) {}
 
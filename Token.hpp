@@ -10,6 +10,7 @@
 
 #include "Block.hpp"
 #include "ComparisonFlagRegister.hpp"
+#include "Opcodes.hpp"
 
 class Integer;
 class Real;
@@ -31,11 +32,17 @@ struct Token
         T_OPERAND_STACK_BOTTOM,
         T_OPERAND_STACK_NEGATIVE,
         T_OPERAND_COMPARISON_FLAG_ID,
+        T_OPERAND_REDUCTION,
         T_OPERAND_NIL,
         T_LABEL,
         T_NULL
     };
 
+    // Static locations from here up stand for the registers rather than places in the unmanaged heap
+    static const unsigned firstRegisterLocation = ~0u - 1,
+                          primaryRegisterLocation = firstRegisterLocation,
+                          managedOutRegisterLocation = firstRegisterLocation + 1;
+
     Token();
     Token(const unsigned char opcode);
 
@@ -60,8 +67,9 @@ struct Token
         Block::DataType dataTypeData;
         unsigned stackPositionData, labelLineNumberData;
         CFR::ComparisonFlagId comparisonFlagData;
+        Opcodes::Reduction reductionData;
         char labelData[Label::length + 1];
-        Block * locationData;
+        unsigned locationData; // An address in the unmanaged heap, or one of the register locations
     };
 };
 
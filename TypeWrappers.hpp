@@ -50,7 +50,11 @@ struct Label
 
     char value[length + 1];
     unsigned line;
-    explicit Label(const char * value_, const unsigned line) : line(line) { strncpy(value, value_, length); }
+    explicit Label(const char * value_, const unsigned line) : line(line)
+    {
+        strncpy(value, value_, length);
+        value[length] = '\0';
+    }
 };
 
 struct StackLocation
@@ -0,0 +1,130 @@
+/*
+ * WorkerPool.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdexcept>
+#include <exception>
+#include <unistd.h>
+
+#include "WorkerPool.hpp"
+
+WorkerPool::WorkerPool(unsigned workerCount)
+    : task(NULL), partCount(0), nextPart(0), taskNumber(0), busyCount(0), failed(false), stopping(false)
+{
+    if (workerCount == 0) workerCount = processorCount();
+
+    threads.reserve(workerCount - 1);
+    for (unsigned i = 1; i < workerCount; ++i)
+    {
+        threads.push_back(Thread());
+        Thread & thread = threads.back();
+        thread.pool = this;
+        thread.index = i;
+        if (pthread_create(&thread.thread, NULL, &runThread, &thread) != 0)
+        {
+            threads.pop_back();
+            break;
+        }
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        Mutex::Lock lock(mutex);
+        stopping = true;
+        taskReady.signalAll();
+    }
+    for (unsigned i = 0; i < threads.size(); ++i) pthread_join(threads[i].thread, NULL);
+}
+
+unsigned WorkerPool::workerCount() const
+{
+    return threads.size() + 1;
+}
+
+unsigned WorkerPool::processorCount()
+{
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+}
+
+void WorkerPool::run(Task & task, const unsigned partCount)
+{
+    if (partCount == 0) return;
+
+    {
+        Mutex::Lock lock(mutex);
+        this->task = &task;
+        this->partCount = partCount;
+        nextPart = 0;
+        failed = false;
+        error.clear();
+
+        // A task with only one part isn't worth waking anyone up for
+        if ((partCount > 1) && !threads.empty())
+        {
+            busyCount = threads.size();
+            ++taskNumber;
+            taskReady.signalAll();
+        }
+    }
+
+    runParts(0);
+
+    {
+        Mutex::Lock lock(mutex);
+        while (busyCount != 0) taskFinished.wait(mutex);
+        this->task = NULL;
+    }
+    if (failed) throw(std::runtime_error(error));
+}
+
+void * WorkerPool::runThread(void * const thread)
+{
+    Thread & self = *static_cast<Thread*>(thread);
+    self.pool->work(self.index);
+    return NULL;
+}
+
+void WorkerPool::work(const unsigned worker)
+{
+    unsigned lastTaskNumber = 0;
+    while (true)
+    {
+        {
+            Mutex::Lock lock(mutex);
+            while ((taskNumber == lastTaskNumber) && !stopping) taskReady.wait(mutex);
+            if (stopping) return;
+            lastTaskNumber = taskNumber;
+        }
+
+        runParts(worker);
+
+        {
+            Mutex::Lock lock(mutex);
+            if (--busyCount == 0) taskFinished.signalAll();
+        }
+    }
+}
+
+void WorkerPool::runParts(const unsigned worker)
+{
+    while (true)
+    {
+        const unsigned part = __atomic_fetch_add(&nextPart, 1, __ATOMIC_RELAXED);
+        if (part >= partCount) return;
+        if (__atomic_load_n(&failed, __ATOMIC_RELAXED)) continue;
+
+        try { task->runPart(worker, part); }
+        catch (const std::exception & e)
+        {
+            Mutex::Lock lock(mutex);
+            if (!failed) error = e.what();
+            __atomic_store_n(&failed, true, __ATOMIC_RELAXED);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * WorkerPool.hpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+#include "Mutex.hpp"
+
+// A set of threads that are kept waiting to share out the parts of a task with the thread that runs it, so that
+// splitting work up doesn't cost a thread start each time. Parts are handed out one at a time, so a worker that
+// finishes its part early just takes the next one
+
+class WorkerPool
+{
+public:
+    class Task
+    {
+    public:
+        virtual ~Task() {}
+        // worker is 0 for the thread that called run, so that each worker can keep state of its own
+        virtual void runPart(unsigned worker, unsigned part) = 0;
+    };
+
+    // workerCount includes the thread that calls run, so a pool of one starts no threads. 0 for one per processor
+    explicit WorkerPool(unsigned workerCount = 0);
+    ~WorkerPool();
+
+    unsigned workerCount() const; // Fewer than asked for if some of the threads couldn't be started
+    static unsigned processorCount();
+    // Runs parts 0 to partCount - 1 of task, returning once they have all finished. If a part throws, the parts that
+    // haven't started yet are skipped and its error is thrown from here
+    void run(Task & task, unsigned partCount);
+
+private:
+    struct Thread
+    {
+        WorkerPool * pool;
+        unsigned index;
+        pthread_t thread;
+    };
+
+    Mutex mutex;
+    Condition taskReady, taskFinished;
+    std::vector<Thread> threads; // Reserved up front, as each thread holds a pointer to its own
+    Task * task;
+    unsigned partCount, nextPart; // nextPart is claimed atomically while a task runs
+    unsigned taskNumber; // Counts tasks handed to the threads, so that they can tell a new one from the last
+    unsigned busyCount; // Threads still working on the current task
+    bool failed, stopping;
+    std::string error;
+
+    static void * runThread(void * thread);
+    void work(unsigned worker);
+    void runParts(unsigned worker);
+
+    WorkerPool(const WorkerPool &);
+    WorkerPool & operator =(const WorkerPool &);
+};
+
+#endif // WORKERPOOL_HPP
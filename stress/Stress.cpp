@@ -0,0 +1,157 @@
+/*
+ * Stress.cpp
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+// Runs each program given on several threads at once, all of them sharing one Program, and checks that every run
+// outputs what the program outputs when it's run on its own. Each program is run with the JIT, without it, with
+// mark-sweep collection, and with its green threads spread over four carriers (see Scheduler). Every run is given what
+// was on standard input as its input. Exits with 1 if any run differed, or any program couldn't be loaded. Usage:
+//     Stress <threads> <runs per thread> <program>...
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <pthread.h>
+
+#include "Machine.hpp"
+#include "Interpreter.hpp"
+#include "Program.hpp"
+
+struct Configuration
+{
+    const char * name;
+    ManagedHeap::CollectionMode collectionMode;
+    bool disableJit;
+    unsigned parallelWorkerCount;
+};
+
+const Configuration configurations[] =
+{
+    { "JIT", ManagedHeap::CM_REFERENCE_COUNTING, false, 1 },
+    { "no JIT", ManagedHeap::CM_REFERENCE_COUNTING, true, 1 },
+    { "mark-sweep", ManagedHeap::CM_MARK_SWEEP, false, 1 },
+    { "4 carriers", ManagedHeap::CM_REFERENCE_COUNTING, false, 4 }
+};
+
+// What each thread is given to run, and how many of its runs output something other than expected
+struct Runs
+{
+    const Program * program;
+    const Configuration * configuration;
+    unsigned runCount;
+    const std::string * input, * expected;
+    unsigned differed;
+    pthread_t thread;
+};
+
+std::string runAlone(const Program & program, const std::string & input);
+// Returns how many of the runs output something other than expected
+unsigned runTogether(const Program & program, const Configuration & configuration, unsigned threadCount,
+                     unsigned runCount, const std::string & input, const std::string & expected);
+void * runThread(void * runs);
+
+int main(int argc, char * argv[])
+{
+    if (argc < 4)
+    {
+        std::cout << "Usage: " << argv[0] << " <threads> <runs per thread> <program>..." << std::endl;
+        return 1;
+    }
+    const unsigned threadCount = strtoul(argv[1], NULL, 10), runCount = strtoul(argv[2], NULL, 10);
+
+    std::stringstream inputContents;
+    inputContents << std::cin.rdbuf();
+    const std::string input = inputContents.str();
+
+    int result = 0;
+    for (int i = 3; i < argc; ++i)
+    {
+        try
+        {
+            const Program program(argv[i]);
+            const std::string expected = runAlone(program, input);
+            for (unsigned j = 0; j < sizeof(configurations) / sizeof(configurations[0]); ++j)
+            {
+                const unsigned differed = runTogether(program, configurations[j], threadCount, runCount, input,
+                                                      expected);
+                std::cout << argv[i] << " (" << configurations[j].name << "): " << threadCount * runCount
+                          << " runs on " << threadCount << " threads, ";
+                if (differed == 0) std::cout << "all as expected" << std::endl;
+                else
+                {
+                    std::cout << differed << " differed" << std::endl;
+                    result = 1;
+                }
+            }
+        }
+        catch (const std::exception & e)
+        {
+            std::cout << argv[i] << ": " << e.what() << std::endl;
+            result = 1;
+        }
+    }
+
+    return result;
+}
+
+std::string runAlone(const Program & program, const std::string & input)
+{
+    std::istringstream inputStream(input);
+    std::ostringstream output;
+    Machine machine;
+    machine.setInput(inputStream);
+    machine.setOutput(output);
+    Interpreter interpreter(machine, program, 0, NULL);
+    interpreter.runWithoutOptions();
+    return output.str();
+}
+
+unsigned runTogether(const Program & program, const Configuration & configuration, const unsigned threadCount,
+                     const unsigned runCount, const std::string & input, const std::string & expected)
+{
+    const Runs prototype = { &program, &configuration, runCount, &input, &expected, 0, pthread_t() };
+    std::vector<Runs> threads(threadCount, prototype);
+    unsigned started = 0;
+    for (; started < threadCount; ++started)
+    {
+        if (pthread_create(&threads[started].thread, NULL, &runThread, &threads[started]) != 0) break;
+    }
+
+    // Runs that couldn't be started count as having differed
+    unsigned differed = (threadCount - started) * runCount;
+    for (unsigned i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i].thread, NULL);
+        differed += threads[i].differed;
+    }
+    return differed;
+}
+
+void * runThread(void * const runs)
+{
+    Runs & self = *static_cast<Runs*>(runs);
+    const Interpreter::Option disableJit = Interpreter::O_DISABLE_JIT;
+    for (unsigned i = 0; i < self.runCount; ++i)
+    {
+        std::istringstream input(*self.input);
+        std::ostringstream output;
+        Machine machine(0, 0, 0, self.configuration->collectionMode);
+        machine.setInput(input);
+        machine.setOutput(output);
+        try
+        {
+            Interpreter interpreter(machine, *self.program, self.configuration->disableJit ? 1 : 0, &disableJit);
+            interpreter.setParallelWorkerCount(self.configuration->parallelWorkerCount);
+            interpreter.runWithoutOptions();
+        }
+        catch (const std::exception & e) { output << e.what() << std::endl << "Execution halted" << std::endl; }
+        machine.flush();
+        if (output.str() != *self.expected) ++self.differed;
+    }
+    return NULL;
+}